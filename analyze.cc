@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "gameboy.h"
+#include "cfg.h"
+
+// finds the code in a rom ahead of time and saves its control flow graph
+// next to it (game.gb to game.cfg), then reports how much was found
+// usage: gb-analyze <rom> [--out <path>] [--cached]
+// --cached reuses a saved graph that still matches the rom instead of
+// analysing again.
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <rom> [--out <path>] [--cached]\n", argv[0]);
+        return 1;
+    }
+    std::string rom_name = argv[1];
+    std::string out = rom_name.substr(0, rom_name.find_last_of('.')) + ".cfg";
+    bool cached = false;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i], "--cached")) {
+            cached = true;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::shared_ptr<std::vector<BYTE>> rom = GameBoy::read_rom(rom_name);
+    if (!rom) {
+        return 1;
+    }
+    std::unique_ptr<ControlFlowGraph> cfg;
+    if (cached) {
+        cfg = ControlFlowGraph::load(out, rom->data(), rom->size());
+    }
+    if (cfg) {
+        printf("%s: loaded from %s\n", rom_name.c_str(), out.c_str());
+    } else {
+        cfg = ControlFlowGraph::analyze(rom->data(), rom->size());
+        if (!cfg->save(out)) {
+            return 1;
+        }
+        printf("%s: saved to %s\n", rom_name.c_str(), out.c_str());
+    }
+    cfg->print_coverage();
+    return 0;
+}
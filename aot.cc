@@ -0,0 +1,36 @@
+#include "aot.h"
+#include <vector>
+
+// constructed before main(), in no particular order
+static std::vector<const AotTranslation*>& registered() {
+    static std::vector<const AotTranslation*> translations;
+    return translations;
+}
+
+AotRegistration::AotRegistration(const AotTranslation& translation) {
+    registered().push_back(&translation);
+}
+
+uint64_t aot_rom_hash(const BYTE* rom, size_t rom_size) {
+    uint64_t hash = 14695981039346656037ULL; // fnv-1a
+    for (size_t i = 0; i < rom_size; i++) {
+        hash = (hash ^ rom[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+const AotTranslation* aot_translation(const BYTE* rom, size_t rom_size) {
+    uint64_t hash = 0;
+    for (const AotTranslation* translation : registered()) {
+        if (translation->rom_size != rom_size) {
+            continue;
+        }
+        if (!hash) {
+            hash = aot_rom_hash(rom, rom_size);
+        }
+        if (translation->rom_hash == hash) {
+            return translation;
+        }
+    }
+    return nullptr;
+}
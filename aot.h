@@ -0,0 +1,94 @@
+#pragma once
+#include "gameboy.h"
+#include "cpu_ops.h"
+
+// code recompiled ahead of time from one rom by gb-recompile: a function per
+// basic block the analyzer found (cfg.h), running the block's instructions
+// through the same helpers as CPU::exec() with the operands filled in, and
+// doing between them what the run loop does. Code with no block (in ram, or
+// never found) is interpreted as usual.
+//
+// Between instructions a block doesn't hand time to the units one
+// instruction at a time. It runs up a debt of cycles and pays it in one
+// advance() when the debt reaches GameBoy::quiet_until(), or before an
+// instruction that may touch memory other than rom, work ram and high ram,
+// where the units could tell.
+
+// one call to a block
+struct AotRun {
+    uint64_t end;         // the frame's end, where the run loop stops
+    int interrupt_cycles; // spent taking an interrupt before the block
+    WORD pc;              // where the last instruction run started
+    int executed;         // instructions run
+    const BYTE* rom0;     // the banks mapped on the way in
+    const BYTE* romx;
+    uint64_t quiet;       // GameBoy::quiet_until() when owed was last paid, or 0
+    int owed = 0;         // machine cycles run but not yet advanced
+};
+
+// a block (AotBlock) returns the cycles of its last instruction, and any
+// still owed, for the run loop to account for, or -1 when it stopped early
+// with all of them accounted for
+
+// everything recompiled from one rom
+struct AotTranslation {
+    const char* rom_name;
+    size_t rom_size;
+    uint64_t rom_hash; // aot_rom_hash() of the padded image
+    int blocks;
+    AotBlock (*find)(int bank, WORD pc); // null where there is no block
+};
+
+// a translation linked into the program makes itself known with one of these
+struct AotRegistration {
+    AotRegistration(const AotTranslation& translation);
+};
+
+// the translation linked in for this rom, or null
+const AotTranslation* aot_translation(const BYTE* rom, size_t rom_size);
+uint64_t aot_rom_hash(const BYTE* rom, size_t rom_size);
+
+// before an instruction the units could see: pay the cycles owed
+inline void aot_sync(GameBoy& gb, AotRun& run) {
+    if (run.owed) {
+        gb.advance(run.owed * 4);
+        run.owed = 0;
+    }
+}
+
+// between two instructions of a block: account for the one just run, then
+// say whether the run loop would go straight on to the next. It would not at
+// the end of the frame, to take an interrupt or enable them, or with other
+// code mapped in or an oam dma holding the bus (only possible after a write).
+// Interrupts only come due as time is paid or after a write or ei, so that
+// is where they are looked at; run.quiet starts at 0 to look on the way in.
+// wrote pays at once, as a write may have moved the units' next event.
+template <bool wrote>
+inline bool aot_next(GameBoy& gb, AotRun& run, WORD next) {
+    CPU& cpu = gb.cpu;
+    run.owed += cpu.cycles + run.interrupt_cycles;
+    cpu.cycles = 0;
+    run.interrupt_cycles = 0;
+    run.executed++;
+    if (wrote || cpu.clock + run.owed * 4 >= run.quiet) {
+        aot_sync(gb, run);
+        if (wrote && (cpu.rom0 != run.rom0 || cpu.romx != run.romx || cpu.dma)) {
+            return false;
+        }
+        if (cpu.clock >= run.end || cpu.IME_next || (cpu.IME && cpu.pending)) {
+            return false;
+        }
+        run.quiet = gb.quiet_until(run.end);
+    }
+    run.pc = next;
+    return true;
+}
+
+// the last instruction of a block, left for the run loop with what is owed
+inline int aot_last(CPU& cpu, AotRun& run) {
+    int cycles = cpu.cycles + run.owed;
+    cpu.cycles = 0;
+    run.owed = 0;
+    run.executed++;
+    return cycles;
+}
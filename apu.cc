@@ -0,0 +1,447 @@
+#include "apu.h"
+#include <algorithm>
+#include <cstring>
+
+#define GAIN_SCALE 32 // 4 channels * 15 * 8 * 32 stays inside 16 bits
+
+// bits that always read back as 1, indexed from 0xFF10
+static const BYTE read_mask[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10 - NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20 - NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30 - NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40 - NR44
+    0x00, 0x00, 0x70,             // NR50 - NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const BYTE duty_table[4] = {0b00000001, 0b10000001, 0b10000111, 0b01111110};
+static const int noise_divisor[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+APU::APU() {
+    // sized for the fastest rate first, so set_rate_ratio() never grows them
+    set_rate_ratio(MAX_RATE_RATIO);
+    set_rate_ratio(1);
+    reset();
+}
+
+void APU::reset() {
+    sq1 = Square();
+    sq2 = Square();
+    wave = Wave();
+    noise = Noise();
+    memset(regs, 0, sizeof(regs));
+    powered = true;
+    fs_step = 0;
+    fs_delay = FRAME_SEQUENCER_PERIOD;
+    time = 0;
+    pending = 0;
+    left.clear();
+    right.clear();
+
+    // post boot rom register values, written without triggering so the
+    // boot chime doesn't replay
+    static const BYTE boot_regs[0x17] = {
+        0x80, 0xBF, 0xF3, 0xFF, 0x3F, 0xFF, 0x3F, 0x00, 0xFF, 0x3F, 0x7F, 0xFF,
+        0x9F, 0xFF, 0x3F, 0xFF, 0xFF, 0x00, 0x00, 0x3F, 0x77, 0xF3, 0xF1
+    };
+    for (int i = 0; i < 0x16; i++) {
+        write(0xFF10 + i, boot_regs[i]);
+    }
+    sq1.enabled = true; // left on by the boot chime, envelope already at zero
+}
+
+Channel& APU::channel(int idx) {
+    switch (idx) {
+        case 0: return sq1;
+        case 1: return sq2;
+        case 2: return wave;
+        default: return noise;
+    }
+}
+
+BYTE APU::read(WORD addr) {
+    int r = addr - 0xFF10;
+    if (r >= 0x20) { // wave ram
+        return regs[r];
+    }
+    if (r == 0x16) {
+        sync(); // length counters may have expired since the last access
+        BYTE status = 0x70 | (powered << 7);
+        for (int i = 0; i < 4; i++) {
+            status |= channel(i).enabled << i;
+        }
+        return status;
+    }
+    return regs[r] | read_mask[r];
+}
+
+void APU::write(WORD addr, BYTE data) {
+    sync();
+    int r = addr - 0xFF10;
+    if (r >= 0x20) { // wave ram
+        regs[r] = data;
+        return;
+    }
+    if (!powered && r != 0x16) {
+        // while powered off only the length counters can be written
+        switch (r) {
+            case 0x01: sq1.length = 64 - (data & 0x3F); break;
+            case 0x06: sq2.length = 64 - (data & 0x3F); break;
+            case 0x0B: wave.length = 256 - data; break;
+            case 0x10: noise.length = 64 - (data & 0x3F); break;
+        }
+        return;
+    }
+    regs[r] = data;
+
+    switch (r) {
+        // square 1
+        case 0x00:
+            sq1.sweep_period = (data >> 4) & 7;
+            sq1.sweep_negate = data & 0b1000;
+            sq1.sweep_shift = data & 7;
+            break;
+        case 0x01:
+            sq1.duty = data >> 6;
+            sq1.length = 64 - (data & 0x3F);
+            break;
+        case 0x02:
+            sq1.dac = data & 0xF8;
+            if (!sq1.dac) sq1.enabled = false;
+            break;
+        case 0x03:
+            sq1.freq = (sq1.freq & 0x700) | data;
+            break;
+        case 0x04:
+            sq1.freq = (sq1.freq & 0xFF) | ((data & 7) << 8);
+            sq1.length_en = data & 0b1000000;
+            if (data & 0b10000000) trigger(0);
+            break;
+        // square 2
+        case 0x06:
+            sq2.duty = data >> 6;
+            sq2.length = 64 - (data & 0x3F);
+            break;
+        case 0x07:
+            sq2.dac = data & 0xF8;
+            if (!sq2.dac) sq2.enabled = false;
+            break;
+        case 0x08:
+            sq2.freq = (sq2.freq & 0x700) | data;
+            break;
+        case 0x09:
+            sq2.freq = (sq2.freq & 0xFF) | ((data & 7) << 8);
+            sq2.length_en = data & 0b1000000;
+            if (data & 0b10000000) trigger(1);
+            break;
+        // wave
+        case 0x0A:
+            wave.dac = data & 0b10000000;
+            if (!wave.dac) wave.enabled = false;
+            break;
+        case 0x0B:
+            wave.length = 256 - data;
+            break;
+        case 0x0C: {
+            static const int shifts[4] = {4, 0, 1, 2};
+            wave.volume_shift = shifts[(data >> 5) & 3];
+            break;
+        }
+        case 0x0D:
+            wave.freq = (wave.freq & 0x700) | data;
+            break;
+        case 0x0E:
+            wave.freq = (wave.freq & 0xFF) | ((data & 7) << 8);
+            wave.length_en = data & 0b1000000;
+            if (data & 0b10000000) trigger(2);
+            break;
+        // noise
+        case 0x10:
+            noise.length = 64 - (data & 0x3F);
+            break;
+        case 0x11:
+            noise.dac = data & 0xF8;
+            if (!noise.dac) noise.enabled = false;
+            break;
+        case 0x12:
+            noise.period = noise_divisor[data & 7] << (data >> 4);
+            noise.narrow = data & 0b1000;
+            break;
+        case 0x13:
+            noise.length_en = data & 0b1000000;
+            if (data & 0b10000000) trigger(3);
+            break;
+        // mixer
+        case 0x14:
+        case 0x15:
+            update_gains();
+            break;
+        // power
+        case 0x16:
+            if (!(data & 0b10000000) && powered) {
+                for (int i = 0; i < 0x16; i++) {
+                    write(0xFF10 + i, 0);
+                }
+                for (int i = 0; i < 4; i++) {
+                    channel(i).enabled = false;
+                }
+                powered = false;
+            } else if ((data & 0b10000000) && !powered) {
+                powered = true;
+                fs_step = 0;
+            }
+            break;
+    }
+}
+
+void APU::trigger(int idx) {
+    Channel& ch = channel(idx);
+    ch.enabled = ch.dac;
+    if (ch.length == 0) {
+        ch.length = idx == 2 ? 256 : 64;
+    }
+    switch (idx) {
+        case 0:
+        case 1: {
+            Square& sq = idx == 0 ? sq1 : sq2;
+            BYTE nrx2 = regs[idx == 0 ? 0x02 : 0x07];
+            sq.env.volume = nrx2 >> 4;
+            sq.env.up = nrx2 & 0b1000;
+            sq.env.period = sq.env.timer = nrx2 & 7;
+            sq.delay = (2048 - sq.freq) * 4;
+            if (idx == 0) {
+                sq1.shadow_freq = sq1.freq;
+                sq1.sweep_timer = sq1.sweep_period ? sq1.sweep_period : 8;
+                sq1.sweep_en = sq1.sweep_period || sq1.sweep_shift;
+                if (sq1.sweep_shift) {
+                    calc_sweep(); // overflow check only
+                }
+            }
+            break;
+        }
+        case 2:
+            wave.position = 0;
+            wave.delay = (2048 - wave.freq) * 2;
+            break;
+        case 3:
+            noise.env.volume = regs[0x11] >> 4;
+            noise.env.up = regs[0x11] & 0b1000;
+            noise.env.period = noise.env.timer = regs[0x11] & 7;
+            noise.lfsr = 0x7FFF;
+            noise.delay = noise.period;
+            break;
+    }
+}
+
+void APU::update_gains() {
+    BYTE nr50 = regs[0x14];
+    BYTE nr51 = regs[0x15];
+    int vol_r = ((nr50 & 7) + 1) * GAIN_SCALE;
+    int vol_l = (((nr50 >> 4) & 7) + 1) * GAIN_SCALE;
+    for (int i = 0; i < 4; i++) {
+        Channel& ch = channel(i);
+        int gain_l = (nr51 >> (i + 4)) & 1 ? vol_l : 0;
+        int gain_r = (nr51 >> i) & 1 ? vol_r : 0;
+        // move the channel's current level over to the new gain
+        if (ch.amp && gain_l != ch.gain_l) left.add_delta(time, ch.amp * (gain_l - ch.gain_l));
+        if (ch.amp && gain_r != ch.gain_r) right.add_delta(time, ch.amp * (gain_r - ch.gain_r));
+        ch.gain_l = gain_l;
+        ch.gain_r = gain_r;
+    }
+}
+
+inline void APU::set_amp(Channel& ch, int time, int amp) {
+    int delta = amp - ch.amp;
+    if (delta) {
+        ch.amp = amp;
+        if (ch.gain_l) left.add_delta(time, delta * ch.gain_l);
+        if (ch.gain_r) right.add_delta(time, delta * ch.gain_r);
+    }
+}
+
+void APU::clock_length(Channel& ch) {
+    if (ch.length_en && ch.length > 0 && --ch.length == 0) {
+        ch.enabled = false;
+    }
+}
+
+void APU::clock_envelope(Channel& ch, Envelope& env) {
+    if (env.period == 0 || --env.timer > 0) {
+        return;
+    }
+    env.timer = env.period;
+    if (env.up && env.volume < 15) {
+        env.volume++;
+    } else if (!env.up && env.volume > 0) {
+        env.volume--;
+    }
+}
+
+int APU::calc_sweep() {
+    int delta = sq1.shadow_freq >> sq1.sweep_shift;
+    int freq = sq1.sweep_negate ? sq1.shadow_freq - delta : sq1.shadow_freq + delta;
+    if (freq > 2047) {
+        sq1.enabled = false;
+    }
+    return freq;
+}
+
+void APU::clock_sweep() {
+    if (--sq1.sweep_timer > 0) {
+        return;
+    }
+    sq1.sweep_timer = sq1.sweep_period ? sq1.sweep_period : 8;
+    if (sq1.sweep_en && sq1.sweep_period) {
+        int freq = calc_sweep();
+        if (freq <= 2047 && sq1.sweep_shift) {
+            sq1.freq = sq1.shadow_freq = freq;
+            regs[0x03] = freq & 0xFF;
+            regs[0x04] = (regs[0x04] & 0b11111000) | (freq >> 8);
+            calc_sweep();
+        }
+    }
+}
+
+void APU::clock_frame_sequencer() {
+    // 512 Hz: length at 256 Hz, sweep at 128 Hz, envelope at 64 Hz
+    if (!(fs_step & 1)) {
+        clock_length(sq1);
+        clock_length(sq2);
+        clock_length(wave);
+        clock_length(noise);
+    }
+    if (fs_step == 2 || fs_step == 6) {
+        clock_sweep();
+    }
+    if (fs_step == 7) {
+        clock_envelope(sq1, sq1.env);
+        clock_envelope(sq2, sq2.env);
+        clock_envelope(noise, noise.env);
+    }
+    fs_step = (fs_step + 1) & 7;
+}
+
+void APU::run_square(Square& sq, int start, int end) {
+    int volume = sq.enabled ? sq.env.volume : 0;
+    set_amp(sq, start, (duty_table[sq.duty] >> sq.phase) & 1 ? volume : 0);
+
+    int period = (2048 - sq.freq) * 4;
+    int t = start + sq.delay;
+    if (t < end) {
+        if (!volume) {
+            // silent, just keep the phase moving
+            int count = (end - t + period - 1) / period;
+            sq.phase = (sq.phase + count) & 7;
+            t += count * period;
+        } else {
+            BYTE duty = duty_table[sq.duty];
+            do {
+                sq.phase = (sq.phase + 1) & 7;
+                set_amp(sq, t, (duty >> sq.phase) & 1 ? volume : 0);
+                t += period;
+            } while (t < end);
+        }
+    }
+    sq.delay = t - end;
+}
+
+void APU::run_wave(int start, int end) {
+    bool audible = wave.enabled && wave.volume_shift < 4;
+    BYTE sample = regs[0x20 + wave.position / 2];
+    sample = wave.position & 1 ? sample & 0xF : sample >> 4;
+    set_amp(wave, start, audible ? sample >> wave.volume_shift : 0);
+
+    int period = (2048 - wave.freq) * 2;
+    int t = start + wave.delay;
+    if (t < end) {
+        if (!audible) {
+            int count = (end - t + period - 1) / period;
+            wave.position = (wave.position + count) & 31;
+            t += count * period;
+        } else {
+            do {
+                wave.position = (wave.position + 1) & 31;
+                sample = regs[0x20 + wave.position / 2];
+                sample = wave.position & 1 ? sample & 0xF : sample >> 4;
+                set_amp(wave, t, sample >> wave.volume_shift);
+                t += period;
+            } while (t < end);
+        }
+    }
+    wave.delay = t - end;
+}
+
+void APU::run_noise(int start, int end) {
+    int volume = noise.enabled ? noise.env.volume : 0;
+    set_amp(noise, start, (~noise.lfsr & 1) ? volume : 0);
+
+    int period = noise.period;
+    int t = start + noise.delay;
+    if (t < end) {
+        if (!volume) {
+            // silent, skip the shift register entirely
+            int count = (end - t + period - 1) / period;
+            t += count * period;
+        } else {
+            do {
+                int bit = (noise.lfsr ^ (noise.lfsr >> 1)) & 1;
+                noise.lfsr = (noise.lfsr >> 1) | (bit << 14);
+                if (noise.narrow) {
+                    noise.lfsr = (noise.lfsr & ~0b1000000) | (bit << 6);
+                }
+                set_amp(noise, t, (~noise.lfsr & 1) ? volume : 0);
+                t += period;
+            } while (t < end);
+        }
+    }
+    noise.delay = t - end;
+}
+
+void APU::run_until(int end) {
+    while (time < end) {
+        int next = end < time + fs_delay ? end : time + fs_delay;
+        run_square(sq1, time, next);
+        run_square(sq2, time, next);
+        run_wave(time, next);
+        run_noise(time, next);
+        fs_delay -= next - time;
+        time = next;
+        if (fs_delay == 0) {
+            fs_delay = FRAME_SEQUENCER_PERIOD;
+            if (powered) {
+                clock_frame_sequencer();
+            }
+        }
+    }
+}
+
+void APU::sync() {
+    if (pending) {
+        run_until(time + pending);
+        pending = 0;
+    }
+}
+
+void APU::set_rate_ratio(double ratio) {
+    ratio = std::min(ratio, MAX_RATE_RATIO);
+    left.set_rates(APU_CLOCK_RATE, SAMPLE_RATE * ratio);
+    right.set_rates(APU_CLOCK_RATE, SAMPLE_RATE * ratio);
+}
+
+void APU::end_frame() {
+    sync();
+    left.end_frame(time);
+    right.end_frame(time);
+    time = 0;
+
+    int16_t samples[SAMPLE_RATE / 10 * AUDIO_CHANNELS];
+    int count = left.samples_avail();
+    if (count > SAMPLE_RATE / 10) {
+        count = SAMPLE_RATE / 10;
+    }
+    left.read_samples(samples, count, AUDIO_CHANNELS);
+    right.read_samples(samples + 1, count, AUDIO_CHANNELS);
+    if (output) {
+        output->push(samples, count * AUDIO_CHANNELS); // drops on overflow
+    }
+}
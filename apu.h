@@ -0,0 +1,107 @@
+#pragma once
+#include "cpu.h"
+#include "blip.h"
+#include "audio.h"
+
+#define APU_CLOCK_RATE 4194304
+#define MAX_RATE_RATIO 1.05 // the fastest set_rate_ratio() resamples, buffers are sized for it
+#define FRAME_SEQUENCER_PERIOD 8192 // 512 Hz
+
+// state shared by all four channels
+struct Channel {
+    bool enabled = false;
+    bool dac = false;
+    bool length_en = false;
+    int length = 0;
+    int delay = 0;  // clocks until the frequency timer next expires
+    int amp = 0;    // current output level, 0-15
+    int gain_l = 0; // current mixer gain per side (panning * master volume)
+    int gain_r = 0;
+};
+
+struct Envelope {
+    int volume = 0;
+    int period = 0;
+    int timer = 0;
+    bool up = false;
+};
+
+struct Square : Channel {
+    Envelope env;
+    int freq = 0;
+    int duty = 0;
+    int phase = 0;
+    // sweep, channel 1 only
+    int sweep_period = 0;
+    int sweep_timer = 0;
+    int sweep_shift = 0;
+    bool sweep_negate = false;
+    bool sweep_en = false;
+    int shadow_freq = 0;
+};
+
+struct Wave : Channel {
+    int freq = 0;
+    int position = 0;
+    int volume_shift = 4;
+};
+
+struct Noise : Channel {
+    Envelope env;
+    int period = 8;
+    bool narrow = false;
+    WORD lfsr = 0x7FFF;
+};
+
+class APU {
+    public:
+        APU();
+        void reset();
+
+        // cheap per-instruction hook, actual synthesis is deferred until a
+        // register access or the end of the frame. cycles are of the
+        // 4.19MHz clock, four to a machine cycle.
+        inline void update(int cycles) { pending += cycles; }
+        // finish the frame and push its samples to the output ring
+        void end_frame();
+        // resample slightly faster (> 1) or slower (< 1) than SAMPLE_RATE,
+        // up to MAX_RATE_RATIO. Nothing is allocated, so the emulation
+        // thread can call it between frames.
+        void set_rate_ratio(double ratio);
+        // bytes allocated outside the object
+        size_t footprint() const { return left.footprint() + right.footprint(); }
+
+        BYTE read(WORD addr);
+        void write(WORD addr, BYTE data);
+
+        SampleRing* output = nullptr;
+
+    private:
+        void sync();
+        void run_until(int end);
+        void clock_frame_sequencer();
+        void clock_length(Channel& ch);
+        void clock_envelope(Channel& ch, Envelope& env);
+        void clock_sweep();
+        int calc_sweep();
+        void trigger(int idx);
+        Channel& channel(int idx);
+        void update_gains();
+        inline void set_amp(Channel& ch, int time, int amp);
+        void run_square(Square& sq, int start, int end);
+        void run_wave(int start, int end);
+        void run_noise(int start, int end);
+
+        Square sq1, sq2;
+        Wave wave;
+        Noise noise;
+
+        BYTE regs[0x30]; // 0xFF10 - 0xFF3F, wave ram included
+        bool powered = true;
+        int fs_step = 0;
+        int fs_delay = FRAME_SEQUENCER_PERIOD;
+
+        int time = 0;    // clocks since the start of the blip frame
+        int pending = 0; // clocks not yet synthesized
+        BlipBuffer left, right;
+};
@@ -0,0 +1,84 @@
+#include "audio.h"
+
+RateControl::RateControl(int latency_ms, size_t device_chunk, double max_delta) : max_delta(max_delta) {
+    if (latency_ms < MIN_LATENCY_MS) {
+        latency_ms = MIN_LATENCY_MS;
+    }
+    target_fill = (size_t) SAMPLE_RATE * latency_ms / 1000 * AUDIO_CHANNELS;
+    if (target_fill > SampleRing::capacity() / 2) {
+        target_fill = SampleRing::capacity() / 2;
+    }
+    // the device drains the ring a chunk at a time, so a frontend waiting for
+    // the fill to drop below the target wakes up half a chunk under it on average
+    center = target_fill - device_chunk / 2.0;
+    if (center < target_fill / 2.0) {
+        center = target_fill / 2.0;
+    }
+}
+
+double RateControl::ratio(size_t fill) const {
+    // linear in the distance from the center, so the ratio settles at
+    // whatever offset matches the two clocks
+    double error = (center - (double) fill) / center;
+    if (error > 1) {
+        error = 1;
+    } else if (error < -1) {
+        error = -1;
+    }
+    return 1 + max_delta * error;
+}
+
+void NullSink::drain(SampleRing& ring) {
+    ring.pop(nullptr, ring.size());
+}
+
+WavSink::WavSink(const std::string& path) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Error opening %s for writing\n", path.c_str());
+        return;
+    }
+    write_header(); // placeholder sizes, patched on close
+}
+
+WavSink::~WavSink() {
+    if (file) {
+        fseek(file, 0, SEEK_SET);
+        write_header();
+        fclose(file);
+    }
+}
+
+static void put_le(FILE* f, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((value >> (i * 8)) & 0xFF, f);
+    }
+}
+
+void WavSink::write_header() {
+    fwrite("RIFF", 1, 4, file);
+    put_le(file, 36 + data_bytes, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    put_le(file, 16, 4);                                  // fmt chunk size
+    put_le(file, 1, 2);                                   // pcm
+    put_le(file, AUDIO_CHANNELS, 2);
+    put_le(file, SAMPLE_RATE, 4);
+    put_le(file, SAMPLE_RATE * AUDIO_CHANNELS * 2, 4);    // byte rate
+    put_le(file, AUDIO_CHANNELS * 2, 2);                  // block align
+    put_le(file, 16, 2);                                  // bits per sample
+    fwrite("data", 1, 4, file);
+    put_le(file, data_bytes, 4);
+}
+
+void WavSink::drain(SampleRing& ring) {
+    int16_t chunk[1024];
+    size_t count;
+    while ((count = ring.pop(chunk, 1024)) > 0) {
+        if (file) {
+            for (size_t i = 0; i < count; i++) {
+                put_le(file, (uint16_t) chunk[i], 2);
+            }
+            data_bytes += count * 2;
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#define SAMPLE_RATE 44100
+#define AUDIO_CHANNELS 2
+
+// single producer, single consumer ring buffer; the emulation thread pushes
+// and the audio backend pops without either side ever taking a lock
+template <typename T, size_t SIZE>
+class SpscRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "ring size must be a power of two");
+    public:
+        // returns the number of entries actually written
+        size_t push(const T* data, size_t count) {
+            size_t tail = write_pos.load(std::memory_order_relaxed);
+            size_t head = read_pos.load(std::memory_order_acquire);
+            size_t space = SIZE - (tail - head);
+            if (count > space) {
+                count = space;
+            }
+            for (size_t i = 0; i < count; i++) {
+                buffer[(tail + i) & (SIZE - 1)] = data[i];
+            }
+            write_pos.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        // returns the number of entries actually read
+        size_t pop(T* out, size_t count) {
+            size_t head = read_pos.load(std::memory_order_relaxed);
+            size_t tail = write_pos.load(std::memory_order_acquire);
+            if (count > tail - head) {
+                count = tail - head;
+            }
+            if (out) {
+                for (size_t i = 0; i < count; i++) {
+                    out[i] = buffer[(head + i) & (SIZE - 1)];
+                }
+            }
+            read_pos.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        size_t size() const {
+            return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+        }
+        static constexpr size_t capacity() { return SIZE; }
+
+    private:
+        // keep the two indices on separate cache lines so the threads don't fight over them
+        alignas(64) std::atomic<size_t> write_pos{0};
+        alignas(64) std::atomic<size_t> read_pos{0};
+        alignas(64) T buffer[SIZE];
+};
+
+// interleaved stereo samples, about 370 ms at 44.1 kHz
+typedef SpscRing<int16_t, 1 << 15> SampleRing;
+
+// dynamic rate control for frontends that sync to the audio device: keeps
+// the ring filled to the target latency by resampling slightly faster or
+// slower, which absorbs the drift between the emulated and host clocks
+class RateControl {
+    public:
+        static const int MIN_LATENCY_MS = 20;
+
+        // device_chunk is how many ring entries the device takes per callback
+        RateControl(int latency_ms = 60, size_t device_chunk = 0, double max_delta = 0.005);
+        // queued ring entries the frontend should keep ahead of the device
+        size_t target() const { return target_fill; }
+        // resampling ratio for the next frame given the ring fill at the
+        // moment the frontend stopped waiting
+        double ratio(size_t fill) const;
+
+    private:
+        size_t target_fill;
+        double center; // average fill at wake up when the clocks agree
+        double max_delta;
+};
+
+// consumer side of the ring for frontends without an audio device
+class AudioSink {
+    public:
+        virtual ~AudioSink() {}
+        virtual void drain(SampleRing& ring) = 0;
+};
+
+// throws samples away
+class NullSink : public AudioSink {
+    public:
+        void drain(SampleRing& ring) override;
+};
+
+// writes 16 bit stereo PCM to a .wav file
+class WavSink : public AudioSink {
+    public:
+        WavSink(const std::string& path);
+        ~WavSink();
+        bool is_open() const { return file != nullptr; }
+        void drain(SampleRing& ring) override;
+    private:
+        void write_header();
+        FILE* file = nullptr;
+        uint32_t data_bytes = 0;
+};
@@ -0,0 +1,92 @@
+#include "blip.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+
+int16_t BlipBuffer::step_kernel[BlipBuffer::PHASES][BlipBuffer::HALF_WIDTH * 2];
+
+// windowed sinc low-pass, cutoff just below the output nyquist frequency
+static double lowpass(double x) {
+    const double cutoff = 0.9;
+    const double width = BlipBuffer::HALF_WIDTH;
+    if (std::fabs(x) >= width) {
+        return 0;
+    }
+    double window = 0.42 + 0.5 * std::cos(M_PI * x / width) + 0.08 * std::cos(2 * M_PI * x / width); // blackman
+    double sinc = x == 0 ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+    return cutoff * sinc * window;
+}
+
+void BlipBuffer::init_kernel() {
+    const int steps = 64; // integration steps per output sample
+    for (int p = 0; p < PHASES; p++) {
+        // each tap holds the area of the impulse response covered by one
+        // output sample, so the integrated taps form a band-limited step
+        double frac = (double) p / PHASES;
+        int sum = 0;
+        for (int i = 0; i < HALF_WIDTH * 2; i++) {
+            double start = i - HALF_WIDTH - frac;
+            double area = 0;
+            for (int s = 0; s < steps; s++) {
+                area += lowpass(start + (s + 0.5) / steps) / steps;
+            }
+            step_kernel[p][i] = (int16_t) std::lround(area * (1 << KERNEL_BITS));
+            sum += step_kernel[p][i];
+        }
+        // make each phase sum to exactly unity so steps never drift
+        step_kernel[p][HALF_WIDTH] += (1 << KERNEL_BITS) - sum;
+    }
+}
+
+BlipBuffer::BlipBuffer() {
+    // consoles are made on several threads at once (pools, vecenv)
+    static std::once_flag kernel_ready;
+    std::call_once(kernel_ready, init_kernel);
+}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+    factor = (uint64_t) std::ceil(sample_rate / clock_rate * 4294967296.0);
+    size_t size = (size_t) (sample_rate / 10) + HALF_WIDTH * 2;
+    if (buffer.size() < size) {
+        buffer.resize(size, 0);
+    }
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    integrator = 0;
+    std::fill(buffer.begin(), buffer.end(), 0);
+}
+
+void BlipBuffer::end_frame(uint32_t time) {
+    offset += time * factor;
+}
+
+int BlipBuffer::read_samples(int16_t* out, int count, int stride) {
+    if (count > samples_avail()) {
+        count = samples_avail();
+    }
+    int32_t sum = integrator;
+    for (int i = 0; i < count; i++) {
+        sum += buffer[i];
+        int sample = sum >> KERNEL_BITS;
+        if (sample > 32767) {
+            sample = 32767;
+        } else if (sample < -32768) {
+            sample = -32768;
+        }
+        if (out) {
+            out[i * stride] = (int16_t) sample;
+        }
+        sum -= sample * (1 << (KERNEL_BITS - BASS_SHIFT));
+    }
+    integrator = sum;
+
+    // shift the remaining deltas (including the kernel tail) to the front
+    int remain = samples_avail() - count + HALF_WIDTH * 2;
+    memmove(buffer.data(), buffer.data() + count, remain * sizeof(int32_t));
+    memset(buffer.data() + remain, 0, count * sizeof(int32_t));
+    offset -= (uint64_t) count << 32;
+    return count;
+}
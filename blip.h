@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// band-limited step synthesis: instead of producing a sample every clock,
+// channels report the clock at which their output level changes and the
+// buffer mixes a band-limited step into the output at that point
+class BlipBuffer {
+    public:
+        static const int HALF_WIDTH = 8; // kernel taps on each side of a step
+        static const int PHASES = 32;    // sub-sample resolution of a step
+
+        BlipBuffer();
+        void set_rates(double clock_rate, double sample_rate);
+        void clear();
+
+        // add a change in amplitude at the given clock (relative to frame start)
+        inline void add_delta(uint32_t time, int delta) {
+            uint64_t fixed = time * factor + offset;
+            int32_t* out = buffer.data() + (fixed >> 32);
+            const int16_t* kernel = step_kernel[(fixed >> (32 - PHASE_BITS)) & (PHASES - 1)];
+            for (int i = 0; i < HALF_WIDTH * 2; i++) {
+                out[i] += kernel[i] * delta;
+            }
+        }
+
+        // end the current frame, making samples up to the given clock readable;
+        // the buffer holds a tenth of a second, so read after every frame
+        void end_frame(uint32_t time);
+        int samples_avail() const { return (int) (offset >> 32); }
+        // read up to count samples, writing every stride'th entry of out
+        int read_samples(int16_t* out, int count, int stride);
+        size_t footprint() const { return buffer.capacity() * sizeof(int32_t); }
+
+    private:
+        static const int PHASE_BITS = 5;
+        static const int KERNEL_BITS = 15;
+        static const int BASS_SHIFT = 9; // high-pass to remove the DC offset
+        static int16_t step_kernel[PHASES][HALF_WIDTH * 2];
+        static void init_kernel();
+
+        uint64_t factor = 0; // output samples per clock in 32.32 fixed point
+        uint64_t offset = 0; // fixed point position of the current frame start
+        int32_t integrator = 0;
+        std::vector<int32_t> buffer;
+};
@@ -0,0 +1,139 @@
+#include "capi.h"
+#include "gameboy.h"
+#include "vecenv.h"
+
+struct gb_console {
+    GameBoy gb;
+};
+
+struct gb_state {
+    GameBoy::State state;
+};
+
+struct gb_vecenv {
+    std::unique_ptr<VecEnv> env;
+    std::vector<BYTE> joypads; // the buttons turned to joypad bits
+};
+
+gb_console* gb_create(void) {
+    gb_console* console = new gb_console();
+    console->gb.cpu.mem.flat(); // pinned before anyone holds on to it
+    return console;
+}
+
+void gb_destroy(gb_console* console) {
+    delete console;
+}
+
+int gb_load_rom(gb_console* console, const char* path) {
+    return console->gb.load_rom(path);
+}
+
+int gb_rom_loaded(gb_console* console) {
+    return console->gb.loaded();
+}
+
+void gb_run_frame(gb_console* console) {
+    if (console->gb.loaded()) {
+        console->gb.run_frame();
+    }
+}
+
+int gb_locked_up(gb_console* console, uint16_t* pc) {
+    if (pc) {
+        *pc = console->gb.cpu.locked_at;
+    }
+    return console->gb.cpu.locked;
+}
+
+void gb_set_input(gb_console* console, uint8_t buttons) {
+    console->gb.cpu.set_joypad(~buttons); // the joypad has 0 for held
+}
+
+const uint8_t* gb_framebuffer(gb_console* console) {
+    return &console->gb.cpu.screen[0][0];
+}
+
+const uint8_t* gb_memory(gb_console* console) {
+    return console->gb.cpu.mem.flat();
+}
+
+uint8_t gb_read_mem(gb_console* console, uint16_t addr) {
+    return console->gb.loaded() ? console->gb.cpu.peek(addr) : 0xFF;
+}
+
+size_t gb_read_audio(gb_console* console, int16_t* out, size_t max_frames) {
+    return console->gb.audio.pop(out, max_frames * AUDIO_CHANNELS) / AUDIO_CHANNELS;
+}
+
+gb_state* gb_state_create(void) {
+    return new gb_state();
+}
+
+void gb_state_destroy(gb_state* state) {
+    delete state;
+}
+
+void gb_save_state(gb_console* console, gb_state* state) {
+    if (console->gb.loaded()) {
+        console->gb.save_state(state->state);
+    }
+}
+
+void gb_load_state(gb_console* console, const gb_state* state) {
+    // a state saved on a console with no rom holds nothing
+    if (console->gb.loaded() && state->state.mapper) {
+        console->gb.load_state(state->state);
+    }
+}
+
+gb_vecenv* gb_vecenv_create(const char* path, int count, int frames_per_step, int threads,
+                            int boot_frames) {
+    std::unique_ptr<VecEnv> env = VecEnv::open(path, count, frames_per_step, threads, boot_frames);
+    if (!env) {
+        return nullptr;
+    }
+    gb_vecenv* vecenv = new gb_vecenv();
+    vecenv->env = std::move(env);
+    vecenv->joypads.resize(count);
+    return vecenv;
+}
+
+void gb_vecenv_destroy(gb_vecenv* vecenv) {
+    delete vecenv;
+}
+
+int gb_vecenv_size(gb_vecenv* vecenv) {
+    return vecenv->env->size();
+}
+
+void gb_vecenv_set_obs_mode(gb_vecenv* vecenv, int mode) {
+    vecenv->env->set_obs_mode((ObsMode) mode);
+}
+
+void gb_vecenv_watch_ram(gb_vecenv* vecenv, const uint16_t* addrs, size_t count) {
+    vecenv->env->watch_ram(std::vector<WORD>(addrs, addrs + count));
+}
+
+void gb_vecenv_set_max_frames(gb_vecenv* vecenv, long frames) {
+    vecenv->env->max_frames = frames;
+}
+
+size_t gb_vecenv_obs_size(gb_vecenv* vecenv) {
+    return vecenv->env->obs_size();
+}
+
+void gb_vecenv_step(gb_vecenv* vecenv, const uint8_t* buttons, uint8_t* obs, uint8_t* dones) {
+    for (size_t i = 0; i < vecenv->joypads.size(); i++) {
+        vecenv->joypads[i] = ~buttons[i];
+    }
+    vecenv->env->step(vecenv->joypads.data(), obs, dones);
+}
+
+void gb_vecenv_reset(gb_vecenv* vecenv, uint8_t* obs) {
+    vecenv->env->reset(obs);
+}
+
+uint8_t gb_vecenv_read_mem(gb_vecenv* vecenv, int i, uint16_t addr) {
+    return vecenv->env->env(i).cpu.peek(addr);
+}
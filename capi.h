@@ -0,0 +1,98 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// a plain C interface to the emulator core, for embedding it in other
+// languages. Consoles and states are opaque handles. The framebuffer and
+// memory pointers stay valid (and keep changing in place) for the life of
+// the console, so callers can wrap them once instead of copying per frame.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gb_console gb_console;
+typedef struct gb_state gb_state;
+typedef struct gb_vecenv gb_vecenv;
+
+// gb_set_input bits, 1 for held
+#define GB_BUTTON_RIGHT  0x01
+#define GB_BUTTON_LEFT   0x02
+#define GB_BUTTON_UP     0x04
+#define GB_BUTTON_DOWN   0x08
+#define GB_BUTTON_A      0x10
+#define GB_BUTTON_B      0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START  0x80
+
+#define GB_SCREEN_WIDTH  160
+#define GB_SCREEN_HEIGHT 144
+
+gb_console* gb_create(void);
+void gb_destroy(gb_console* gb);
+// 1 on success; battery ram goes to a .sav file next to the rom
+int gb_load_rom(gb_console* gb, const char* path);
+// 1 once a rom is loaded. Until then running, reading memory and states
+// do nothing (reads give 0xFF).
+int gb_rom_loaded(gb_console* gb);
+// one frame, 1/59.73s of emulated time
+void gb_run_frame(gb_console* gb);
+// 1 once the cpu has run an opcode that doesn't exist. It hangs for good
+// then, as the real one does, until the next gb_load_rom. *pc (if pc isn't
+// NULL) is set to where the opcode is.
+int gb_locked_up(gb_console* gb, uint16_t* pc);
+void gb_set_input(gb_console* gb, uint8_t buttons);
+
+// rows of 160 pixels, 144 * 160 bytes, each a grey level from 0xFF
+// (white) through 0xCC and 0x77 to 0x00 (black)
+const uint8_t* gb_framebuffer(gb_console* gb);
+// the 64KB address space as memory holds it, which isn't always what the
+// cpu reads: rom and cartridge ram are banked elsewhere and read back as
+// zero or stale, and registers worked out on read (the joypad, serial,
+// timer, LY, STAT and sound) are stale too. Use gb_read_mem for those.
+const uint8_t* gb_memory(gb_console* gb);
+// a read as the cpu would see it with the bus free, banking and registers
+// included
+uint8_t gb_read_mem(gb_console* gb, uint16_t addr);
+// sound since the last call as interleaved stereo int16, returns frames read
+size_t gb_read_audio(gb_console* gb, int16_t* out, size_t max_frames);
+
+// a state restores on any console running the same rom
+gb_state* gb_state_create(void);
+void gb_state_destroy(gb_state* state);
+void gb_save_state(gb_console* gb, gb_state* state);
+void gb_load_state(gb_console* gb, const gb_state* state);
+
+// a batch of consoles on one rom, stepped together on a pool of threads
+// (see vecenv.h). Each console's observation is its picture, followed by
+// the watched ram bytes in the order given.
+#define GB_OBS_RGB       0 // 160x144x3
+#define GB_OBS_GRAY      1 // 160x144
+#define GB_OBS_GRAY_HALF 2 // 80x72, 2x2 averaged
+
+// NULL if the rom can't be loaded. boot_frames run once before the start
+// state is taken; threads 0 picks one per core
+gb_vecenv* gb_vecenv_create(const char* path, int count, int frames_per_step, int threads,
+                            int boot_frames);
+void gb_vecenv_destroy(gb_vecenv* env);
+int gb_vecenv_size(gb_vecenv* env);
+// set up before stepping, they change obs_size
+void gb_vecenv_set_obs_mode(gb_vecenv* env, int mode);
+void gb_vecenv_watch_ram(gb_vecenv* env, const uint16_t* addrs, size_t count);
+// episodes end after this many frames, 0 (the default) for never
+void gb_vecenv_set_max_frames(gb_vecenv* env, long frames);
+// bytes of one console's observation
+size_t gb_vecenv_obs_size(gb_vecenv* env);
+// hold buttons[i] (GB_BUTTON_* bits) on console i for frames_per_step
+// frames, then write size * obs_size bytes of observations to obs. A
+// console whose episode ended starts over and gets dones[i] = 1 (dones may
+// be NULL).
+void gb_vecenv_step(gb_vecenv* env, const uint8_t* buttons, uint8_t* obs, uint8_t* dones);
+// start every episode over and observe
+void gb_vecenv_reset(gb_vecenv* env, uint8_t* obs);
+// gb_read_mem on console i
+uint8_t gb_vecenv_read_mem(gb_vecenv* env, int i, uint16_t addr);
+
+#ifdef __cplusplus
+}
+#endif
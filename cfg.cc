@@ -0,0 +1,612 @@
+#include "cfg.h"
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#define MAX_TABLE_ENTRIES 256
+#define MAX_DISPATCHER_INSTRUCTIONS 16
+
+// instruction lengths, 0 for the opcodes that lock the cpu up
+static const BYTE op_length[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,
+    2, 1, 1, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1,
+    2, 1, 1, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1,
+};
+
+int instruction_length(BYTE opcode) {
+    return op_length[opcode];
+}
+
+static const char* exit_names[] = {"fall", "jump", "branch", "call", "ret", "indirect", "halt", "invalid"};
+
+// per rom byte
+#define BYTE_CODE 1   // part of an instruction
+#define BYTE_START 2  // first byte of one
+#define BYTE_LEADER 4 // a block starts here
+
+// does the instruction leave A as it was
+static bool keeps_a(BYTE op) {
+    if ((op >= 0x40 && op < 0x78 && op != 0x76) || (op >= 0xB8 && op < 0xC0)) {
+        return true; // ld to other registers or memory, cp
+    }
+    switch (op) {
+        case 0x00: case 0x01: case 0x11: case 0x21: case 0x31: case 0x02: case 0x12: case 0x22:
+        case 0x32: case 0x03: case 0x13: case 0x23: case 0x33: case 0x0B: case 0x1B: case 0x2B:
+        case 0x3B: case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15: case 0x1C:
+        case 0x1D: case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x34: case 0x35: case 0x06:
+        case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x09: case 0x19:
+        case 0x29: case 0x39: case 0x37: case 0x3F: case 0xFE: case 0xC5: case 0xD5: case 0xE5:
+        case 0xF5: case 0xC1: case 0xD1: case 0xE1: case 0xE0: case 0xE2: case 0xEA: case 0xF3:
+        case 0xFB: case 0xE8: case 0xF8: case 0xF9:
+            return true;
+    }
+    return false;
+}
+
+static bool writes_b(BYTE op, BYTE cb) {
+    if (op >= 0x40 && op < 0x48) {
+        return true; // ld b,r
+    }
+    switch (op) {
+        case 0x01: case 0x03: case 0x0B: case 0x04: case 0x05: case 0x06: case 0xC1:
+            return true;
+        case 0xCB:
+            return (cb < 0x40 || cb >= 0x80) && (cb & 7) == 0;
+    }
+    return false;
+}
+
+static bool writes_hl(BYTE op, BYTE cb) {
+    if (op >= 0x60 && op < 0x70) {
+        return true; // ld h,r and ld l,r
+    }
+    switch (op) {
+        case 0x21: case 0x22: case 0x32: case 0x2A: case 0x3A: case 0x23: case 0x2B: case 0x09:
+        case 0x19: case 0x29: case 0x39: case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x26:
+        case 0x2E: case 0xE1: case 0xF8:
+            return true;
+        case 0xCB:
+            return (cb < 0x40 || cb >= 0x80) && ((cb & 7) == 4 || (cb & 7) == 5);
+    }
+    return false;
+}
+
+namespace {
+
+class Analyzer {
+    public:
+        Analyzer(const BYTE* rom, size_t rom_size, ControlFlowGraph& cfg)
+            : rom(rom), rom_size(rom_size), banks(rom_size / 0x4000), cfg(cfg), marks(rom_size, 0) {
+            BYTE type = rom[0x147];
+            has_mbc = type != 0x00 && type != 0x08 && type != 0x09;
+            mbc5 = type >= 0x19 && type <= 0x1E;
+        }
+        void run();
+
+    private:
+        struct Pending {
+            CodeAddr at;
+            int mapped; // bank at 0x4000-0x7FFF, -1 unknown
+        };
+        size_t offset(CodeAddr at) const {
+            WORD pc = code_pc(at);
+            return pc < 0x4000 ? pc : code_bank(at) * 0x4000 + (pc - 0x4000);
+        }
+        CodeAddr at_offset(size_t off) const {
+            return off < 0x4000 ? code_addr(0, off) : code_addr(off / 0x4000, 0x4000 + off % 0x4000);
+        }
+        // where a jump from code in bank to target ends up, false if unknown
+        bool resolve(int bank, int mapped, WORD target, CodeAddr& out);
+        void follow(int bank, int mapped, WORD target, std::vector<CodeAddr>& edges);
+        void explore(Pending start);
+        // 0 for an ordinary routine, 1 for a dispatcher reading the table
+        // after the call, 2 for one reading the table at HL, 3 for a far
+        // call switching to bank B and jumping to HL
+        int dispatcher(CodeAddr at);
+        void read_table(CodeAddr site, CodeAddr table, int mapped, bool bounded);
+        int bank_number(int value) const;
+        void build_blocks();
+
+        const BYTE* rom;
+        size_t rom_size;
+        int banks;
+        bool has_mbc, mbc5;
+        ControlFlowGraph& cfg;
+        std::vector<BYTE> marks;
+        std::vector<Pending> pending;
+        std::map<size_t, std::vector<CodeAddr>> edges; // control transfers by offset
+        std::map<CodeAddr, int> dispatchers;
+        std::set<size_t> no_return; // calls to a dispatcher of the first kind
+};
+
+int Analyzer::bank_number(int value) const {
+    value &= banks - 1;
+    if (value == 0 && !mbc5) {
+        value = 1; // bank 0 selects 1 on the older mappers
+    }
+    return value;
+}
+
+bool Analyzer::resolve(int bank, int mapped, WORD target, CodeAddr& out) {
+    if (target < 0x4000) {
+        out = code_addr(0, target);
+        return true;
+    }
+    if (target >= 0x8000) {
+        cfg.ram_targets++;
+        return false;
+    }
+    if (bank != 0) {
+        out = code_addr(bank, target);
+    } else if (mapped >= 0) {
+        out = code_addr(mapped, target);
+    } else if (banks == 2) {
+        out = code_addr(1, target);
+    } else {
+        cfg.unresolved++;
+        return false;
+    }
+    return true;
+}
+
+void Analyzer::follow(int bank, int mapped, WORD target, std::vector<CodeAddr>& out) {
+    CodeAddr at;
+    if (resolve(bank, mapped, target, at)) {
+        out.push_back(at);
+        pending.push_back({at, code_bank(at) ? code_bank(at) : mapped});
+    }
+}
+
+int Analyzer::dispatcher(CodeAddr at) {
+    auto known = dispatchers.find(at);
+    if (known != dispatchers.end()) {
+        return known->second;
+    }
+    // straight line code ending in jp (hl), with or without popping the
+    // return address into hl first
+    int kind = 0;
+    bool popped = false, from_b = false, far = false;
+    size_t off = offset(at);
+    for (int i = 0; i < MAX_DISPATCHER_INSTRUCTIONS && off < rom_size; i++) {
+        BYTE op = rom[off];
+        if (op == 0xE1 && i < 3) {
+            popped = true;
+        } else if (op == 0x78) {
+            from_b = true;
+        } else if (op == 0xEA && off + 2 < rom_size && rom[off + 2] >= 0x20 && rom[off + 2] < 0x40) {
+            far = from_b;
+        } else if (!keeps_a(op)) {
+            from_b = false;
+        }
+        if (op == 0xE9) {
+            kind = far ? 3 : popped ? 1 : 2;
+            break;
+        }
+        int len = op_length[op];
+        bool control = op == 0x18 || (op & 0xE7) == 0x20 || op == 0xC3 || op == 0xCD || op == 0xC9 ||
+                       op == 0xD9 || (op & 0xC7) == 0xC7 || (op & 0xE7) == 0xC0 || (op & 0xE7) == 0xC2 ||
+                       (op & 0xE7) == 0xC4;
+        if (!len || control) {
+            break;
+        }
+        off += len;
+    }
+    dispatchers[at] = kind;
+    return kind;
+}
+
+void Analyzer::read_table(CodeAddr site, CodeAddr table, int mapped, bool bounded) {
+    JumpTable found;
+    found.site = site;
+    found.table = table;
+    int bank = code_bank(table);
+    WORD pc = code_pc(table);
+    // a table ends where the code it points to starts, when that follows it
+    WORD limit = 0xFFFF;
+    for (int i = 0; i < MAX_TABLE_ENTRIES && pc < limit; i++, pc += 2) {
+        size_t off = offset(code_addr(bank, pc));
+        if (off + 1 >= rom_size || (pc & 0x3FFF) == 0x3FFF) {
+            break;
+        }
+        WORD entry = rom[off] | (rom[off + 1] << 8);
+        // without a bound only entries into the table's own area count
+        bool near = (entry < 0x4000) == (pc < 0x4000) || entry < 0x4000;
+        if (entry >= 0x8000 || (!bounded && !near) || (bounded && entry == 0)) {
+            break;
+        }
+        if (entry > pc && entry < limit) {
+            limit = entry;
+        }
+        CodeAddr at;
+        if (!resolve(bank, mapped, entry, at)) {
+            break;
+        }
+        found.entries.push_back(at);
+        pending.push_back({at, code_bank(at) ? code_bank(at) : mapped});
+    }
+    if (!found.entries.empty()) {
+        cfg.tables.push_back(found);
+    }
+}
+
+void Analyzer::explore(Pending start) {
+    int bank = code_bank(start.at);
+    int mapped = start.mapped;
+    WORD pc = code_pc(start.at);
+    int a = -1, b = -1, hl = -1; // known constants
+    marks[offset(start.at)] |= BYTE_LEADER;
+    while (true) {
+        if (bank == 0 ? pc >= 0x4000 : (pc < 0x4000 || pc >= 0x8000)) {
+            return; // ran off the end of the bank
+        }
+        size_t off = offset(code_addr(bank, pc));
+        if (off >= rom_size || (marks[off] & BYTE_START)) {
+            if (off < rom_size) {
+                marks[off] |= BYTE_LEADER; // joined from here
+            }
+            return;
+        }
+        BYTE op = rom[off];
+        int len = op_length[op];
+        marks[off] |= BYTE_START;
+        if (!len || off + len > rom_size) {
+            marks[off] |= BYTE_CODE;
+            return;
+        }
+        for (int i = 0; i < len; i++) {
+            marks[off + i] |= BYTE_CODE;
+        }
+        BYTE n = len > 1 ? rom[off + 1] : 0;
+        WORD nn = len > 2 ? rom[off + 1] | (rom[off + 2] << 8) : 0;
+        WORD next = pc + len;
+        CodeAddr here = code_addr(bank, pc);
+
+        // bank switches: a store into 0x2000-0x3FFF
+        int store = -1, value = -1;
+        if (op == 0xEA) {
+            store = nn;
+            value = a;
+        } else if (op == 0x77 || op == 0x36 || (op >= 0x70 && op < 0x76)) {
+            store = hl;
+            value = op == 0x77 ? a : op == 0x36 ? n : -1;
+        }
+        if (has_mbc && store >= 0x2000 && store < 0x4000) {
+            int switched = value >= 0 ? bank_number(value) : -1;
+            cfg.switches.push_back({here, switched});
+            mapped = switched;
+        }
+
+        std::vector<CodeAddr>& out = edges[off];
+        bool stop = false;
+        switch (op) {
+            case 0x18: // jr
+                follow(bank, mapped, next + (SIGNED_BYTE) n, out);
+                stop = true;
+                break;
+            case 0x20: case 0x28: case 0x30: case 0x38: // jr cc
+                follow(bank, mapped, next + (SIGNED_BYTE) n, out);
+                break;
+            case 0xC3: // jp
+                follow(bank, mapped, nn, out);
+                stop = true;
+                break;
+            case 0xC2: case 0xCA: case 0xD2: case 0xDA: // jp cc
+                follow(bank, mapped, nn, out);
+                break;
+            case 0xE9: // jp (hl)
+                if (hl >= 0) {
+                    follow(bank, mapped, hl, out);
+                }
+                stop = true;
+                break;
+            case 0xC9: case 0xD9: // ret, reti
+                stop = true;
+                break;
+            case 0xCD: case 0xC4: case 0xCC: case 0xD4: case 0xDC:
+            case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: {
+                WORD target = (op & 0xC7) == 0xC7 ? op & 0x38 : nn;
+                follow(bank, mapped, target, out);
+                CodeAddr callee;
+                int kind = out.empty() ? 0 : dispatcher(out.back());
+                if (kind == 1 && resolve(bank, mapped, next, callee)) {
+                    read_table(here, callee, mapped, true);
+                    no_return.insert(off);
+                    stop = true;
+                } else if (kind == 2 && hl >= 0 && resolve(bank, mapped, hl, callee)) {
+                    read_table(here, callee, mapped, false);
+                } else if (kind == 3 && b >= 0 && hl >= 0) {
+                    follow(bank, hl < 0x4000 ? mapped : bank_number(b), hl, out);
+                }
+                a = b = hl = -1; // whatever the callee left
+                break;
+            }
+        }
+        if (op != 0xCD && (op & 0xC7) != 0xC7 && (op & 0xE7) != 0xC4) {
+            if (op == 0x3E) {
+                a = n;
+            } else if (op == 0xAF) {
+                a = 0;
+            } else if (op == 0x78) {
+                a = b;
+            } else if (!keeps_a(op)) {
+                a = -1;
+            }
+            if (op == 0x06) {
+                b = n;
+            } else if (op == 0x01) {
+                b = nn >> 8;
+            } else if (writes_b(op, n)) {
+                b = -1;
+            }
+            if (op == 0x21) {
+                hl = nn;
+            } else if (writes_hl(op, n)) {
+                hl = -1;
+            }
+        }
+        if (out.empty()) {
+            edges.erase(off);
+        }
+        if (stop) {
+            return;
+        }
+        bool transfer = op == 0x76 || op == 0x10 || op == 0xC0 || op == 0xC8 || op == 0xD0 || op == 0xD8 ||
+                        edges.count(off);
+        if (transfer && next < 0x8000) {
+            marks[offset(code_addr(bank, next))] |= BYTE_LEADER;
+        }
+        pc = next;
+    }
+}
+
+void Analyzer::run() {
+    std::vector<WORD> entries = {0x100};
+    for (WORD vector = 0; vector <= 0x60; vector += 8) {
+        entries.push_back(vector); // rst, then vblank, stat, timer, serial and joypad
+    }
+    for (WORD entry : entries) {
+        pending.push_back({code_addr(0, entry), -1});
+    }
+    while (!pending.empty()) {
+        Pending next = pending.back();
+        pending.pop_back();
+        if (offset(next.at) < rom_size && !(marks[offset(next.at)] & BYTE_START)) {
+            explore(next);
+        } else if (offset(next.at) < rom_size) {
+            marks[offset(next.at)] |= BYTE_LEADER;
+        }
+    }
+    build_blocks();
+}
+
+void Analyzer::build_blocks() {
+    size_t off = 0;
+    while (off < rom_size) {
+        if (!(marks[off] & BYTE_START)) {
+            off++;
+            continue;
+        }
+        BasicBlock block;
+        block.start = at_offset(off);
+        block.instructions = 0;
+        block.exit = EXIT_FALL;
+        size_t bank_end = off < 0x4000 ? 0x4000 : (off / 0x4000 + 1) * 0x4000;
+        while (true) {
+            BYTE op = rom[off];
+            int len = op_length[op];
+            block.instructions++;
+            if (!len) {
+                block.exit = EXIT_INVALID;
+                off++;
+                break;
+            }
+            auto out = edges.find(off);
+            bool conditional_ret = op == 0xC0 || op == 0xC8 || op == 0xD0 || op == 0xD8;
+            if (out != edges.end()) {
+                block.targets = out->second;
+            }
+            if (op == 0x18 || op == 0xC3) {
+                block.exit = EXIT_JUMP;
+            } else if ((op & 0xE7) == 0x20 || (op & 0xE7) == 0xC2) {
+                block.exit = EXIT_BRANCH;
+            } else if (op == 0xCD || (op & 0xC7) == 0xC7 || (op & 0xE7) == 0xC4) {
+                block.exit = EXIT_CALL;
+            } else if (op == 0xC9 || op == 0xD9 || conditional_ret) {
+                block.exit = EXIT_RET;
+            } else if (op == 0xE9) {
+                block.exit = EXIT_INDIRECT;
+            } else if (op == 0x76 || op == 0x10) {
+                block.exit = EXIT_HALT;
+            }
+            bool falls = block.exit == EXIT_FALL || block.exit == EXIT_BRANCH || block.exit == EXIT_HALT ||
+                         (block.exit == EXIT_CALL && !no_return.count(off)) || conditional_ret;
+            size_t next = off + len;
+            if (block.exit != EXIT_FALL || next >= bank_end || !(marks[next] & BYTE_START) ||
+                (marks[next] & BYTE_LEADER)) {
+                if (falls && next < bank_end && (marks[next] & BYTE_START)) {
+                    block.targets.push_back(at_offset(next));
+                }
+                off = next;
+                break;
+            }
+            off = next;
+        }
+        block.end = code_pc(block.start) + (off - offset(block.start));
+        cfg.blocks[block.start] = block;
+    }
+}
+
+}
+
+std::unique_ptr<ControlFlowGraph> ControlFlowGraph::analyze(const BYTE* rom, size_t rom_size) {
+    std::unique_ptr<ControlFlowGraph> cfg(new ControlFlowGraph());
+    cfg->rom_size = rom_size;
+    cfg->checksum = rom[0x14E] << 8 | rom[0x14F];
+    Analyzer(rom, rom_size, *cfg).run();
+    return cfg;
+}
+
+const BasicBlock* ControlFlowGraph::block(CodeAddr at) const {
+    auto found = blocks.find(at);
+    return found == blocks.end() ? nullptr : &found->second;
+}
+
+static void write_addrs(FILE* out, const std::vector<CodeAddr>& addrs) {
+    for (CodeAddr at : addrs) {
+        fprintf(out, " %X:%04X", code_bank(at), code_pc(at));
+    }
+    fputc('\n', out);
+}
+
+bool ControlFlowGraph::save(const std::string& path) const {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        perror(path.c_str());
+        return false;
+    }
+    fprintf(out, "gb-cfg 1 %zu %04X\n", rom_size, checksum);
+    for (const auto& entry : blocks) {
+        const BasicBlock& block = entry.second;
+        fprintf(out, "block %X:%04X %04X %d %s", code_bank(block.start), code_pc(block.start), block.end,
+                block.instructions, exit_names[block.exit]);
+        write_addrs(out, block.targets);
+    }
+    for (const JumpTable& table : tables) {
+        fprintf(out, "table %X:%04X %X:%04X", code_bank(table.site), code_pc(table.site),
+                code_bank(table.table), code_pc(table.table));
+        write_addrs(out, table.entries);
+    }
+    for (const BankSwitch& bank_switch : switches) {
+        fprintf(out, "switch %X:%04X %d\n", code_bank(bank_switch.site), code_pc(bank_switch.site), bank_switch.bank);
+    }
+    fprintf(out, "unresolved %d %d\n", unresolved, ram_targets);
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+// "bank:addr" at *text, moving past it
+static bool read_addr(const char*& text, CodeAddr& at) {
+    unsigned bank, pc;
+    int used;
+    if (sscanf(text, " %x:%x%n", &bank, &pc, &used) != 2) {
+        return false;
+    }
+    text += used;
+    at = code_addr(bank, pc);
+    return true;
+}
+
+std::unique_ptr<ControlFlowGraph> ControlFlowGraph::load(const std::string& path, const BYTE* rom,
+                                                         size_t rom_size) {
+    FILE* in = fopen(path.c_str(), "r");
+    if (!in) {
+        return nullptr;
+    }
+    std::unique_ptr<ControlFlowGraph> cfg(new ControlFlowGraph());
+    size_t size;
+    unsigned checksum;
+    char line[4096];
+    if (!fgets(line, sizeof(line), in) || sscanf(line, "gb-cfg 1 %zu %x", &size, &checksum) != 2 ||
+        size != rom_size || checksum != (unsigned) (rom[0x14E] << 8 | rom[0x14F])) {
+        fclose(in);
+        return nullptr; // stale
+    }
+    cfg->rom_size = size;
+    cfg->checksum = checksum;
+    while (fgets(line, sizeof(line), in)) {
+        const char* text = line;
+        int used;
+        char kind[16];
+        if (sscanf(text, "%15s%n", kind, &used) != 1) {
+            continue;
+        }
+        text += used;
+        CodeAddr at, other;
+        if (!strcmp(kind, "block") && read_addr(text, at)) {
+            BasicBlock block;
+            block.start = at;
+            unsigned end;
+            char exit[16];
+            if (sscanf(text, " %x %d %15s%n", &end, &block.instructions, exit, &used) != 3) {
+                continue;
+            }
+            text += used;
+            block.end = end;
+            block.exit = EXIT_FALL;
+            for (int i = 0; i < (int) (sizeof(exit_names) / sizeof(exit_names[0])); i++) {
+                if (!strcmp(exit, exit_names[i])) {
+                    block.exit = (BlockExit) i;
+                }
+            }
+            while (read_addr(text, other)) {
+                block.targets.push_back(other);
+            }
+            cfg->blocks[at] = block;
+        } else if (!strcmp(kind, "table") && read_addr(text, at) && read_addr(text, other)) {
+            JumpTable table = {at, other, {}};
+            while (read_addr(text, other)) {
+                table.entries.push_back(other);
+            }
+            cfg->tables.push_back(table);
+        } else if (!strcmp(kind, "switch") && read_addr(text, at)) {
+            int bank;
+            if (sscanf(text, " %d", &bank) == 1) {
+                cfg->switches.push_back({at, bank});
+            }
+        } else if (!strcmp(kind, "unresolved")) {
+            sscanf(text, " %d %d", &cfg->unresolved, &cfg->ram_targets);
+        }
+    }
+    fclose(in);
+    return cfg;
+}
+
+void ControlFlowGraph::print_coverage() const {
+    int banks = rom_size / 0x4000;
+    std::vector<size_t> code(banks, 0);
+    long instructions = 0;
+    for (const auto& entry : blocks) {
+        const BasicBlock& block = entry.second;
+        code[code_bank(block.start)] += block.end - code_pc(block.start);
+        instructions += block.instructions;
+    }
+    size_t total = 0;
+    int touched = 0;
+    for (int bank = 0; bank < banks; bank++) {
+        total += code[bank];
+        touched += code[bank] > 0;
+    }
+    size_t entries = 0;
+    for (const JumpTable& table : tables) {
+        entries += table.entries.size();
+    }
+    int constant = 0;
+    for (const BankSwitch& bank_switch : switches) {
+        constant += bank_switch.bank >= 0;
+    }
+    printf("%zu blocks, %ld instructions, %zu bytes of code (%.1f%% of the rom)\n", blocks.size(),
+           instructions, total, 100.0 * total / rom_size);
+    printf("code found in %d of %d banks:", touched, banks);
+    for (int bank = 0; bank < banks; bank++) {
+        if (code[bank]) {
+            printf(" %d:%.0f%%", bank, 100.0 * code[bank] / 0x4000);
+        }
+    }
+    printf("\n%zu jump tables with %zu entries, %zu bank switches (%d constant)\n", tables.size(), entries,
+           switches.size(), constant);
+    printf("%d jumps into an unknown bank, %d out of the rom\n", unresolved, ram_targets);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+
+// where a piece of code lives: the rom bank it is in (0 for 0x0000-0x3FFF)
+// and the address the cpu runs it at, packed as bank << 16 | address
+typedef uint32_t CodeAddr;
+inline CodeAddr code_addr(int bank, WORD addr) { return (CodeAddr) bank << 16 | addr; }
+inline int code_bank(CodeAddr at) { return at >> 16; }
+inline WORD code_pc(CodeAddr at) { return at & 0xFFFF; }
+
+// bytes in the instruction starting with opcode, 0 for the ones that lock
+// the cpu up
+int instruction_length(BYTE opcode);
+
+// how control leaves a basic block
+enum BlockExit {
+    EXIT_FALL,     // runs into the next block, which something jumps to
+    EXIT_JUMP,     // jp, jr
+    EXIT_BRANCH,   // conditional jp, jr: the target or the next block
+    EXIT_CALL,     // call, rst (conditional too), back to the next block
+    EXIT_RET,      // ret, reti; conditional ones may fall through
+    EXIT_INDIRECT, // jp (hl), targets only known for jump tables
+    EXIT_HALT,     // halt, stop, carrying on with the next block
+    EXIT_INVALID,  // an opcode that locks the cpu up, most likely data
+};
+
+struct BasicBlock {
+    CodeAddr start;
+    WORD end; // one past the last instruction
+    int instructions;
+    BlockExit exit;
+    std::vector<CodeAddr> targets; // every successor found, fall through included
+};
+
+// a table of code pointers read by a dispatch routine
+struct JumpTable {
+    CodeAddr site;  // the call to the dispatcher
+    CodeAddr table;
+    std::vector<CodeAddr> entries;
+};
+
+// a write to the mapper's rom bank register
+struct BankSwitch {
+    CodeAddr site;
+    int bank; // -1 when not a constant
+};
+
+// what recursive disassembly finds from the entry point, the rst and the
+// interrupt vectors. Code in 0x4000-0x7FFF called from bank 0 is followed
+// into the bank the caller last switched to, when that was a constant.
+// Saved as text next to the rom so whatever runs it can skip discovery.
+class ControlFlowGraph {
+    public:
+        static std::unique_ptr<ControlFlowGraph> analyze(const BYTE* rom, size_t rom_size);
+        // null if missing or made from another rom
+        static std::unique_ptr<ControlFlowGraph> load(const std::string& path, const BYTE* rom,
+                                                      size_t rom_size);
+        bool save(const std::string& path) const;
+        void print_coverage() const;
+        // the block starting at, or null
+        const BasicBlock* block(CodeAddr at) const;
+
+        std::map<CodeAddr, BasicBlock> blocks;
+        std::vector<JumpTable> tables;
+        std::vector<BankSwitch> switches;
+        int unresolved = 0; // jumps and calls into an unknown bank
+        int ram_targets = 0; // jumps and calls out of the rom
+        size_t rom_size = 0;
+        WORD checksum = 0; // the header's global checksum
+
+    private:
+        ControlFlowGraph() {}
+};
@@ -1,175 +1,89 @@
-#include <iostream>
 #include <vector>
 #include <functional>
 #include <memory>
 #include <cstring>
+#include <cstddef>
 
 #include "cpu.h"
-
-CPU::CPU(BYTE* rom) : af(0x01B0), bc(0x0013), de(0x00D8), hl(0x014D), sp(0xFFFE), pc(PC_START), 
-                      cycles(0), rom(rom), curr_rom_bank(1), curr_ram_bank(0), 
-                      mbc1(false), mbc2(false), mbc3(false), rom_banking(true), divider_reg(0), timer_counter(0), joypad_state(0xFF), clock_speed(1024) {
-    // initialize rom values
-    rom[0xFF05] = 0x00;
-    rom[0xFF06] = 0x00;
-    rom[0xFF07] = 0x00;
-    rom[0xFF10] = 0x80;
-    rom[0xFF11] = 0xBF;
-    rom[0xFF12] = 0xF3;
-    rom[0xFF14] = 0xBF;
-    rom[0xFF16] = 0x3F;
-    rom[0xFF17] = 0x00;
-    rom[0xFF19] = 0xBF;
-    rom[0xFF1A] = 0x7F;
-    rom[0xFF1B] = 0xFF;
-    rom[0xFF1C] = 0x9F;
-    rom[0xFF1E] = 0xBF;
-    rom[0xFF20] = 0xFF;
-    rom[0xFF21] = 0x00;
-    rom[0xFF22] = 0x00;
-    rom[0xFF23] = 0xBF;
-    rom[0xFF24] = 0x77;
-    rom[0xFF25] = 0xF3;
-    rom[0xFF26] = 0xF1;
-    rom[0xFF40] = 0x91;
-    rom[0xFF42] = 0x00;
-    rom[0xFF43] = 0x00;
-    rom[0xFF45] = 0x00;
-    rom[0xFF47] = 0xFC;
-    rom[0xFF48] = 0xFF;
-    rom[0xFF49] = 0xFF;
-    rom[0xFF4A] = 0x00;
-    rom[0xFF4B] = 0x00;
-    rom[0xFFFF] = 0x00;
-
-    rom_clone = new BYTE[0x200000];
-    memcpy(rom_clone, rom, 0x200000);
-
-    // set mbc type
-    if(rom[0x147] == 1 || rom[0x147] == 2 || rom[0x147] == 3) {
-        mbc1 = true;
-    }else if(rom[0x147] == 5 || rom[0x147] == 6) {
-        mbc2 = true;
-    }else if(rom[0x147] >= 0xF && rom[0x147] <= 0x13) {
-        mbc3 = true;
-    }
-
-    switch(rom[0x0148]){
-        case 0x00: rom_bank_count = 2; break;
-        case 0x01: rom_bank_count = 4; break;
-        case 0x02: rom_bank_count = 8; break;
-        case 0x03: rom_bank_count = 16; break;
-        case 0x04: rom_bank_count = 32; break;
-        case 0x05: rom_bank_count = 64; break;
-        case 0x06: rom_bank_count = 128; break;
-        case 0x07: rom_bank_count = 256; break;
-        case 0x08: rom_bank_count = 512; break;
-        default: rom_bank_count = 2;
-    }
-
-    // set ram banks to 0
-    memset(ram, 0, sizeof(ram));
-
-}
-
-BYTE CPU::read_r8(BYTE r) {
-    switch(r) {
-        case 0: return B;
-        case 1: return C;
-        case 2: return D;
-        case 3: return E;
-        case 4: return H;
-        case 5: return L;
-        case 6: return read_mem(HL);
-        case 7: return A;
-    }
-    exit(-1);
-}
-
-void CPU::write_r8(BYTE r, BYTE data) {
-    switch(r) {
-        case 0: B = data; break;
-        case 1: C = data; break;
-        case 2: D = data; break;
-        case 3: E = data; break;
-        case 4: H = data; break;
-        case 5: L = data; break;
-        case 6: write_mem(HL, data); break;
-        case 7: A = data; break;
-    }
+#include "apu.h"
+#include "serial.h"
+#include "mapper.h"
+#include "save.h"
+#include "ppu.h"
+#include "lcd.h"
+#include "timer.h"
+#include "cpu_ops.h"
+
+// a reordering that spreads the hot fields out again should not go unnoticed
+static_assert(offsetof(CPU, joypad_state) < 64, "registers, clock and banks share the first cache line");
+static_assert(offsetof(CPU, rom) + sizeof(BYTE*) <= 128, "unit pointers and mapper fill the second");
+static_assert(offsetof(CPU, mem) == 128, "the page table starts on the third");
+static_assert(offsetof(CPU, screen) > offsetof(CPU, mem), "the picture is cold, it goes last");
+
+CPU::CPU() : rom(nullptr) {}
+CPU::CPU(CPU&&) = default;
+CPU& CPU::operator=(CPU&&) = default;
+CPU::~CPU() {}
+
+CPU::CPU(BYTE* rom, size_t rom_size) : af(0x01B0), bc(0x0013), de(0x00D8), hl(0x014D), sp(0xFFFE), pc(PC_START), 
+                      cycles(0), joypad_state(0xFF), rom(rom), rom_size(rom_size) {
+    memset(screen, 0xFF, sizeof(screen)); // blank, as with the background off
+    // initialize io registers
+    mem.set(0xFF05, 0x00);
+    mem.set(0xFF06, 0x00);
+    mem.set(0xFF07, 0x00);
+    mem.set(0xFF10, 0x80);
+    mem.set(0xFF11, 0xBF);
+    mem.set(0xFF12, 0xF3);
+    mem.set(0xFF14, 0xBF);
+    mem.set(0xFF16, 0x3F);
+    mem.set(0xFF17, 0x00);
+    mem.set(0xFF19, 0xBF);
+    mem.set(0xFF1A, 0x7F);
+    mem.set(0xFF1B, 0xFF);
+    mem.set(0xFF1C, 0x9F);
+    mem.set(0xFF1E, 0xBF);
+    mem.set(0xFF20, 0xFF);
+    mem.set(0xFF21, 0x00);
+    mem.set(0xFF22, 0x00);
+    mem.set(0xFF23, 0xBF);
+    mem.set(0xFF24, 0x77);
+    mem.set(0xFF25, 0xF3);
+    mem.set(0xFF26, 0xF1);
+    mem.set(0xFF40, 0x91);
+    mem.set(0xFF42, 0x00);
+    mem.set(0xFF43, 0x00);
+    mem.set(0xFF45, 0x00);
+    mem.set(0xFF47, 0xFC);
+    mem.set(0xFF48, 0xFF);
+    mem.set(0xFF49, 0xFF);
+    mem.set(0xFF4A, 0x00);
+    mem.set(0xFF4B, 0x00);
+    mem.set(0xFFFF, 0x00);
+
+    mapper = Mapper::create(rom, rom_size);
+    map_banks();
 }
 
-void CPU::write_r16(BYTE r, WORD data) {
-    switch(r) {
-        case 0: bc.word = data; break;
-        case 1: de.word = data; break;
-        case 2: hl.word = data; break;
-        case 3: sp.word = data; break;
+BYTE CPU::peek(WORD addr) {
+    // fixed rom bank
+    if(addr < 0x4000) {
+        return rom0[addr];
     }
-}
-
-WORD CPU::read_r16(BYTE r) {
-    switch(r) {
-        case 0: return bc.word;
-        case 1: return de.word;
-        case 2: return hl.word;
-        case 3: return sp.word;
-    }
-    exit(-1);
-}
-
-void CPU::write_r16mem(BYTE r, WORD data) {
-    exit(0);
-}
-
-WORD CPU::read_r16mem(BYTE r) {
-    switch(r) {
-        case 0: return (BC);
-        case 1: return (DE);
-        case 2: return (HL);
-        case 3: return (HL);
-    }
-    exit(-1);
-}
-
-void CPU::write_r16stk(BYTE r, WORD data, bool high) {
-    switch(r) {
-        case 0: if(high){bc.high = data;}else{bc.low = data;} break;
-        case 1: if(high){de.high = data;}else{de.low = data;} break;
-        case 2: if(high){hl.high = data;}else{hl.low = data;} break;
-        case 3: if(high){af.high = data;}else{af.low = (data&0xF0);} break;
-    }
-}
-
-WORD CPU::read_r16stk(BYTE r, bool high) {
-    switch(r) {
-        case 0: if(high){return bc.high;}else{return bc.low;}
-        case 1: if(high){return de.high;}else{return de.low;}
-        case 2: if(high){return hl.high;}else{return hl.low;}
-        case 3: if(high){return af.high;}else{return af.low;}
-    }
-    exit(-1);
-}
-
-BYTE CPU::read_mem(WORD addr) {
-    // rom bank
-    if((addr >= 0x4000) && (addr < 0x8000)) {
-        if(mbc1 || mbc2 || mbc3) return rom_clone[(addr - 0x4000) + curr_rom_bank*0x4000];
-        return rom[(addr - 0x4000) + (curr_rom_bank * 0x4000)];
+    // switchable rom bank
+    else if(addr < 0x8000) {
+        return romx[addr - 0x4000];
     }
     // ram bank
     else if((addr >= 0xA000) && (addr < 0xC000)) {
-        if(mbc1 || mbc2) {
-            return ram[(addr - 0xA000) + (curr_ram_bank * 0x2000)];
-        }else if(mbc3 && curr_ram_bank <= 0x03){
-            return ram[(addr - 0xA000) + (curr_ram_bank * 0x2000)];
-        }else{
-            return ram[(addr - 0xA000) + (curr_ram_bank * 0x2000)];
+        if(sram) {
+            return sram[addr - 0xA000];
         }
+        return mapper->read_ram(addr);
     }
     // input
     else if(addr == 0xFF00) {
-        BYTE ret = ~(rom[0xFF00]);
+        BYTE ret = ~(mem[0xFF00]);
         // standard buttons
         if(!(ret & (1 << 4))) {
             ret &= (joypad_state >> 4) | 0xF0; 
@@ -180,134 +94,144 @@ BYTE CPU::read_mem(WORD addr) {
         }
         return ret;
     }
+    // serial port
+    else if((addr == 0xFF01 || addr == 0xFF02) && serial) {
+        return serial->read(addr);
+    }
+    // timer
+    else if((addr >= 0xFF04) && (addr < 0xFF08) && timer) {
+        return timer->read(*this, addr);
+    }
+    // lcd status and current line
+    else if((addr == 0xFF41 || addr == 0xFF44) && lcd) {
+        return lcd->read(*this, addr);
+    }
+    // sound registers and wave ram
+    else if((addr >= 0xFF10) && (addr < 0xFF40) && apu) {
+        return apu->read(addr);
+    }
     // memory
     else {
-        return rom[addr];
+        return mem[addr];
     }
 }
 
+// vram, oam, dma and the registers the picture depends on (not STAT or LY)
+static inline bool video_visible(WORD addr) {
+    return ((addr >= 0x8000) && (addr < 0xA000)) || ((addr >= 0xFE00) && (addr < 0xFEA0)) ||
+           addr == 0xFF40 || addr == 0xFF42 || addr == 0xFF43 || ((addr >= 0xFF46) && (addr < 0xFF4C));
+}
+
 void CPU::write_mem(WORD addr, BYTE data) {
+    if(dma && addr < 0xFF00 && bus_held()) {
+        return;
+    }
+    // draw the lines already scanned out with the old contents
+    if(ppu && video_visible(addr)) {
+        ppu->catchUp(*this, lcd->visibleLines(clock));
+    }
     // banking
     if(addr < 0x8000) {
         bank_mem(addr, data);
     }
     // write to ram
     else if((addr >= 0xA000) && (addr < 0xC000)) {
-        if(ram_en && mbc1) {
-            ram[(addr - 0xA000) + (curr_ram_bank*0x2000)] = data;
-        }else if(mbc2 && addr < 0xA200) {
-            ram[(addr - 0xA000) + (curr_ram_bank*0x2000)] = data;
-        }else if(mbc3){
-            if(curr_ram_bank <= 0x03){
-                ram[(addr - 0xA000) + (curr_ram_bank*0x2000)] = data;
-            }
+        if(sram) {
+            sram[addr - 0xA000] = data;
+        }else {
+            mapper->write_ram(addr, data);
         }
+        if(save) save->mark();
     }
     // echo ram
     else if((addr >= 0xE000) && (addr < 0xFE00)) {
-        rom[addr] = data;
+        mem.set(addr, data);
         write_mem(addr-0x2000, data);
     }
-    // divider register
-    else if(addr == 0xFF04) {
-        rom[0xFF04] = 0;
-        divider_reg = 0;
+    // timer
+    else if((addr >= 0xFF04) && (addr < 0xFF08) && timer) {
+        timer->write(*this, addr, data);
     }
-    // timer controller
-    else if(addr == 0xFF07) {
-        rom[addr] = data;
-
-        int new_clock_speed = 0;
-		switch(data & 3) {
-			case 0: new_clock_speed = 256; break;
-			case 1: new_clock_speed = 4; break;
-			case 2: new_clock_speed = 16; break; 
-			case 3: new_clock_speed = 64; break;
-		}
-
-		if (clock_speed != new_clock_speed) {
-			timer_counter = 0 ;
-			clock_speed = new_clock_speed;
-		}
+    // serial port
+    else if((addr == 0xFF01 || addr == 0xFF02) && serial) {
+        serial->write(addr, data);
+    }
+    // lcd control, status, current line and compare
+    else if((addr == 0xFF40 || addr == 0xFF41 || addr == 0xFF44 || addr == 0xFF45) && lcd) {
+        lcd->write(*this, addr, data);
     }
-    // DMA transfer
+    // sound registers and wave ram
+    else if((addr >= 0xFF10) && (addr < 0xFF40) && apu) {
+        apu->write(addr, data);
+    }
+    // DMA transfer. The cpu can't reach the source or oam until it is done,
+    // so the whole copy is made now and the bus held for as long as it takes.
     else if(addr == 0xFF46) {
-        WORD new_data = (data << 8);
-		for (int i = 0; i < 160; i++) {
-			rom[0xFE00 + i] = read_mem(new_data + i);
-		}
+        WORD source = data << 8;
+        if(const BYTE* from = host_pointer(source)) {
+            mem.write(0xFE00, from, 160);
+        }else {
+            for (int i = 0; i < 160; i++) {
+                mem.set(0xFE00 + i, peek(source + i));
+            }
+        }
+        mem.set(addr, data);
+        // from the end of the instruction writing here
+        dma_end = clock + cycles * 4 + OAM_DMA_CYCLES;
+        dma = 1;
+    }
+    // interrupt flags and enable, kept as what is pending too
+    else if(addr == 0xFF0F || addr == 0xFFFF) {
+        mem.set(addr, data);
+        pending = mem[0xFF0F] & mem[0xFFFF] & 0x1F;
     }
     // write if not restrictied address
     else if (!((addr >= 0xFEA0) && (addr < 0xFF00))) {
-        rom[addr] = data;
+        mem.set(addr, data);
     }
 }
 
-void CPU::bank_mem(WORD addr, BYTE data) {
-    if(mbc1 || mbc2){
-        // ram enable
-        if(addr < 0x2000 && (mbc1 || mbc2)) {
-            if(mbc1) {
-                if((data & 0xF) == 0xA)
-                    ram_en = true;
-                else if(data == 0)
-                    ram_en = false;
-            }else {
-                if(!(addr & (1 << 8))) {
-                    if((data & 0xF) == 0xA)
-                        ram_en = true;
-                    else if(data == 0)
-                        ram_en = false;
-                }
-            }
-        }
-        // rom bank change
-        else if((addr >= 0x2000) && (addr < 0x4000) && (mbc1 || mbc2)) {
-            if(mbc2) {
-                curr_rom_bank = data & 0xF;   
-            }else {
-                if(data == 0) {
-                    data = 1;
-                }
-                curr_rom_bank = (curr_rom_bank & 0xE0) | (data & 0x1F);
-            }
-        }
-        // do ROM or RAM bank change
-        else if((addr >= 0x4000) && (addr < 0x6000) && mbc1) {
-            if(rom_banking) {
-                curr_ram_bank = 0;
-                data = (data & 3) << 5;
-                if((curr_rom_bank & 0x1F) == 0)
-                    data++;
-                curr_rom_bank = (curr_rom_bank & 0x1F) | data;
-            }else {
-                curr_ram_bank = data & 3;
-            }
-        }
-        // change rom ram mode
-        else if((addr >= 0x6000) && (addr < 0x8000) && mbc1) {
-        rom_banking = !(data & 1);
-        if (data & 1)
-            curr_ram_bank = 0;
-    }
-    }else if(mbc3){
-        if(addr < 0x2000){
-            ram_en = ((data & 0xF) == 0xA);
-        }
-        else if(addr < 0x4000){
-            BYTE bank = data % rom_bank_count;
-            if(bank == 0) {
-                bank = 1;
-            }
-            curr_rom_bank = bank;
-        }
-        else if(addr < 0x6000){
-            BYTE r = data & 0xF;
-            if(r <= 3){
-                curr_ram_bank = r;
-            }
-        }
+const BYTE* CPU::host_pointer(WORD addr) const {
+    if(addr < 0x4000) {
+        return rom0 + addr;
+    }else if(addr < 0x8000) {
+        return romx + (addr - 0x4000);
+    }else if(addr < 0xA000 || ((addr >= 0xC000) && (addr < 0xE000))) {
+        return mem.page(addr >> MEM_PAGE_BITS) + (addr & (MEM_PAGE_SIZE - 1));
     }
+    return nullptr;
+}
+
+void CPU::bank_mem(WORD addr, BYTE data) {
+    mapper->write(addr, data);
+    map_banks();
+}
+
+void CPU::map_banks() {
+    rom0 = mapper->rom0;
+    romx = mapper->romx;
+    sram = mapper->sram;
+}
+
+void CPU::copy_state(const CPU& other) {
+    IME = other.IME;
+    IME_next = other.IME_next;
+    mem = other.mem; // shares the pages
+    af = other.af;
+    bc = other.bc;
+    de = other.de;
+    hl = other.hl;
+    sp = other.sp;
+    pc = other.pc;
+    cycles = other.cycles;
+    clock = other.clock;
+    joypad_state = other.joypad_state;
+    halted = other.halted;
+    locked = other.locked;
+    locked_at = other.locked_at;
+    dma = other.dma;
+    pending = other.pending;
+    dma_end = other.dma_end;
 }
 
 void CPU::resetDirty() {
@@ -319,73 +243,17 @@ void CPU::resetDirty() {
 
 void CPU::handle_interrupt(int signal) {
     IME = false;
-    write_mem(0xFF0F, read_mem(0xFF0F) & ~(1 << signal)); // reset bit
+    mem.set(0xFF0F, mem[0xFF0F] & ~(1 << signal)); // reset bit
+    pending &= ~(1 << signal);
     // push pc onto stack
     write_mem(--SP, pchigh);
     write_mem(--SP, pclow);
-    switch (signal) {
-        case 0:
-            PC = 0x40;
-            break;
-        case 1:
-            PC = 0x48;
-            break;
-        case 2:
-            PC = 0x50;
-            break;
-        case 3:
-            pc = 0x58;
-            break;
-        case 4:
-            PC = 0x60;
-            break;
-        default:
-            fprintf(stderr, "Invalid interrupt signal");
-            exit(1);
-    }
+    PC = 0x40 + signal * 8;
 }
 
 void CPU::interrupt(int signal) {
-    write_mem(0xFF0F, read_mem(0xFF0F) | (1 << signal)); // set bit
-}
-
-int CPU::check_interrupts() {
-    BYTE IRR = read_mem(0xFF0F); // Interupt Request Register
-    BYTE IER = read_mem(0xFFFF); // Interupt Enabled Register
-    if (IME && IRR > 0) { // master interupt switch
-        for (int i = 0; i < 5; i++) {
-            if ((IRR & (1 << i)) && (IER & (1 << i))) {
-                handle_interrupt(i);
-                return 5;
-            }
-        }
-    }
-    return 0;
-}
-
-void CPU::update_timers(int cycles) {
-    // update divider register
-    divider_reg += cycles;
-    if(divider_reg > 255) {
-        divider_reg = 0;
-        rom[0xFF04]++;
-    }
-
-    // update timers if clock is enabled
-    if(rom[0xFF07] & (1 << 2)) {
-        timer_counter += cycles;
-        if(timer_counter >= clock_speed) {
-            timer_counter = 0;
-            // timer overflow
-            BYTE timer = read_mem(0xFF05);
-            if(timer == 255) {
-                write_mem(0xFF05, read_mem(0xFF06));
-                interrupt(2);
-            }else {
-                write_mem(0xFF05, timer+1);
-            }
-        }
-    }
+    mem.set(0xFF0F, mem[0xFF0F] | (1 << signal)); // set bit
+    pending = mem[0xFF0F] & mem[0xFFFF] & 0x1F;
 }
 
 void CPU::key_pressed(int key_code) {
@@ -395,7 +263,7 @@ void CPU::key_pressed(int key_code) {
     // set new joypad state
     joypad_state = ~((~joypad_state) | (1 << key_code));
 
-    BYTE key_req = rom[0xFF00];
+    BYTE key_req = mem[0xFF00];
     bool req_interrupt = (std_btn && !(key_req & (1 << 5))) || (!std_btn && !(key_req & (1 << 4)));
 
     if(req_interrupt && !already_pressed) {
@@ -407,336 +275,25 @@ void CPU::key_released(int key_code) {
     joypad_state = joypad_state | (1 << key_code);
 }
 
-inline void CPU::ld_r_r(BYTE r1, BYTE r2) {
-    cycles = 1 + (r2 == 6 || r1 == 6);
-    write_r8(r1, read_r8(r2)); 
-    PC += 1;
-}
-
-inline void CPU::ld_r_imm(BYTE r) {
-    cycles = 2 + (r == 6);
-    write_r8(r, read_mem(PC + 1));
-    PC += 2;
-}
-
-inline void CPU::ld_a_r16mem(BYTE r) {
-    cycles = 2;
-    A = read_mem(read_r16mem(r));
-    if(r == 2) {
-        HL++;
-    } else if (r == 3) {
-        HL--;
-    }
-    PC += 1;
-}
-
-inline void CPU::ld_r16mem_a(BYTE r) {
-    cycles = 2;
-    write_mem(read_r16mem(r), A);
-    if(r == 2) {
-        HL++;
-    } else if (r == 3) {
-        HL--;
-    }
-    PC += 1;
-}
-
-inline void CPU::ld_rr_nn(BYTE r) {
-    cycles = 3;
-    write_r16(r, read_mem(PC+1) + (read_mem(PC+2) << 8));
-    PC += 3;
-}
-
-inline void CPU::push_rr(BYTE r) {
-    cycles = 4;
-    write_mem(--SP, (read_r16stk(r, true)));
-    write_mem(--SP, (read_r16stk(r, false)));
-    PC += 1;
-}
-
-inline void CPU::pop_rr(BYTE r) {
-    cycles = 3;
-    write_r16stk(r, read_mem(SP++), false);
-    write_r16stk(r, read_mem(SP++), true);
-    PC += 1;
-}
-
-inline void CPU::add_r(BYTE carry, BYTE r) {
-    cycles = 1 + (r == 6);
-    BYTE saved_carry = Carry;
-    F &= 0x0F;
-    if(((A&0xF)+(read_r8(r)&0xF)+(carry ? saved_carry : 0))>>4) F |= 0b00100000; // set half carry flag
-    if((A + read_r8(r) + (carry ? saved_carry : 0))>>8) F |= 0b00010000; // set carry flag
-    A += read_r8(r) + (carry ? saved_carry : 0);
-    if(A == 0) F |= 0b10000000; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::sub_r(BYTE carry, BYTE r) {
-    cycles = 1 + (r == 6);
-    BYTE saved_carry = Carry;
-    F &= 0x0F;
-    if((A&0xF) < ((read_r8(r)&0xF) + (carry ? saved_carry : 0))) F |= 0b00100000; // set half carry flag
-    if(A < read_r8(r) + (carry ? saved_carry : 0)) F |= 0b00010000; // set carry flag
-    A -= read_r8(r) + (carry ? saved_carry : 0);
-    if(A == 0) F |= 0b10000000; // set zero flag
-    F |= 0b01000000; // set subtract flag
-    PC += 1;
-}
-
-inline void CPU::cp_r(BYTE r) {
-    cycles = 1 + (r == 6);
-    F &= 0x0F;
-    BYTE value = read_r8(r);
-    if(A == value) F |= 0b10000000; // set zero flag
-    if((A&0xF) < (read_r8(r)&0xF)) F |= 0b00100000; // set half carry flag
-    if(A < read_r8(r)) F |= 0b00010000; // set carry flag
-    F |= 0b01000000; // set subtract flag
-    PC += 1;
-}
-
-inline void CPU::inc_r(BYTE r) {
-    cycles = 1 + (r == 6)*2;
-    write_r8(r, read_r8(r)+1);
-    F &= 0x1F;
-    BYTE value = read_r8(r);
-    if(value == 0) F |= 0b10000000; // set zero flag
-    if((value & 0xF) == 0) F |= 0b00100000; // set half carry flag
-    PC += 1;
-}
-
-inline void CPU::dec_r(BYTE r) {
-    cycles = 1 + (r == 6)*2;
-    write_r8(r, read_r8(r)-1);
-    F &= 0x1F;
-    BYTE value = read_r8(r);
-    if(value == 0) F |= 0b10000000; // set zero flag
-    if((value & 0xF) == 0xF) F |= 0b00100000; // set half carry flag
-    F |= 0b01000000; // set subtract flag
-    PC += 1;
-}
-
-inline void CPU::bit_and(BYTE r) {
-    cycles = 1 + (r == 6);
-    A &= read_r8(r);
-    F &= 0x0F;
-    if(A == 0) F |= 0b10000000; // set zero flag
-    F |= 0b00100000; // set half carry flag
-    PC += 1;
-}
-
-inline void CPU::bit_or(BYTE r) {
-    cycles = 1 + (r == 6);
-    A |= read_r8(r);
-    F &= 0x0F;
-    if(A == 0) F |= 0b10000000; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::bit_xor(BYTE r) {
-    cycles = 1 + (r == 6);
-    A ^= read_r8(r);
-    F &= 0x0F;
-    if(A == 0) F |= 0b10000000; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::inc_r16(BYTE r) {
-    cycles = 2;
-    write_r16(r, read_r16(r)+1);
-    PC += 1;
-}
-
-inline void CPU::dec_r16(BYTE r) {
-    cycles = 2;
-    write_r16(r, read_r16(r)-1);
-    PC += 1;
-}
-
-inline void CPU::add_r16(BYTE r) {
-    cycles = 2;
-    F &= 0x8F; // clear flags except zero
-    if((HL + read_r16(r))>>16) {
-        F |= 0b00010000; // set carry flag
-    }
-    if(((HL&0xFFF) + (read_r16(r)&0xFFF))>>12){
-        F |= 0b00100000; // set half carry flag
-    }
-    HL += read_r16(r);
-    PC += 1;
-}
-
-inline void CPU::rotate_left_circular(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b10000000) >> 3; // set carry flag
-    value = (value << 1) | (value >> 7);
-    write_r8(r, value);
-    F |= (value == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::rotate_right_circular(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b00000001) << 4; // set carry flag
-    value = (value >> 1) | (value << 7);
-    write_r8(r, value);
-    F |= (value == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::rotate_left(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    BYTE carry = Carry;
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b10000000) >> 3; // set carry flag
-    value = (value << 1) | (carry);
-    write_r8(r, value);
-    F |= (value == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::rotate_right(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    BYTE carry = Carry;
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b00000001) << 4; // set carry flag
-    value = (value >> 1) | (carry << 7);
-    write_r8(r, value);
-    F |= (read_r8(r) == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::sla(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b10000000) >> 3; // set carry flag
-    write_r8(r, value << 1);
-    F |= (read_r8(r) == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::sra(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b00000001) << 4; // set carry flag
-    write_r8(r, (value >> 1) | (value & 0b10000000));
-    F |= (read_r8(r) == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::srl(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    F |= (value & 0b00000001) << 4; // set carry flag
-    write_r8(r, (value >> 1));
-    F |= (read_r8(r) == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline void CPU::swap(BYTE r) {
-    cycles = 2 + 2*(r==6);
-    F &= 0x0F; // clear flags
-    BYTE value = read_r8(r);
-    write_r8(r, ((value & 0b11110000) >> 4) | ((value & 0b00001111) << 4));
-    F |= (read_r8(r) == 0) << 7; // set zero flag
-    PC += 1;
-}
-
-inline bool CPU::test_flag(int flag) {
-    return ((F & (1 << flag))) ? true : false;
-    // ZNHC0000
-}
-
-inline void CPU::jump(bool is_conditional, int flag, int condition) {
-    WORD nn = read_mem(PC + 1) + (read_mem(PC + 2) << 8);
-    if (!is_conditional || flag == condition) {
-        PC = nn;
-        cycles = 4;
-    } else {
-        PC += 3;
-        cycles = 3;     // duration on pg111
-    }
-}
-
-inline void CPU::jump_relative(bool is_conditional, int flag, int condition) {
-    SIGNED_BYTE n = read_mem(PC + 1);
-    PC += 2;
-    if (!is_conditional || flag == condition) {
-        PC += n;
-        cycles = 3;
-    } else {
-        cycles = 2;    // pg 114
-    }
-}
-
-inline void CPU::call(bool is_conditional, int flag, int condition) {
-    WORD nn = read_mem(PC + 1) + (read_mem(PC + 2) << 8);
-    if (!is_conditional || flag == condition) {
-        PC += 3;
-        write_mem(--SP, pchigh);
-        write_mem(--SP, pclow);
-        PC = nn;
-        cycles = 6;
-    } else {
-        PC += 3;
-        cycles = 3;
-    }
-}
-
-inline void CPU::ret(bool is_conditional, int flag, int condition) {
-    if (!is_conditional) {
-        cycles = 4;
-        BYTE low = read_mem(SP++);
-        BYTE high = read_mem(SP++);
-        PC = low + (high << 8);
-    } else if (flag == condition) {
-        cycles = 5;
-        BYTE low = read_mem(SP++);
-        BYTE high = read_mem(SP++);
-        PC = low + (high << 8);
-    } else {
-        cycles = 2;
-        PC += 1;
+void CPU::set_joypad(BYTE state) {
+    for (int key = 0; key < 8; key++) {
+        BYTE bit = 1 << key;
+        if (!(state & bit) && (joypad_state & bit)) {
+            key_pressed(key);
+        } else if ((state & bit) && !(joypad_state & bit)) {
+            key_released(key);
+        }
     }
 }
 
-inline void CPU::restart(BYTE n) {
-    cycles = 4;
-    PC++;
-    write_mem(--SP, pchigh);
-    write_mem(--SP, pclow);
-    PC = n;
-}
-
 uint32_t CPU::exec() {
-    if(stopped) {
-        if(~read_mem(0xFF00) & 0xF) {
-            stopped = false;
-        }
-        return 1;
-    }
     if(halted){
-        if(read_mem(0xFFFF) & read_mem(0xFF0F) & 0x1F){
+        if(pending && !locked){
             halted = false;
         }
         return 1;
     }
     BYTE opc = read_mem(PC);
-    // WORD pcval = PC;
-    // BYTE rmpc =  opc;
-    // BYTE rmpc1 = read_mem(PC + 1);
-    // BYTE rmpc2 = read_mem(PC + 2);
-    // BYTE rmpc3 = read_mem(PC + 3);
-    // fprintf(stderr, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n", A, F, B, C, D, E, H, L, SP, pcval, rmpc, rmpc1, rmpc2, rmpc3);
     switch(opc) {
         // nop
         case 0x00:
@@ -745,29 +302,8 @@ uint32_t CPU::exec() {
             break;
         // stop
         case 0x10:
-            cycles = 1;
-            if((~read_mem(0xFF00) & 0xF) || true) {
-                if(read_mem(0xFFFF) & read_mem(0xFF0F) & 0x1F) {
-                    PC += 1;
-                    break;
-                }else {
-                    PC += 2;
-                    // halted = 1;
-                    break;
-                }
-            }else {
-                if(read_mem(0xFFFF) & read_mem(0xFF0F) & 0x1F) {
-                    stopped = 1;
-                    divider_reg = 0;
-                    PC += 1;
-                    break;
-                }else {
-                    stopped = 1;
-                    divider_reg = 0;
-                    PC += 2;
-                    break;
-                }
-            }
+            stop();
+            break;
         case 0b01000000:
             ld_r_r(0,0);
             break;
@@ -931,17 +467,7 @@ uint32_t CPU::exec() {
             ld_r_r(6,5);
             break;
         case 0x76:
-            if(IME){
-                halted = true;
-            }else{
-                if(!(read_mem(0xFFFF) & read_mem(0xFF0F) & 0x1F)){
-                    halted = true;
-                }else{
-                    halted = false; // do the halt bug
-                }
-            }
-            PC+=1;
-            cycles = 1;
+            halt();
             break;
         case 0b01110111:
             ld_r_r(6,7);
@@ -972,28 +498,28 @@ uint32_t CPU::exec() {
         // load register (immediate)
             break;
         case 0b00000110:
-            ld_r_imm(0);
+            ld_r_imm(0, read_mem(PC + 1));
             break;
         case 0b00001110:
-            ld_r_imm(1);
+            ld_r_imm(1, read_mem(PC + 1));
             break;
         case 0b00010110:
-            ld_r_imm(2);
+            ld_r_imm(2, read_mem(PC + 1));
             break;
         case 0b00011110:
-            ld_r_imm(3);
+            ld_r_imm(3, read_mem(PC + 1));
             break;
         case 0b00100110:
-            ld_r_imm(4);
+            ld_r_imm(4, read_mem(PC + 1));
             break;
         case 0b00101110:
-            ld_r_imm(5);
+            ld_r_imm(5, read_mem(PC + 1));
             break;
         case 0b00110110:
-            ld_r_imm(6);
+            ld_r_imm(6, read_mem(PC + 1));
             break;
         case 0b00111110:
-            ld_r_imm(7);
+            ld_r_imm(7, read_mem(PC + 1));
             break;
         // load accumulator (indirect register)
         case 0b00001010:
@@ -1023,59 +549,44 @@ uint32_t CPU::exec() {
             break;
         // load accumulator direct
         case 0xFA:
-            cycles = 4;
-            A = read_mem(read_mem(PC + 1) + (read_mem(PC + 2) << 8));
-            PC += 3;
+            ld_a_nn(imm16());
             break;
         // load from accumulator direct
         case 0xEA:
-            cycles = 4;
-            write_mem(read_mem(PC + 1) + (read_mem(PC + 2) << 8), A);
-            PC += 3;
+            ld_nn_a(imm16());
             break;
         // load accumulator indirect c
         case 0xF2:
-            cycles = 2;
-            A = read_mem(0xFF00 + C);
-            PC += 1;
+            ld_a_c();
             break;
         // load from accumulator indirect c
         case 0xE2:
-            cycles = 2;
-            write_mem(0xFF00 + C, A);
-            PC += 1;
+            ld_c_a();
             break;
         // load accumulator direct 
         case 0xF0:
-            cycles = 3;
-            A = read_mem(0xFF00 + read_mem(PC + 1));
-            PC += 2;
+            ldh_a_n(read_mem(PC + 1));
             break;
         // load from accumulator direct
         case 0xE0:
-            cycles = 3;
-            write_mem(0xFF00 + read_mem(PC + 1), A);
-            PC += 2;
+            ldh_n_a(read_mem(PC + 1));
             break;
         // load 16 bit register
         case 0b00000001:
-            ld_rr_nn(0);
+            ld_rr_nn(0, imm16());
             break;
         case 0b00010001:
-            ld_rr_nn(1);
+            ld_rr_nn(1, imm16());
             break;
         case 0b00100001:
-            ld_rr_nn(2);
+            ld_rr_nn(2, imm16());
             break;
         case 0b00110001:
-            ld_rr_nn(3);
+            ld_rr_nn(3, imm16());
             break;
         // load from stack pointer (direct)
         case 0x08:
-            cycles = 5;
-            write_mem(read_mem(PC + 1) + (read_mem(PC + 2) << 8), splow);
-            write_mem(read_mem(PC + 1) + (read_mem(PC + 2) << 8) + 1, sphigh);
-            PC += 3;
+            ld_nn_sp(imm16());
             break;
         // load stack pointer from hl
         case 0xF9:
@@ -1111,16 +622,7 @@ uint32_t CPU::exec() {
             break;
         // load hl from adjusted sp
         case 0xF8:
-            cycles = 3;
-            HL = SP + SIGNED_BYTE(read_mem(PC + 1));
-            F &= 0x0F; // clear flags
-            if((((SP&0xFF) + (SIGNED_BYTE(read_mem(PC + 1))&0xFF)))>>8) {
-                F |= 0b00010000; // set carry flag
-            }
-            if(((SP&0xF) + (SIGNED_BYTE(read_mem(PC + 1))&0xF))>>4){
-                F |= 0b00100000; // set half carry flag
-            }
-            PC += 2;
+            ld_hl_sp(read_mem(PC + 1));
             break;
         // add register to accumulator
         case 0b10000000:
@@ -1149,14 +651,7 @@ uint32_t CPU::exec() {
             break;
         // add immediate to accumulator
         case 0xC6:
-            cycles = 2;
-            F &= 0x0F;
-            if(((A&0xF)+(read_mem(PC+1)&0xF))>>4) F |= 0b00100000; // set half carry flag
-            if((A+read_mem(PC+1))>>8) F |= 0b00010000; // set carry flag
-            A += read_mem(PC + 1);
-            
-            if(A == 0) F |= 0b10000000; // set zero flag
-            PC += 2;
+            add_imm(0, read_mem(PC + 1));
             break;
         // add with carry
         case 0b10001000:
@@ -1184,17 +679,9 @@ uint32_t CPU::exec() {
             add_r(1, 7);
             break;
         // add immediate with carry
-        case 0xCE:{
-            cycles = 2;
-            BYTE saved_carry = Carry;
-            F &= 0x0F;
-            if(((A&0xF)+(read_mem(PC+1)&0xF)+ (saved_carry))>>4) F |= 0b00100000; // set half carry flag
-            if((A+read_mem(PC+1) +  (saved_carry))>>8) F |= 0b00010000; // set carry flag
-            A += read_mem(PC + 1) + (saved_carry);
-            if(A == 0) F |= 0b10000000; // set zero flag
-            PC += 2;
+        case 0xCE:
+            add_imm(1, read_mem(PC + 1));
             break;
-        }
         // subtract register from accumulator
         case 0b10010000:
             sub_r(0, 0);
@@ -1222,14 +709,7 @@ uint32_t CPU::exec() {
             break;
         // subtract immediate from accumulator
         case 0xD6:
-            cycles = 2;
-            F &= 0x0F;
-            if((A&0xF) < (read_mem(PC+1)&0xF)) F |= 0b00100000; // set half carry flag
-            if(A < read_mem(PC+1)) F |= 0b00010000; // set carry flag
-            A -= read_mem(PC + 1);
-            if(A == 0) F |= 0b10000000; // set zero flag
-            F |= 0b01000000; // set subtract flag
-            PC += 2;
+            sub_imm(0, read_mem(PC + 1));
             break;
         // subtract with carry
         case 0b10011000:
@@ -1257,18 +737,9 @@ uint32_t CPU::exec() {
             sub_r(1, 7);
             break;
         // subtract immediate with carry
-        case 0xDE:{
-            cycles = 2;
-            BYTE saved_carry = Carry;
-            F &= 0x0F;
-            if((A&0xF) < ((read_mem(PC+1)&0xF) + (saved_carry))) F |= 0b00100000; // set half carry flag
-            if(A < read_mem(PC+1) + (saved_carry)) F |= 0b00010000; // set carry flag
-            A -= read_mem(PC + 1) + (saved_carry);
-            if(A == 0) F |= 0b10000000; // set zero flag
-            F |= 0b01000000; // set subtract flag
-            PC += 2;
+        case 0xDE:
+            sub_imm(1, read_mem(PC + 1));
             break;
-        }
         // compare register
         case 0b10111000:
             cp_r(0);
@@ -1295,17 +766,9 @@ uint32_t CPU::exec() {
             cp_r(7);
             break;
         // compare immediate
-        case 0xFE:{
-            cycles = 2;
-            F &= 0x0F;
-            BYTE val = read_mem(PC + 1);
-            if(A == val) F |= 0b10000000; // set zero flag
-            if((A&0xF) < (val&0xF)) F |= 0b00100000; // set half carry flag
-            if(A < val) F |= 0b00010000; // set carry flag
-            F |= 0b01000000; // set subtract flag
-            PC += 2;
+        case 0xFE:
+            cp_imm(read_mem(PC + 1));
             break;
-        }
         // increment register
         case 0b00000100:
             inc_r(0);
@@ -1383,12 +846,7 @@ uint32_t CPU::exec() {
             break;
         // bitwise and immediate
         case 0xE6:
-            cycles = 2;
-            A &= read_mem(PC + 1);
-            F &= 0x0F;
-            if(A == 0) F |= 0b10000000; // set zero flag
-            F |= 0b00100000; // set half carry flag
-            PC += 2;
+            and_imm(read_mem(PC + 1));
             break;
         // bitwise or register
         case 0b10110000:
@@ -1417,11 +875,7 @@ uint32_t CPU::exec() {
             break;
         // bitwise or immediate
         case 0xF6:
-            cycles = 2;
-            A |= read_mem(PC + 1);
-            F &= 0x0F;
-            if(A == 0) F |= 0b10000000; // set zero flag
-            PC += 2;
+            or_imm(read_mem(PC + 1));
             break;
         // bitwise xor register
         case 0b10101000:
@@ -1450,64 +904,23 @@ uint32_t CPU::exec() {
             break;
         // bitwise xor immediate
         case 0xEE:
-            cycles = 2;
-            A ^= read_mem(PC + 1);
-            F &= 0x0F;
-            if(A == 0) F |= 0b10000000; // set zero flag
-            PC += 2;
+            xor_imm(read_mem(PC + 1));
             break;
         // complement carry flag
         case 0x3F:
-            cycles = 1;
-            F &= 0x9F;
-            F ^= 0b00010000;
-            PC += 1;
+            ccf();
             break;
         // set carry flag
         case 0x37:
-            cycles = 1;
-            F &= 0x9F;
-            F |= 0b00010000;
-            PC += 1;
+            scf();
+            break;
+        // decimal adjust accumulator
+        case 0x27:
+            daa();
             break;
-            case 0x27: { // DAA - Decimal Adjust Accumulator
-                cycles = 1;
-                BYTE correction = 0;
-                if (!(F & 0x40)) {
-                    if ((F & 0x20) || (A & 0x0F) > 9) {
-                        correction += 0x06;
-                    }
-                    if ((F & 0x10) || A > 0x99) {
-                        correction += 0x60;
-                        F |= 0x10; 
-                    }
-                    A += correction;
-                }
-                else {
-                    if (F & 0x20) {
-                        correction += 0x06;
-                    }
-                    if (F & 0x10) {
-                        correction += 0x60;
-                    }
-                    A -= correction;
-                }
-                F &= ~0x20;
-                if (A == 0) {
-                    F |= 0x80; 
-                } else {
-                    F &= ~0x80; 
-                }
-                PC += 1;
-                break;
-            }
         // complement accumulator
         case 0x2F:
-            cycles = 1;
-            A = ~A;
-            F &= 0x9F;
-            F |= 0b01100000; // set subtract and half carry flag
-            PC += 1;
+            cpl();
             break;
         // inc 16 bit register
         case 0b00000011:
@@ -1550,53 +963,24 @@ uint32_t CPU::exec() {
             break;
         // add relative to stack pointer
         case 0xE8:
-            cycles = 4;
-            F &= 0x0F; // clear flags
-            if(((SP&0xFF) + (SIGNED_BYTE(read_mem(PC + 1))&0xFF)) >> 8) {
-                F |= 0b00010000; // set carry flag
-            }
-            if(((SP&0xF) + (SIGNED_BYTE(read_mem(PC + 1))&0xF)) >> 4) {
-                F |= 0b00100000; // set half carry flag
-            }
-            SP += SIGNED_BYTE(read_mem(PC + 1));
-            PC += 2;
+            add_sp(read_mem(PC + 1));
             break;
         // rotate left circular
         case 0x07:
-            cycles = 1;
-            F &= 0x0F; // clear flags
-            F |= (A & 0b10000000) >> 3; // set carry flag
-            A = (A << 1) | (A >> 7);
-            PC += 1;
+            rlca();
             break;
         // rotate right circular
         case 0x0F:
-            cycles = 1;
-            F &= 0x0F; // clear flags
-            F |= (A & 0b00000001) << 4; // set carry flag
-            A = (A >> 1) | (A << 7);
-            PC += 1;
+            rrca();
             break;
         // rotate left through carry
-        case 0x17:{
-            cycles = 1;
-            BYTE carry = Carry;
-            F &= 0x0F; // clear flags
-            F |= (A & 0b10000000) >> 3; // set carry flag
-            A = (A << 1) | (carry);
-            PC += 1;
+        case 0x17:
+            rla();
             break;
-        }
         // rotate right through carry
-        case 0x1F:{
-            cycles = 1;
-            BYTE carry = Carry;
-            F &= 0x0F; // clear flags
-            F |= (A & 0b00000001) << 4; // set carry flag
-            A = (A >> 1) | (carry << 7);
-            PC += 1;
+        case 0x1F:
+            rra();
             break;
-        }
         case 0xCB:{
             PC++;
             BYTE opcode = read_mem(PC); 
@@ -1795,82 +1179,72 @@ uint32_t CPU::exec() {
                 case 0b00111111:
                     srl(7);
                     break;
-                default:
+                default: // 0x40-0xFF, everything below has a case above
                     switch(opcode>>6){
-                        case 0b00:
-                            std::cerr << "cb meow?" << std::endl;exit(-1);
                         case 0b01: // test bit
-                            cycles = 2 + ((opcode&0b00000111)==6);
-                            F &= 0x1F;
-                            F |= 0b00100000; // set half carry flag
-                            if((((read_r8(opcode & 0b00000111))>>((opcode>>3)&7))&1) == 0) F |= 0b10000000; // set zero flag
-                            PC += 1;
+                            test_bit((opcode>>3)&7, opcode & 0b00000111);
                             break;
                         case 0b10: // reset bit
-                            cycles = 2 + ((opcode&0b00000111)==6);
-                            write_r8(opcode & 0b00000111, read_r8(opcode & 0b00000111) & ~(1 << ((opcode>>3)&7)));
-                            PC += 1;
+                            reset_bit((opcode>>3)&7, opcode & 0b00000111);
                             break;
                         case 0b11: // set bit
-                            cycles = 2 + ((opcode&0b00000111)==6);
-                            write_r8(opcode & 0b00000111, read_r8(opcode & 0b00000111) | (1 << ((opcode>>3)&7)));
-                            PC += 1;
-                            break;  
+                            set_bit((opcode>>3)&7, opcode & 0b00000111);
+                            break;
                     }
             }
             break;
         }
         // jumps to immediate  
         case 0xC3:  // unconditional
-            jump(false, 0, false);
+            jump(false, 0, false, imm16());
             break;
         case 0xE9:  // jump hl
-            cycles = 4;
+            cycles = 1;
             PC = HL;
             break;
         case 0b11000010:    // cc = 00, NZ
-            jump(true, Z, false);
+            jump(true, Z, false, imm16());
             break;
         case 0b11001010:    // cc = 01, Z
-            jump(true, Z, true);
+            jump(true, Z, true, imm16());
             break;
         case 0b11010010:    // cc = 10, NC
-            jump(true, Carry, false);
+            jump(true, Carry, false, imm16());
             break;
         case 0b11011010:    // cc = 11, C
-            jump(true, Carry, true);
+            jump(true, Carry, true, imm16());
             break;
         // jumps to relative address
         case 0x18:  // unconditional
-            jump_relative(false, 0, false);
+            jump_relative(false, 0, false, read_mem(PC + 1));
             break;
         case 0b00100000:    // cc = 00, NZ
-            jump_relative(true, Z, false);
+            jump_relative(true, Z, false, read_mem(PC + 1));
             break;
         case 0b00101000:    // cc = 01, Z
-            jump_relative(true, Z, true);
+            jump_relative(true, Z, true, read_mem(PC + 1));
             break;
         case 0b00110000:    // cc = 10, NC
-            jump_relative(true, Carry, false);
+            jump_relative(true, Carry, false, read_mem(PC + 1));
             break;
         case 0b00111000:    // cc = 11, C
-            jump_relative(true, Carry, true);
+            jump_relative(true, Carry, true, read_mem(PC + 1));
             break;
         // calls
         case 0xCD:  // unconditional
-            call(false, 0, false);
+            call(false, 0, false, imm16());
             break;
         case 0b11000100:    // cc = 00, NZ
-            call(true, Z, false);
+            call(true, Z, false, imm16());
             break;
         case 0b11001100:    // cc = 01, Z
-            call(true, Z, true);
+            call(true, Z, true, imm16());
             break;
         case 0b11010100:    // cc = 10, NC
-            call(true, Carry, false);
+            call(true, Carry, false, imm16());
             break;
         case 0b11011100:    // cc = 11, C
-            call(true, Carry, true);
+            call(true, Carry, true, imm16());
             break;
         // returns
         case 0xC9: // unconditional
@@ -1889,14 +1263,9 @@ uint32_t CPU::exec() {
             ret(true, Carry, true);
             break;
         // return from interrupt handler
-        case 0xD9: {
-            cycles = 4;  
-            BYTE low = read_mem(SP++);
-            BYTE high = read_mem(SP++);
-            PC = low + (high << 8);
-            IME = 1;
+        case 0xD9:
+            reti();
             break;
-        }
         // restarts
         case 0b11000111:    // rst 0x0
             restart(0x00);
@@ -1934,12 +1303,14 @@ uint32_t CPU::exec() {
             cycles = 1;
             break;
         default:
-            std::cerr << "meow?" << std::endl;
-            printf("Unknown opcode: 0x%02X\n", opc);
-            printf("Invalid instruction %x encountered at PC=0x%04X\n", opc, PC);
-            printf("ROM bank: %d, RAM bank: %d\n", curr_rom_bank, curr_ram_bank);
-            // fprintf(stderr, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X JOYPAD:%02X\n", A, F, B, C, D, E, H, L, SP, pcval, rmpc, rmpc1, rmpc2, rmpc3, rom[0xFF00]);
-            exit(-1);
+            // not an instruction: the real cpu hangs for good, deaf to
+            // interrupts. Whoever runs the console finds out from locked.
+            locked = 1;
+            locked_at = PC;
+            halted = 1;
+            IME = 0;
+            IME_next = 0;
+            cycles = 1;
             break;
     }
 
@@ -3,9 +3,12 @@
 #include <vector>
 #include <functional>
 #include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "memory.h"
 
 #define PC_START 0x100
-#define RAM_BANK_SIZE 0x8000
+#define OAM_DMA_CYCLES 644 // a machine cycle to start, then one per byte
 
 typedef unsigned char BYTE;
 typedef char SIGNED_BYTE;
@@ -35,6 +38,14 @@ typedef signed short SIGNED_WORD;
 #define pclow pc.low
 #define pchigh pc.high
 
+class APU;
+class Serial;
+class Mapper;
+class SaveFile;
+class PPU;
+class LCD;
+class Timer;
+
 union Register {
     struct {
         BYTE low;
@@ -45,55 +56,111 @@ union Register {
     Register(WORD val) : word(val) {};
 };
 
-class CPU {
+class alignas(64) CPU {
 
 public:
-    CPU() {};
-    CPU(BYTE* rom);
+    CPU();
+    CPU(BYTE* rom, size_t rom_size);
+    CPU(CPU&&);
+    CPU& operator=(CPU&&);
+    ~CPU();
 
-    BYTE read_mem(WORD addr);
+    // while an oam dma holds the bus the cpu only reaches io and hram, and
+    // reads 0xFF anywhere else
+    inline BYTE read_mem(WORD addr) {
+        if (dma && addr < 0xFF00 && bus_held()) {
+            return 0xFF;
+        }
+        return peek(addr);
+    }
     void write_mem(WORD addr, BYTE data);
+    // what is at addr, as read_mem() would see it with the bus free
+    BYTE peek(WORD addr);
+    inline bool bus_held() {
+        if (clock < dma_end) {
+            return true;
+        }
+        dma = 0;
+        return false;
+    }
     
     void interrupt(int signal);
-    int check_interrupts();
+    // before each instruction: take the first pending interrupt if they are
+    // enabled, returning the cycles that took, then let an ei from the
+    // instruction before take effect
+    inline int check_interrupts() {
+        int taken = 0;
+        if (IME && pending) {
+            handle_interrupt(__builtin_ctz(pending));
+            taken = 5;
+        }
+        if (IME_next) {
+            IME = 1;
+            IME_next = 0;
+        }
+        return taken;
+    }
     void handle_interrupt(int signal);
-    void update_timers(int cycles);
 
     void key_pressed(int key_code);
     void key_released(int key_code);
+    // press and release keys to match a whole joypad_state
+    void set_joypad(BYTE state);
 
-    BYTE screen[144][160][3];
-    BYTE IME = 0; // interrupt master enable
-    BYTE IME_next = 0;
-
-    int dirtyMaxX = 0;
-    int dirtyMaxY = 0;
-    int dirtyMinX = 159;
-    int dirtyMinY = 143;
     void resetDirty();
 
     // execute the next instruction returns the number of cycles the instruction took
     uint32_t exec();
 
-    BYTE ram[RAM_BANK_SIZE];
+    // what every instruction touches comes first and fits in two cache
+    // lines (checked in cpu.cc), the picture is last
     Register af, bc, de, hl, sp, pc;
+    BYTE IME = 0; // interrupt master enable
+    BYTE IME_next = 0;
+    BYTE halted = 0;
+    BYTE locked = 0;    // ran an opcode that doesn't exist, halted for good
+    WORD locked_at = 0; // where
     uint32_t cycles;
-    BYTE* rom;
-    BYTE curr_rom_bank, curr_ram_bank;
-    bool mbc1, mbc2, mbc3;
-    bool rom_banking;
-    bool ram_en;
-    int divider_reg;
-    int timer_counter;
+    uint64_t clock = 0; // 4.19MHz cycles since power on, as of the current instruction
+    // current banks as published by the mapper
+    BYTE* rom0 = nullptr;
+    BYTE* romx = nullptr;
+    BYTE* sram = nullptr;
     BYTE joypad_state;
-    int clock_speed;
-    BYTE halted = 0;
-    BYTE stopped = 0;
-    WORD rom_bank_count = 0;
-    BYTE* rom_clone;
+    BYTE dma = 0; // an oam dma may still hold the bus, see dma_end
+    BYTE pending = 0; // IF & IE, the interrupts waiting to be taken
+
+    APU* apu = nullptr; // sound registers are forwarded here when set
+    Serial* serial = nullptr; // as are SB and SC
+    Timer* timer = nullptr; // and DIV, TIMA, TMA and TAC
+    PPU* ppu = nullptr; // brought up to date before video memory changes
+    LCD* lcd = nullptr; // works out LY and STAT, owns LCDC/STAT/LYC writes
+    SaveFile* save = nullptr; // told about battery ram stores
+    std::unique_ptr<Mapper> mapper;
+    BYTE* rom; // cartridge image
+
+    Memory mem; // address space outside the cartridge, page table first
+
+    size_t rom_size = 0;
+    uint64_t dma_end = 0; // when the last oam dma lets go of the bus
+    int dirtyMaxX = 0;
+    int dirtyMaxY = 0;
+    int dirtyMinX = 159;
+    int dirtyMinY = 143;
+    // one grey level per pixel (white 0xFF, 0xCC, 0x77, black 0x00), so
+    // the four shades are both palette index and displayable luminance
+    BYTE screen[144][160];
 
     void bank_mem(WORD addr, BYTE data);
-    void set_clock_freq();
+    // where addr is held in the host's memory, running on to at least the
+    // end of its 256 byte block; null for registers and cartridge ram
+    const BYTE* host_pointer(WORD addr) const;
+    void map_banks();
+    // take over the registers and memory of another cpu of the same console,
+    // leaving the picture, cartridge and unit pointers alone; map_banks()
+    // once the mapper is back too
+    void copy_state(const CPU& other);
+    // the instructions exec() is made of (cpu_ops.h)
     inline void write_r8(BYTE r, BYTE data);
     inline BYTE read_r8(BYTE r);
     inline void write_r16(BYTE r, WORD data);
@@ -103,10 +170,10 @@ public:
     inline void write_r16stk(BYTE r, WORD data, bool high);
     inline WORD read_r16stk(BYTE r, bool high);
     inline void ld_r_r(BYTE r1, BYTE r2);
-    inline void ld_r_imm(BYTE r);
+    inline void ld_r_imm(BYTE r, BYTE n);
     inline void ld_a_r16mem(BYTE r);
     inline void ld_r16mem_a(BYTE r);
-    inline void ld_rr_nn(BYTE r);
+    inline void ld_rr_nn(BYTE r, WORD nn);
     inline void push_rr(BYTE r);
     inline void pop_rr(BYTE r);
     inline void add_r(BYTE carry, BYTE r);
@@ -129,9 +196,39 @@ public:
     inline void srl(BYTE r);
     inline void swap(BYTE r);
     inline bool test_flag(int flag);
-    inline void jump(bool is_conditional, int flag, int condition);
-    inline void jump_relative(bool is_conditional, int flag, int condition);
-    inline void call(bool is_conditional, int flag, int condition);
+    inline void jump(bool is_conditional, int flag, int condition, WORD nn);
+    inline void jump_relative(bool is_conditional, int flag, int condition, SIGNED_BYTE n);
+    inline void call(bool is_conditional, int flag, int condition, WORD nn);
     inline void ret(bool is_conditional, int flag, int condition);
     inline void restart(BYTE n);
+    inline WORD imm16();
+    inline void stop();
+    inline void halt();
+    inline void ld_a_nn(WORD nn);
+    inline void ld_nn_a(WORD nn);
+    inline void ld_a_c();
+    inline void ld_c_a();
+    inline void ldh_a_n(BYTE n);
+    inline void ldh_n_a(BYTE n);
+    inline void ld_nn_sp(WORD nn);
+    inline void ld_hl_sp(SIGNED_BYTE e);
+    inline void add_sp(SIGNED_BYTE e);
+    inline void add_imm(BYTE carry, BYTE n);
+    inline void sub_imm(BYTE carry, BYTE n);
+    inline void cp_imm(BYTE n);
+    inline void and_imm(BYTE n);
+    inline void or_imm(BYTE n);
+    inline void xor_imm(BYTE n);
+    inline void ccf();
+    inline void scf();
+    inline void daa();
+    inline void cpl();
+    inline void rlca();
+    inline void rrca();
+    inline void rla();
+    inline void rra();
+    inline void reti();
+    inline void test_bit(BYTE bit, BYTE r);
+    inline void reset_bit(BYTE bit, BYTE r);
+    inline void set_bit(BYTE bit, BYTE r);
 };
\ No newline at end of file
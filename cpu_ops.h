@@ -0,0 +1,665 @@
+#pragma once
+#include <cstdlib>
+#include "cpu.h"
+
+// what each instruction does, for exec() and for code recompiled ahead of
+// time (aot.h), which calls the same helpers with the operands filled in
+
+inline BYTE CPU::read_r8(BYTE r) {
+    switch(r) {
+        case 0: return B;
+        case 1: return C;
+        case 2: return D;
+        case 3: return E;
+        case 4: return H;
+        case 5: return L;
+        case 6: return read_mem(HL);
+        case 7: return A;
+    }
+    exit(-1);
+}
+
+inline void CPU::write_r8(BYTE r, BYTE data) {
+    switch(r) {
+        case 0: B = data; break;
+        case 1: C = data; break;
+        case 2: D = data; break;
+        case 3: E = data; break;
+        case 4: H = data; break;
+        case 5: L = data; break;
+        case 6: write_mem(HL, data); break;
+        case 7: A = data; break;
+    }
+}
+
+inline void CPU::write_r16(BYTE r, WORD data) {
+    switch(r) {
+        case 0: bc.word = data; break;
+        case 1: de.word = data; break;
+        case 2: hl.word = data; break;
+        case 3: sp.word = data; break;
+    }
+}
+
+inline WORD CPU::read_r16(BYTE r) {
+    switch(r) {
+        case 0: return bc.word;
+        case 1: return de.word;
+        case 2: return hl.word;
+        case 3: return sp.word;
+    }
+    exit(-1);
+}
+
+inline void CPU::write_r16mem(BYTE r, WORD data) {
+    exit(0);
+}
+
+inline WORD CPU::read_r16mem(BYTE r) {
+    switch(r) {
+        case 0: return (BC);
+        case 1: return (DE);
+        case 2: return (HL);
+        case 3: return (HL);
+    }
+    exit(-1);
+}
+
+inline void CPU::write_r16stk(BYTE r, WORD data, bool high) {
+    switch(r) {
+        case 0: if(high){bc.high = data;}else{bc.low = data;} break;
+        case 1: if(high){de.high = data;}else{de.low = data;} break;
+        case 2: if(high){hl.high = data;}else{hl.low = data;} break;
+        case 3: if(high){af.high = data;}else{af.low = (data&0xF0);} break;
+    }
+}
+
+inline WORD CPU::read_r16stk(BYTE r, bool high) {
+    switch(r) {
+        case 0: if(high){return bc.high;}else{return bc.low;}
+        case 1: if(high){return de.high;}else{return de.low;}
+        case 2: if(high){return hl.high;}else{return hl.low;}
+        case 3: if(high){return af.high;}else{return af.low;}
+    }
+    exit(-1);
+}
+
+inline void CPU::ld_r_r(BYTE r1, BYTE r2) {
+    cycles = 1 + (r2 == 6 || r1 == 6);
+    write_r8(r1, read_r8(r2)); 
+    PC += 1;
+}
+
+inline void CPU::ld_r_imm(BYTE r, BYTE n) {
+    cycles = 2 + (r == 6);
+    write_r8(r, n);
+    PC += 2;
+}
+
+inline void CPU::ld_a_r16mem(BYTE r) {
+    cycles = 2;
+    A = read_mem(read_r16mem(r));
+    if(r == 2) {
+        HL++;
+    } else if (r == 3) {
+        HL--;
+    }
+    PC += 1;
+}
+
+inline void CPU::ld_r16mem_a(BYTE r) {
+    cycles = 2;
+    write_mem(read_r16mem(r), A);
+    if(r == 2) {
+        HL++;
+    } else if (r == 3) {
+        HL--;
+    }
+    PC += 1;
+}
+
+inline void CPU::ld_rr_nn(BYTE r, WORD nn) {
+    cycles = 3;
+    write_r16(r, nn);
+    PC += 3;
+}
+
+inline void CPU::push_rr(BYTE r) {
+    cycles = 4;
+    write_mem(--SP, (read_r16stk(r, true)));
+    write_mem(--SP, (read_r16stk(r, false)));
+    PC += 1;
+}
+
+inline void CPU::pop_rr(BYTE r) {
+    cycles = 3;
+    write_r16stk(r, read_mem(SP++), false);
+    write_r16stk(r, read_mem(SP++), true);
+    PC += 1;
+}
+
+inline void CPU::add_r(BYTE carry, BYTE r) {
+    cycles = 1 + (r == 6);
+    BYTE saved_carry = Carry;
+    F &= 0x0F;
+    if(((A&0xF)+(read_r8(r)&0xF)+(carry ? saved_carry : 0))>>4) F |= 0b00100000; // set half carry flag
+    if((A + read_r8(r) + (carry ? saved_carry : 0))>>8) F |= 0b00010000; // set carry flag
+    A += read_r8(r) + (carry ? saved_carry : 0);
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::sub_r(BYTE carry, BYTE r) {
+    cycles = 1 + (r == 6);
+    BYTE saved_carry = Carry;
+    F &= 0x0F;
+    if((A&0xF) < ((read_r8(r)&0xF) + (carry ? saved_carry : 0))) F |= 0b00100000; // set half carry flag
+    if(A < read_r8(r) + (carry ? saved_carry : 0)) F |= 0b00010000; // set carry flag
+    A -= read_r8(r) + (carry ? saved_carry : 0);
+    if(A == 0) F |= 0b10000000; // set zero flag
+    F |= 0b01000000; // set subtract flag
+    PC += 1;
+}
+
+inline void CPU::cp_r(BYTE r) {
+    cycles = 1 + (r == 6);
+    F &= 0x0F;
+    BYTE value = read_r8(r);
+    if(A == value) F |= 0b10000000; // set zero flag
+    if((A&0xF) < (read_r8(r)&0xF)) F |= 0b00100000; // set half carry flag
+    if(A < read_r8(r)) F |= 0b00010000; // set carry flag
+    F |= 0b01000000; // set subtract flag
+    PC += 1;
+}
+
+inline void CPU::inc_r(BYTE r) {
+    cycles = 1 + (r == 6)*2;
+    write_r8(r, read_r8(r)+1);
+    F &= 0x1F;
+    BYTE value = read_r8(r);
+    if(value == 0) F |= 0b10000000; // set zero flag
+    if((value & 0xF) == 0) F |= 0b00100000; // set half carry flag
+    PC += 1;
+}
+
+inline void CPU::dec_r(BYTE r) {
+    cycles = 1 + (r == 6)*2;
+    write_r8(r, read_r8(r)-1);
+    F &= 0x1F;
+    BYTE value = read_r8(r);
+    if(value == 0) F |= 0b10000000; // set zero flag
+    if((value & 0xF) == 0xF) F |= 0b00100000; // set half carry flag
+    F |= 0b01000000; // set subtract flag
+    PC += 1;
+}
+
+inline void CPU::bit_and(BYTE r) {
+    cycles = 1 + (r == 6);
+    A &= read_r8(r);
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    F |= 0b00100000; // set half carry flag
+    PC += 1;
+}
+
+inline void CPU::bit_or(BYTE r) {
+    cycles = 1 + (r == 6);
+    A |= read_r8(r);
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::bit_xor(BYTE r) {
+    cycles = 1 + (r == 6);
+    A ^= read_r8(r);
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::inc_r16(BYTE r) {
+    cycles = 2;
+    write_r16(r, read_r16(r)+1);
+    PC += 1;
+}
+
+inline void CPU::dec_r16(BYTE r) {
+    cycles = 2;
+    write_r16(r, read_r16(r)-1);
+    PC += 1;
+}
+
+inline void CPU::add_r16(BYTE r) {
+    cycles = 2;
+    F &= 0x8F; // clear flags except zero
+    if((HL + read_r16(r))>>16) {
+        F |= 0b00010000; // set carry flag
+    }
+    if(((HL&0xFFF) + (read_r16(r)&0xFFF))>>12){
+        F |= 0b00100000; // set half carry flag
+    }
+    HL += read_r16(r);
+    PC += 1;
+}
+
+inline void CPU::rotate_left_circular(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b10000000) >> 3; // set carry flag
+    value = (value << 1) | (value >> 7);
+    write_r8(r, value);
+    F |= (value == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::rotate_right_circular(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b00000001) << 4; // set carry flag
+    value = (value >> 1) | (value << 7);
+    write_r8(r, value);
+    F |= (value == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::rotate_left(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    BYTE carry = Carry;
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b10000000) >> 3; // set carry flag
+    value = (value << 1) | (carry);
+    write_r8(r, value);
+    F |= (value == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::rotate_right(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    BYTE carry = Carry;
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b00000001) << 4; // set carry flag
+    value = (value >> 1) | (carry << 7);
+    write_r8(r, value);
+    F |= (read_r8(r) == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::sla(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b10000000) >> 3; // set carry flag
+    write_r8(r, value << 1);
+    F |= (read_r8(r) == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::sra(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b00000001) << 4; // set carry flag
+    write_r8(r, (value >> 1) | (value & 0b10000000));
+    F |= (read_r8(r) == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::srl(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    F |= (value & 0b00000001) << 4; // set carry flag
+    write_r8(r, (value >> 1));
+    F |= (read_r8(r) == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::swap(BYTE r) {
+    cycles = 2 + 2*(r==6);
+    F &= 0x0F; // clear flags
+    BYTE value = read_r8(r);
+    write_r8(r, ((value & 0b11110000) >> 4) | ((value & 0b00001111) << 4));
+    F |= (read_r8(r) == 0) << 7; // set zero flag
+    PC += 1;
+}
+
+inline bool CPU::test_flag(int flag) {
+    return ((F & (1 << flag))) ? true : false;
+    // ZNHC0000
+}
+
+inline void CPU::jump(bool is_conditional, int flag, int condition, WORD nn) {
+    if (!is_conditional || flag == condition) {
+        PC = nn;
+        cycles = 4;
+    } else {
+        PC += 3;
+        cycles = 3;     // duration on pg111
+    }
+}
+
+inline void CPU::jump_relative(bool is_conditional, int flag, int condition, SIGNED_BYTE n) {
+    PC += 2;
+    if (!is_conditional || flag == condition) {
+        PC += n;
+        cycles = 3;
+    } else {
+        cycles = 2;    // pg 114
+    }
+}
+
+inline void CPU::call(bool is_conditional, int flag, int condition, WORD nn) {
+    if (!is_conditional || flag == condition) {
+        PC += 3;
+        write_mem(--SP, pchigh);
+        write_mem(--SP, pclow);
+        PC = nn;
+        cycles = 6;
+    } else {
+        PC += 3;
+        cycles = 3;
+    }
+}
+
+inline void CPU::ret(bool is_conditional, int flag, int condition) {
+    if (!is_conditional) {
+        cycles = 4;
+        BYTE low = read_mem(SP++);
+        BYTE high = read_mem(SP++);
+        PC = low + (high << 8);
+    } else if (flag == condition) {
+        cycles = 5;
+        BYTE low = read_mem(SP++);
+        BYTE high = read_mem(SP++);
+        PC = low + (high << 8);
+    } else {
+        cycles = 2;
+        PC += 1;
+    }
+}
+
+inline void CPU::restart(BYTE n) {
+    cycles = 4;
+    PC++;
+    write_mem(--SP, pchigh);
+    write_mem(--SP, pclow);
+    PC = n;
+}
+
+// the two bytes after the opcode
+inline WORD CPU::imm16() {
+    return read_mem(PC + 1) + (read_mem(PC + 2) << 8);
+}
+
+// the low power wait isn't emulated: roms such as cpu_instrs run stop
+// expecting to carry on, as a cgb switching speed does. It steps over its
+// second byte unless an interrupt is pending.
+inline void CPU::stop() {
+    cycles = 1;
+    if(pending) {
+        PC += 1;
+    }else {
+        PC += 2;
+    }
+}
+
+inline void CPU::halt() {
+    if(IME){
+        halted = true;
+    }else{
+        if(!pending){
+            halted = true;
+        }else{
+            halted = false; // do the halt bug
+        }
+    }
+    PC+=1;
+    cycles = 1;
+}
+
+inline void CPU::ld_a_nn(WORD nn) {
+    cycles = 4;
+    A = read_mem(nn);
+    PC += 3;
+}
+
+inline void CPU::ld_nn_a(WORD nn) {
+    cycles = 4;
+    write_mem(nn, A);
+    PC += 3;
+}
+
+inline void CPU::ld_a_c() {
+    cycles = 2;
+    A = read_mem(0xFF00 + C);
+    PC += 1;
+}
+
+inline void CPU::ld_c_a() {
+    cycles = 2;
+    write_mem(0xFF00 + C, A);
+    PC += 1;
+}
+
+inline void CPU::ldh_a_n(BYTE n) {
+    cycles = 3;
+    A = read_mem(0xFF00 + n);
+    PC += 2;
+}
+
+inline void CPU::ldh_n_a(BYTE n) {
+    cycles = 3;
+    write_mem(0xFF00 + n, A);
+    PC += 2;
+}
+
+inline void CPU::ld_nn_sp(WORD nn) {
+    cycles = 5;
+    write_mem(nn, splow);
+    write_mem(nn + 1, sphigh);
+    PC += 3;
+}
+
+inline void CPU::ld_hl_sp(SIGNED_BYTE e) {
+    cycles = 3;
+    HL = SP + e;
+    F &= 0x0F; // clear flags
+    if((((SP&0xFF) + (e&0xFF)))>>8) {
+        F |= 0b00010000; // set carry flag
+    }
+    if(((SP&0xF) + (e&0xF))>>4){
+        F |= 0b00100000; // set half carry flag
+    }
+    PC += 2;
+}
+
+inline void CPU::add_sp(SIGNED_BYTE e) {
+    cycles = 4;
+    F &= 0x0F; // clear flags
+    if(((SP&0xFF) + (e&0xFF)) >> 8) {
+        F |= 0b00010000; // set carry flag
+    }
+    if(((SP&0xF) + (e&0xF)) >> 4) {
+        F |= 0b00100000; // set half carry flag
+    }
+    SP += e;
+    PC += 2;
+}
+
+inline void CPU::add_imm(BYTE carry, BYTE n) {
+    cycles = 2;
+    BYTE saved_carry = carry ? Carry : 0;
+    F &= 0x0F;
+    if(((A&0xF)+(n&0xF)+(saved_carry))>>4) F |= 0b00100000; // set half carry flag
+    if((A+n+(saved_carry))>>8) F |= 0b00010000; // set carry flag
+    A += n + saved_carry;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 2;
+}
+
+inline void CPU::sub_imm(BYTE carry, BYTE n) {
+    cycles = 2;
+    BYTE saved_carry = carry ? Carry : 0;
+    F &= 0x0F;
+    if((A&0xF) < ((n&0xF) + (saved_carry))) F |= 0b00100000; // set half carry flag
+    if(A < n + (saved_carry)) F |= 0b00010000; // set carry flag
+    A -= n + saved_carry;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    F |= 0b01000000; // set subtract flag
+    PC += 2;
+}
+
+inline void CPU::cp_imm(BYTE n) {
+    cycles = 2;
+    F &= 0x0F;
+    if(A == n) F |= 0b10000000; // set zero flag
+    if((A&0xF) < (n&0xF)) F |= 0b00100000; // set half carry flag
+    if(A < n) F |= 0b00010000; // set carry flag
+    F |= 0b01000000; // set subtract flag
+    PC += 2;
+}
+
+inline void CPU::and_imm(BYTE n) {
+    cycles = 2;
+    A &= n;
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    F |= 0b00100000; // set half carry flag
+    PC += 2;
+}
+
+inline void CPU::or_imm(BYTE n) {
+    cycles = 2;
+    A |= n;
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 2;
+}
+
+inline void CPU::xor_imm(BYTE n) {
+    cycles = 2;
+    A ^= n;
+    F &= 0x0F;
+    if(A == 0) F |= 0b10000000; // set zero flag
+    PC += 2;
+}
+
+inline void CPU::ccf() {
+    cycles = 1;
+    F &= 0x9F;
+    F ^= 0b00010000;
+    PC += 1;
+}
+
+inline void CPU::scf() {
+    cycles = 1;
+    F &= 0x9F;
+    F |= 0b00010000;
+    PC += 1;
+}
+
+inline void CPU::daa() {
+    cycles = 1;
+    BYTE correction = 0;
+    if (!(F & 0x40)) {
+        if ((F & 0x20) || (A & 0x0F) > 9) {
+            correction += 0x06;
+        }
+        if ((F & 0x10) || A > 0x99) {
+            correction += 0x60;
+            F |= 0x10; 
+        }
+        A += correction;
+    }
+    else {
+        if (F & 0x20) {
+            correction += 0x06;
+        }
+        if (F & 0x10) {
+            correction += 0x60;
+        }
+        A -= correction;
+    }
+    F &= ~0x20;
+    if (A == 0) {
+        F |= 0x80; 
+    } else {
+        F &= ~0x80; 
+    }
+    PC += 1;
+}
+
+inline void CPU::cpl() {
+    cycles = 1;
+    A = ~A;
+    F &= 0x9F;
+    F |= 0b01100000; // set subtract and half carry flag
+    PC += 1;
+}
+
+inline void CPU::rlca() {
+    cycles = 1;
+    F &= 0x0F; // clear flags
+    F |= (A & 0b10000000) >> 3; // set carry flag
+    A = (A << 1) | (A >> 7);
+    PC += 1;
+}
+
+inline void CPU::rrca() {
+    cycles = 1;
+    F &= 0x0F; // clear flags
+    F |= (A & 0b00000001) << 4; // set carry flag
+    A = (A >> 1) | (A << 7);
+    PC += 1;
+}
+
+inline void CPU::rla() {
+    cycles = 1;
+    BYTE carry = Carry;
+    F &= 0x0F; // clear flags
+    F |= (A & 0b10000000) >> 3; // set carry flag
+    A = (A << 1) | (carry);
+    PC += 1;
+}
+
+inline void CPU::rra() {
+    cycles = 1;
+    BYTE carry = Carry;
+    F &= 0x0F; // clear flags
+    F |= (A & 0b00000001) << 4; // set carry flag
+    A = (A >> 1) | (carry << 7);
+    PC += 1;
+}
+
+inline void CPU::reti() {
+    cycles = 4;  
+    BYTE low = read_mem(SP++);
+    BYTE high = read_mem(SP++);
+    PC = low + (high << 8);
+    IME = 1;
+}
+
+inline void CPU::test_bit(BYTE bit, BYTE r) {
+    cycles = 2 + (r==6);
+    F &= 0x1F;
+    F |= 0b00100000; // set half carry flag
+    if(((read_r8(r)>>bit)&1) == 0) F |= 0b10000000; // set zero flag
+    PC += 1;
+}
+
+inline void CPU::reset_bit(BYTE bit, BYTE r) {
+    cycles = 2 + 2*(r==6); // (hl) is read and written back
+    write_r8(r, read_r8(r) & ~(1 << bit));
+    PC += 1;
+}
+
+inline void CPU::set_bit(BYTE bit, BYTE r) {
+    cycles = 2 + 2*(r==6);
+    write_r8(r, read_r8(r) | (1 << bit));
+    PC += 1;
+}
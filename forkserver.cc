@@ -0,0 +1,136 @@
+#include "forkserver.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define JOB_BACKLOG 64
+
+// keeps whatever the game sends, with nothing on the other end
+class CaptureLink : public SerialLink {
+    public:
+        void start(BYTE out) override { sent.push_back(out); }
+        bool finish(Serial& port, BYTE& in) override { in = 0xFF; return true; }
+        std::vector<BYTE> sent;
+};
+
+static bool read_full(int fd, void* data, size_t size) {
+    BYTE* bytes = (BYTE*) data;
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* data, size_t size) {
+    const BYTE* bytes = (const BYTE*) data;
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+std::unique_ptr<ForkServer> ForkServer::listen(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return nullptr;
+    }
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(fd, JOB_BACKLOG) < 0) {
+        perror("bind");
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<ForkServer>(new ForkServer(fd, path));
+}
+
+ForkServer::~ForkServer() {
+    close(fd);
+    unlink(path.c_str());
+}
+
+void ForkServer::serve(GameBoy& gb) {
+    signal(SIGCHLD, SIG_IGN); // finished jobs are reaped for us
+    printf("Serving jobs on %s\n", path.c_str());
+    fflush(stdout); // or the children print it again
+    while (true) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            return;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            run_job(gb, conn);
+            _exit(0); // no destructors, the parent's threads didn't come along
+        }
+        if (pid < 0) {
+            perror("fork");
+        }
+        close(conn);
+    }
+}
+
+void ForkServer::run_job(GameBoy& gb, int conn) {
+    uint32_t frames;
+    if (!read_full(conn, &frames, sizeof(frames))) {
+        return;
+    }
+    CaptureLink* capture = new CaptureLink();
+    gb.serial.link.reset(capture);
+    gb.apu.output = nullptr;
+    BYTE inputs[4096];
+    for (uint32_t done = 0; done < frames;) {
+        uint32_t count = std::min<uint32_t>(frames - done, sizeof(inputs));
+        if (!read_full(conn, inputs, count)) {
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            gb.cpu.set_joypad(inputs[i]);
+            gb.run_frame();
+        }
+        done += count;
+    }
+
+    uint32_t sent = capture->sent.size();
+    if (!write_full(conn, &sent, sizeof(sent)) || !write_full(conn, capture->sent.data(), sent) ||
+        !write_full(conn, gb.cpu.screen, sizeof(gb.cpu.screen))) {
+        return;
+    }
+    for (int i = 0; i < MEM_PAGES; i++) {
+        if (!write_full(conn, gb.cpu.mem.page(i), MEM_PAGE_SIZE)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "gameboy.h"
+
+// boots a rom once and hands every job a process of its own forked from
+// the warmed up console, so a job starts in microseconds instead of
+// loading and booting the rom again. Jobs come in over a unix domain
+// stream socket, one per connection, and run in parallel.
+//
+// a job is a uint32 frame count and then that many joypad states (as
+// cpu.joypad_state, a 0 bit is held), one per frame. The reply is a uint32
+// length and the bytes the game sent out of the serial port (where test
+// roms print), then the 144x160 picture (a grey level per pixel) and the
+// 64KB address space.
+// Everything is in host byte order.
+class ForkServer {
+    public:
+        static std::unique_ptr<ForkServer> listen(const std::string& path);
+        ~ForkServer();
+        // serve jobs from gb's current state until accepting fails. gb
+        // should have no save file, which jobs could otherwise write to.
+        void serve(GameBoy& gb);
+
+    private:
+        ForkServer(int fd, const std::string& path) : fd(fd), path(path) {}
+        // in the child, which exits afterwards
+        static void run_job(GameBoy& gb, int conn);
+
+        int fd;
+        std::string path;
+};
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cstring>
+#include "fuse.h"
+#include "aot.h"
+
+const char* const fused_names[FUSED_FORMS] = {
+    "dec r; jr nz",
+    "and/or/xor/cp; jr cc",
+    "ldh a,(n); and/or/xor/cp; jr cc",
+    "ld a,(hl+); ld (de),a; inc de",
+    "fill loop",
+    "copy loop",
+};
+
+// the code at pc in the banks mapped when the handler was picked
+static inline const BYTE* code_at(const AotRun& run, WORD pc) {
+    return pc < 0x4000 ? run.rom0 + pc : run.romx + (pc - 0x4000);
+}
+
+static inline bool is_jr_cc(BYTE op) {
+    return op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38;
+}
+
+static inline void jr_cc(CPU& cpu, const BYTE* code) {
+    int flag = code[0] & 0x10 ? (cpu.F >> 4) & 1 : (cpu.F >> 7) & 1;
+    cpu.jump_relative(true, flag, (code[0] >> 3) & 1, code[1]);
+}
+
+// bytes in an and, or, xor or cp with A, 0 for anything else
+static inline int test_length(BYTE op) {
+    if (op >= 0xA0 && op < 0xC0) {
+        return 1;
+    }
+    return op == 0xE6 || op == 0xFE ? 2 : 0;
+}
+
+static inline void test(CPU& cpu, const BYTE* code) {
+    BYTE op = code[0];
+    if (op == 0xE6) {
+        cpu.and_imm(code[1]);
+        return;
+    } else if (op == 0xFE) {
+        cpu.cp_imm(code[1]);
+        return;
+    }
+    switch ((op >> 3) & 3) {
+        case 0: cpu.bit_and(op & 7); break;
+        case 1: cpu.bit_xor(op & 7); break;
+        case 2: cpu.bit_or(op & 7); break;
+        case 3: cpu.cp_r(op & 7); break;
+    }
+}
+
+static int dec_jr(GameBoy& gb, AotRun& run) {
+    CPU& cpu = gb.cpu;
+    WORD pc = run.pc;
+    const BYTE* code = code_at(run, pc);
+    cpu.dec_r((code[0] >> 3) & 7);
+    if (!aot_next<false>(gb, run, pc + 1)) return -1;
+    jr_cc(cpu, code + 1);
+    gb.fused[FUSED_DEC_JR]++;
+    return aot_last(cpu, run);
+}
+
+static int test_jr(GameBoy& gb, AotRun& run) {
+    CPU& cpu = gb.cpu;
+    WORD pc = run.pc;
+    const BYTE* code = code_at(run, pc);
+    int length = test_length(code[0]);
+    test(cpu, code);
+    if (!aot_next<false>(gb, run, pc + length)) return -1;
+    jr_cc(cpu, code + length);
+    gb.fused[FUSED_TEST_JR]++;
+    return aot_last(cpu, run);
+}
+
+static int poll(GameBoy& gb, AotRun& run) {
+    CPU& cpu = gb.cpu;
+    WORD pc = run.pc;
+    const BYTE* code = code_at(run, pc);
+    int length = test_length(code[2]);
+    cpu.ldh_a_n(code[1]);
+    if (!aot_next<false>(gb, run, pc + 2)) return -1;
+    test(cpu, code + 2);
+    if (!aot_next<false>(gb, run, pc + 2 + length)) return -1;
+    jr_cc(cpu, code + 2 + length);
+    gb.fused[FUSED_POLL]++;
+    return aot_last(cpu, run);
+}
+
+static int copy(GameBoy& gb, AotRun& run) {
+    CPU& cpu = gb.cpu;
+    WORD pc = run.pc;
+    cpu.ld_a_r16mem(2);
+    if (!aot_next<false>(gb, run, pc + 1)) return -1;
+    cpu.ld_r16mem_a(1);
+    if (!aot_next<true>(gb, run, pc + 2)) return -1;
+    cpu.inc_r16(1);
+    gb.fused[FUSED_COPY]++;
+    return aot_last(cpu, run);
+}
+
+// a loop storing or copying one byte per trip round, counted down in a
+// register or in BC, like the ones games clear and fill vram with
+struct BulkLoop {
+    bool copy;
+    int value;   // fills: the register stored (as numbered in opcodes), or -1
+    BYTE fill;   // the byte stored when value is -1
+    bool load;   // the value is loaded into A each trip
+    int to;      // the pair written through, 1 (DE) or 2 (HL)
+    int step;    // which way it goes, 1 or -1
+    int counter; // the register counted down, or -1 for BC
+    int trip;    // machine cycles once round, jumping back
+    int instructions;
+};
+
+// the loop starting at code, if it is one
+static bool bulk_loop(const BYTE* code, BulkLoop& loop) {
+    int i = 0;
+    loop = BulkLoop();
+    loop.value = 7;
+    loop.step = 1;
+    if (code[0] >= 0x78 && code[0] < 0x7E) { // ld a,r
+        loop.value = code[0] & 7;
+        loop.load = true;
+        loop.trip = 1;
+        i = 1;
+    } else if (code[0] == 0x3E) { // ld a,n
+        loop.value = -1;
+        loop.fill = code[1];
+        loop.load = true;
+        loop.trip = 2;
+        i = 2;
+    }
+    BYTE op = code[i];
+    if (op == 0x22 || op == 0x32) { // ld (hl+),a, ld (hl-),a
+        loop.to = 2;
+        loop.step = op == 0x22 ? 1 : -1;
+        loop.trip += 2;
+        loop.instructions = 1;
+        i += 1;
+    } else if (op == 0x36 && !loop.load && (code[i + 2] == 0x23 || code[i + 2] == 0x2B)) { // ld (hl),n; inc/dec hl
+        loop.value = -1;
+        loop.fill = code[i + 1];
+        loop.to = 2;
+        loop.step = code[i + 2] == 0x23 ? 1 : -1;
+        loop.trip += 5;
+        loop.instructions = 2;
+        i += 3;
+    } else if (!loop.load && ((op == 0x2A && code[i + 1] == 0x12) || (op == 0x1A && code[i + 1] == 0x22)) &&
+               code[i + 2] == 0x13) { // ld a,(hl+); ld (de),a or ld a,(de); ld (hl+),a; inc de
+        loop.copy = true;
+        loop.to = op == 0x2A ? 1 : 2;
+        loop.trip += 6;
+        loop.instructions = 3;
+        i += 3;
+    } else {
+        return false;
+    }
+    loop.instructions += loop.load;
+    op = code[i];
+    if (op == 0x05 || op == 0x0D || op == 0x15 || op == 0x1D) { // dec r
+        loop.counter = op >> 3;
+        if (loop.counter == loop.value || (loop.counter >= 2 && (loop.copy || loop.to == 1))) {
+            return false;
+        }
+        loop.trip += 1;
+        loop.instructions += 1;
+        i += 1;
+    } else if (op == 0x0B && ((code[i + 1] == 0x78 && code[i + 2] == 0xB1) ||
+                              (code[i + 1] == 0x79 && code[i + 2] == 0xB0))) { // dec bc; ld a,b; or c
+        // A is taken over, so a fill has to load its value again each trip
+        if ((!loop.copy && !loop.load && loop.value == 7) || loop.value == 0 || loop.value == 1) {
+            return false;
+        }
+        loop.counter = -1;
+        loop.trip += 4;
+        loop.instructions += 3;
+        i += 3;
+    } else {
+        return false;
+    }
+    if (loop.value == 4 || loop.value == 5 || code[i] != 0x20 || (SIGNED_BYTE) code[i + 1] != -(i + 2)) {
+        return false;
+    }
+    loop.trip += 3;
+    loop.instructions += 1;
+    return true;
+}
+
+// bytes from addr on in the direction of step without leaving plain memory:
+// vram, work ram and, to read from, the rom banks
+static int span(WORD addr, int step, bool read) {
+    int low, high;
+    if (addr >= 0x8000 && addr < 0xA000) {
+        low = 0x8000, high = 0xA000;
+    } else if (addr >= 0xC000 && addr < 0xE000) {
+        low = 0xC000, high = 0xE000;
+    } else if (read && addr < 0x8000) {
+        low = addr & 0x4000, high = low + 0x4000;
+    } else {
+        return 0;
+    }
+    return step > 0 ? high - addr : addr - low + 1;
+}
+
+// all but the last of the trips left, as many as end before anything
+// besides the loop can happen (an event, the frame ending, a new line
+// drawn while writing to vram), at once. The registers and flags are left
+// as those trips leave them. The last trip, or a loop with no time to
+// spare, goes through the interpreter.
+static int bulk(GameBoy& gb, AotRun& run) {
+    CPU& cpu = gb.cpu;
+    BulkLoop loop;
+    bulk_loop(code_at(run, run.pc), loop);
+    int left = loop.counter < 0 ? cpu.BC : cpu.read_r8(loop.counter);
+    if (!left) {
+        left = loop.counter < 0 ? 0x10000 : 0x100; // counting down from 0
+    }
+    WORD to = cpu.read_r16(loop.to);
+    WORD from = cpu.read_r16(3 - loop.to);
+    int trips = std::min(left - 1, span(to, loop.step, false));
+    if (loop.copy) {
+        trips = std::min(trips, span(from, 1, true));
+        if (to > from) {
+            trips = std::min(trips, to - from); // copying forward over what is still to be read
+        }
+    }
+    uint64_t now = cpu.clock + run.interrupt_cycles * 4;
+    uint64_t until = std::min(run.end, std::min(gb.lcd.next_event, gb.timer.next_event));
+    until = std::min(until, now + gb.serial.idle_cycles());
+    if (to < 0xA000) {
+        until = std::min(until, gb.lcd.nextChange(now));
+    }
+    if (until > now) {
+        trips = std::min<uint64_t>(trips, (until - now - 1) / (loop.trip * 4));
+    } else {
+        trips = 0;
+    }
+    if (trips <= 0) {
+        run.executed = 1;
+        return cpu.exec();
+    }
+
+    WORD first = loop.step > 0 ? to : to - trips + 1;
+    if (to < 0xA000) {
+        gb.ppu.catchUp(cpu, gb.lcd.visibleLines(now));
+    }
+    BYTE last = cpu.A;
+    if (loop.copy) {
+        for (int done = 0; done < trips;) {
+            // host_pointer() holds to the end of the 256 byte block. The
+            // bytes go through a copy: writing may move the page they are
+            // on (see Memory::own), and the old one then lives only as long
+            // as a render job holds it.
+            int count = std::min(trips - done, 0x100 - ((from + done) & 0xFF));
+            BYTE bytes[0x100];
+            memcpy(bytes, cpu.host_pointer(from + done), count);
+            cpu.mem.write(first + done, bytes, count);
+            last = bytes[count - 1];
+            done += count;
+        }
+        cpu.write_r16(3 - loop.to, from + trips);
+    } else {
+        last = loop.value < 0 ? loop.fill : cpu.read_r8(loop.value);
+        cpu.mem.fill(first, last, trips);
+    }
+    cpu.write_r16(loop.to, to + loop.step * trips);
+    if (loop.counter < 0) {
+        cpu.BC -= trips;
+        cpu.A = cpu.B | cpu.C;
+        cpu.F = 0; // never zero here
+    } else {
+        BYTE count = cpu.read_r8(loop.counter) - trips;
+        cpu.write_r8(loop.counter, count);
+        cpu.F = (cpu.F & 0x10) | 0x40 | ((count & 0xF) == 0xF ? 0x20 : 0);
+        if (loop.copy || loop.load) {
+            cpu.A = last;
+        }
+    }
+    gb.advance((run.interrupt_cycles + trips * loop.trip) * 4);
+    run.interrupt_cycles = 0;
+    run.executed = trips * loop.instructions;
+    gb.fused[loop.copy ? FUSED_MEMCPY : FUSED_FILL]++;
+    return -1;
+}
+
+AotBlock fused_handler(const BYTE* code) {
+    BulkLoop loop;
+    if (bulk_loop(code, loop)) {
+        return bulk;
+    }
+    BYTE op = code[0];
+    if ((op & 0xC7) == 0x05 && op != 0x35) { // dec r, not (hl)
+        return code[1] == 0x20 ? dec_jr : nullptr;
+    } else if (op == 0xF0) {
+        int length = test_length(code[2]);
+        return length && is_jr_cc(code[2 + length]) ? poll : nullptr;
+    } else if (op == 0x2A) {
+        return code[1] == 0x12 && code[2] == 0x13 ? copy : nullptr;
+    }
+    int length = test_length(op);
+    return length && is_jr_cc(code[length]) ? test_jr : nullptr;
+}
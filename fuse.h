@@ -0,0 +1,29 @@
+#pragma once
+#include "gameboy.h"
+
+// the instruction sequences games spend most of their time in, found by
+// counting pairs in tetris and pokemon red: countdown loops, flag tests
+// before a branch, polling a register and byte copies. Each runs through
+// one handler, like a recompiled block (aot.h): the instructions are
+// decoded once, and between two of them only what can have changed is
+// checked (the units move on, interrupts, the frame ending), so the results
+// and cycles are exactly those of running them one by one.
+// Only code in rom is fused, where nothing can write over it.
+// Loops clearing or copying memory a byte per trip (to vram and work ram)
+// go further: as many trips as fit before anything else can happen are
+// done at once with host memory operations, and charged in one go.
+
+#define MAX_FUSED_BYTES 9 // the longest, ld (hl),n; inc hl; dec bc; ld a,b; or c; jr nz
+
+extern const char* const fused_names[FUSED_FORMS];
+
+// whether a sequence can start with op, to pass over the rest quickly
+inline bool fused_head(BYTE op) {
+    return (op >= 0xA0 && op < 0xC0) || ((op & 0xC7) == 0x05 && op != 0x35) || op == 0xF0 ||
+           op == 0xFE || op == 0xE6 || op == 0x2A || (op >= 0x78 && op < 0x7E) || op == 0x3E ||
+           op == 0x22 || op == 0x32 || op == 0x36 || op == 0x1A;
+}
+
+// the handler for the sequence starting at code, or null. There must be
+// MAX_FUSED_BYTES to read.
+AotBlock fused_handler(const BYTE* code);
@@ -0,0 +1,524 @@
+#include "gameboy.h"
+#include "mapper.h"
+#include "idle.h"
+#include "aot.h"
+#include "fuse.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <sys/stat.h>
+
+// roms already in memory, shared read only by every console running them.
+// Keyed on the file's identity and modification time, so an edited rom is
+// read again.
+static std::mutex rom_cache_lock;
+static std::map<std::tuple<dev_t, ino_t, off_t, time_t>, std::weak_ptr<std::vector<BYTE>>> rom_cache;
+
+std::shared_ptr<std::vector<BYTE>> GameBoy::read_rom(const std::string& rom_name) {
+    FILE* fin;
+    fin = fopen(rom_name.c_str(), "rb");
+    if (!fin) {
+        printf("Error opening %s\n", rom_name.c_str());
+        return nullptr;
+    }
+    struct stat info;
+    fstat(fileno(fin), &info);
+    auto key = std::make_tuple(info.st_dev, info.st_ino, info.st_size, info.st_mtime);
+    std::lock_guard<std::mutex> guard(rom_cache_lock);
+    std::shared_ptr<std::vector<BYTE>> rom = rom_cache[key].lock();
+    if (rom) {
+        fclose(fin);
+        return rom;
+    }
+
+    fseek(fin, 0, SEEK_END);
+    long file_size = ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+    if (file_size < 0 || file_size > MAX_ROM_SIZE) {
+        printf("Unsupported ROM size\n");
+        fclose(fin);
+        return nullptr;
+    }
+    // pad to a whole power of two banks so the mappers can mask bank numbers
+    size_t rom_size = MIN_ROM_SIZE;
+    while (rom_size < (size_t) file_size) {
+        rom_size *= 2;
+    }
+    rom = std::make_shared<std::vector<BYTE>>(rom_size, 0xFF);
+    size_t read_count = fread(rom->data(), 1, file_size, fin);
+    if (read_count != (size_t) file_size) {
+        printf("Error reading file\n");
+        fclose(fin);
+        return nullptr;
+    }
+    fclose(fin);
+    // drop entries whose consoles are all gone while here
+    for (auto it = rom_cache.begin(); it != rom_cache.end();) {
+        it = it->second.expired() ? rom_cache.erase(it) : std::next(it);
+    }
+    rom_cache[key] = rom;
+    return rom;
+}
+
+bool GameBoy::load_rom(const std::string& rom_name) {
+    std::shared_ptr<std::vector<BYTE>> image = read_rom(rom_name);
+    if (!image) {
+        return false;
+    }
+    rom = image;
+    translation = aot_translation(rom->data(), rom->size());
+    aot = translation;
+    cpu = CPU(rom->data(), rom->size());
+    save.reset();
+    if (Mapper::has_battery(rom->data()) && cpu.mapper->ram_size) {
+        // game.gb saves to game.sav next to it
+        std::string path = rom_name.substr(0, rom_name.find_last_of('.')) + ".sav";
+        save = SaveFile::open(path, cpu.mapper->ram_size, cpu.mapper->ram);
+        cpu.save = save.get();
+    }
+    ppu = PPU();
+    lcd = LCD();
+    lcd.reset(cpu);
+    apu.reset();
+    serial.reset();
+    timer.reset(cpu);
+    wire();
+
+    return true;
+}
+
+void GameBoy::wire() {
+    lcd.ppu = &ppu;
+    ppu.worker = renderer.get();
+    apu.output = &audio;
+    cpu.apu = &apu;
+    cpu.serial = &serial;
+    cpu.ppu = &ppu;
+    cpu.lcd = &lcd;
+    cpu.timer = &timer;
+}
+
+void GameBoy::set_render_thread(bool on) {
+    if (on && !renderer) {
+        renderer.reset(new RenderThread());
+    } else if (!on) {
+        renderer.reset();
+    }
+    ppu.worker = renderer.get();
+}
+
+void GameBoy::save_ram() {
+    if (save) {
+        if (!speculative) {
+            commit_save();
+        }
+        save->flush();
+    }
+}
+
+void GameBoy::commit_save() {
+    if (save && save->changed()) {
+        save->commit(cpu.mapper->ram);
+    }
+}
+
+void GameBoy::commit_save(const State& state) {
+    if (save) {
+        save->commit(state.mapper->ram);
+    }
+}
+
+// what each run loop does, worked out at compile time: blocks runs
+// recompiled code and fused sequences, skips jumps over idle and polling
+// loops (to the cycle they'd have left by), and hooks checks in lockstep
+// and traces after every step
+struct Fast {
+    static constexpr bool blocks = true, skips = true, hooks = false;
+};
+struct Balanced {
+    static constexpr bool blocks = false, skips = true, hooks = false;
+};
+struct Plain {
+    static constexpr bool blocks = false, skips = false, hooks = false;
+};
+// any of them, for when something is being debugged
+template <class P> struct Hooked : P {
+    static constexpr bool hooks = true;
+};
+
+void GameBoy::run_frame() {
+    uint64_t start = cpu.clock;
+    uint64_t end = start + CYCLES_PER_FRAME;
+    // keep the render thread busy rather than handing it a whole frame at vblank
+    render_flush = renderer ? start + RENDER_BATCH_LINES * DOTS_PER_LINE : UINT64_MAX;
+    if (lockstep) {
+        lockstep->cpu.set_joypad(cpu.joypad_state);
+    }
+    bool hooks = lockstep || trace;
+    switch (policy) {
+        case POLICY_FAST: hooks ? run<Hooked<Fast>>(end) : run<Fast>(end); break;
+        case POLICY_BALANCED: hooks ? run<Hooked<Balanced>>(end) : run<Balanced>(end); break;
+        case POLICY_PLAIN: hooks ? run<Hooked<Plain>>(end) : run<Plain>(end); break;
+    }
+    end_frame(start);
+    if (!speculative) {
+        commit_save();
+    }
+    if (lockstep) {
+        lockstep->end_frame(start);
+        check_lockstep(0, end);
+    }
+}
+
+template <class P>
+void GameBoy::run(uint64_t end) {
+    while (cpu.clock < end) {
+        int executed = step<P>(end);
+        if constexpr (P::hooks) {
+            if (lockstep) {
+                check_lockstep(executed, end);
+            }
+        }
+    }
+}
+
+template <class P>
+inline int GameBoy::step(uint64_t end) {
+    if constexpr (P::hooks) {
+        if (trace) {
+            trace_step();
+        }
+    }
+    int interrupt_cycles = cpu.check_interrupts();
+    WORD pc = cpu.PC;
+    int executed = 1;
+    int exec_cycles;
+    AotBlock block = nullptr;
+    if constexpr (P::blocks) {
+        block = aot ? aot_block() : nullptr;
+        if (!block && fusion) {
+            block = fused_block();
+        }
+    }
+    if (block) {
+        AotRun run = {end, interrupt_cycles, pc, 0, cpu.rom0, cpu.romx, 0};
+        exec_cycles = block(*this, run);
+        executed = run.executed;
+        if (exec_cycles < 0) {
+            return executed; // stopped between two instructions, both accounted for
+        }
+        pc = run.pc;
+        interrupt_cycles = run.interrupt_cycles;
+    } else {
+        exec_cycles = cpu.exec();
+    }
+    // exec counts machine cycles, everything else runs on the 4.19MHz clock
+    int curr_cycles = (exec_cycles + interrupt_cycles) * 4;
+    if constexpr (P::skips) {
+        if (cpu.halted) {
+            curr_cycles += idle_cycles(cpu.clock + curr_cycles, end);
+        } else if (cpu.PC < pc && pc - cpu.PC <= MAX_POLL_LOOP && !interrupt_cycles) {
+            curr_cycles += poll_loop_cycles(pc, cpu.clock + curr_cycles, end);
+        }
+    }
+    advance(curr_cycles);
+    return executed;
+}
+
+// the registers and the bytes at pc, as gameboy-doctor logs them
+void GameBoy::trace_step() {
+    if (cpu.halted) {
+        return;
+    }
+    WORD pc = cpu.PC;
+    fprintf(trace, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+            cpu.A, cpu.F, cpu.B, cpu.C, cpu.D, cpu.E, cpu.H, cpu.L, cpu.SP, pc, cpu.peek(pc), cpu.peek(pc + 1),
+            cpu.peek(pc + 2), cpu.peek(pc + 3));
+}
+
+void GameBoy::end_frame(uint64_t start) {
+    cpu.mapper->tick(cpu.clock - start);
+    ppu.catchUp(cpu, lcd.visibleLines(cpu.clock)); // partly scanned frames are shown too
+    if (renderer) {
+        renderer->wait();
+    }
+    if (!ppu.skip) {
+        ppu.drawHeld(cpu);
+    }
+    apu.end_frame();
+    serial.poll();
+}
+
+// the block for the code at pc in the banks mapped now
+inline AotBlock GameBoy::aot_block() {
+    WORD pc = cpu.PC;
+    if (pc >= 0x8000 || cpu.halted || cpu.dma) {
+        return nullptr;
+    }
+    if (pc < 0x4000) {
+        // mbc1 can map another bank here
+        return cpu.rom0 == cpu.rom ? aot->find(0, pc) : nullptr;
+    }
+    return aot->find((cpu.romx - cpu.rom) / 0x4000, pc);
+}
+
+// the fused handler for the code at pc, if it is in rom
+inline AotBlock GameBoy::fused_block() {
+    WORD pc = cpu.PC;
+    if (pc >= 0x8000 || (pc & 0x3FFF) > 0x4000 - MAX_FUSED_BYTES || cpu.halted || cpu.dma) {
+        return nullptr;
+    }
+    const BYTE* code = pc < 0x4000 ? cpu.rom0 + pc : cpu.romx + (pc - 0x4000);
+    return fused_head(code[0]) ? fused_handler(code) : nullptr;
+}
+
+void GameBoy::set_aot(bool on) {
+    aot = on ? translation : nullptr;
+}
+
+void GameBoy::set_lockstep(bool on) {
+    if (on) {
+        if (!lockstep) {
+            lockstep.reset(new GameBoy());
+        }
+        sync_lockstep();
+    } else {
+        lockstep.reset();
+    }
+}
+
+void GameBoy::sync_lockstep() {
+    fork_to(*lockstep);
+    // nothing skipped there that isn't here, so both step alike
+    lockstep->policy = policy == POLICY_PLAIN ? policy : POLICY_BALANCED;
+    lockstep->apu.output = nullptr;
+}
+
+static void print_registers(const char* name, const CPU& cpu) {
+    printf("%-12s AF:%04X BC:%04X DE:%04X HL:%04X SP:%04X PC:%04X IME:%d%d halted:%d clock:%llu\n", name,
+           cpu.af.word, cpu.bc.word, cpu.de.word, cpu.hl.word, cpu.sp.word, cpu.pc.word, cpu.IME, cpu.IME_next,
+           cpu.halted, (unsigned long long) cpu.clock);
+}
+
+// bring the interpreter's copy up to here and compare: registers after every
+// step, memory and the picture at the end of the frame (executed 0)
+void GameBoy::check_lockstep(int executed, uint64_t end) {
+    WORD from = lockstep->cpu.PC;
+    for (int i = 0; i < executed; i++) {
+        if (lockstep->policy == POLICY_PLAIN) {
+            lockstep->step<Plain>(end);
+        } else {
+            lockstep->step<Balanced>(end);
+        }
+    }
+    const CPU& a = cpu;
+    const CPU& b = lockstep->cpu;
+    bool same = a.af.word == b.af.word && a.bc.word == b.bc.word && a.de.word == b.de.word &&
+                a.hl.word == b.hl.word && a.sp.word == b.sp.word && a.pc.word == b.pc.word && a.IME == b.IME &&
+                a.IME_next == b.IME_next && a.halted == b.halted && a.clock == b.clock && a.romx == b.romx;
+    const char* what = "registers";
+    if (same && !executed) {
+        for (int page = 0; page < MEM_PAGES && same; page++) {
+            same = !memcmp(a.mem.page(page), b.mem.page(page), MEM_PAGE_SIZE);
+        }
+        what = "memory";
+        if (same) {
+            same = !memcmp(a.screen, b.screen, sizeof(a.screen));
+            what = "the picture";
+        }
+    }
+    if (!same) {
+        printf("lockstep: %s differ after %d instructions from %04X (bank %ld)\n", what, executed, from,
+               (long) ((b.romx - b.rom) / 0x4000));
+        print_registers("recompiled", a);
+        print_registers("interpreted", b);
+        exit(1);
+    }
+}
+
+// nothing changes by itself before the next event, so a halted cpu can
+// jump straight there (rounded up to a whole machine cycle)
+int GameBoy::idle_cycles(uint64_t now, uint64_t until) {
+    until = std::min(until, std::min(lcd.next_event, timer.next_event));
+    until = std::min(until, now + serial.idle_cycles());
+    return until > now ? (until - now + 3) & ~3 : 0;
+}
+
+// pc jumped back to the top of a short loop. Arriving there twice with the
+// same registers, with a loop that only reads, means every trip round is
+// the same until something it reads changes: skip whole trips up to that.
+int GameBoy::poll_loop_cycles(WORD jump, uint64_t now, uint64_t until) {
+    Register regs[5] = {cpu.af, cpu.bc, cpu.de, cpu.hl, cpu.sp};
+    bool same = cpu.PC == loop_head;
+    for (int i = 0; i < 5 && same; i++) {
+        same = regs[i].word == loop_regs[i].word;
+    }
+    uint64_t period = now - loop_time;
+    loop_head = cpu.PC;
+    std::copy(regs, regs + 5, loop_regs);
+    loop_time = now;
+    if (!same || period > MAX_POLL_PERIOD) { // left the loop (or took an interrupt) in between
+        return 0;
+    }
+    int sources = poll_loop_sources(cpu, cpu.PC, jump);
+    if (sources < 0) {
+        return 0;
+    }
+    until = std::min(until, std::min(lcd.next_event, timer.next_event));
+    until = std::min(until, now + serial.idle_cycles());
+    if (sources & POLL_LCD) {
+        until = std::min(until, lcd.nextChange(now));
+    }
+    if (sources & POLL_DIV) {
+        until = std::min(until, timer.next_change(now, false));
+    }
+    if (sources & POLL_TIMA) {
+        until = std::min(until, timer.next_change(now, true));
+    }
+    if (cpu.dma && cpu.dma_end > now) {
+        until = std::min(until, cpu.dma_end); // reads below 0xFF00 see 0xFF until then
+    }
+    if (until <= now) {
+        return 0;
+    }
+    int skipped = (until - now) / period * period;
+    loop_time += skipped;
+    return skipped;
+}
+
+void GameBoy::run_ahead(int frames) {
+    if (frames <= 0) {
+        run_frame();
+        return;
+    }
+    // the real frame is heard but not seen
+    ppu.skip = true;
+    run_frame();
+    if (!ahead) {
+        ahead.reset(new State());
+    }
+    save_state(*ahead);
+    SampleRing* output = apu.output;
+    bool was_speculative = speculative;
+    apu.output = nullptr;
+    speculative = true;
+    for (int i = 0; i < frames; i++) {
+        ppu.skip = i < frames - 1; // only the last one is drawn
+        run_frame();
+    }
+    apu.output = output;
+    speculative = was_speculative;
+    ppu.skip = false;
+    load_state(*ahead);
+}
+
+void GameBoy::save_state(State& state) {
+    if (!state.mapper) {
+        state.mapper = Mapper::create(rom->data(), rom->size());
+    }
+    state.mapper->copy_state(*cpu.mapper);
+    state.cpu.copy_state(cpu);
+    state.lcd = lcd;
+    state.ppu.copy_state(ppu);
+    state.apu = apu;
+    state.timer = timer;
+    state.serial.copy_state(serial);
+    state.loop_head = loop_head;
+    std::copy(loop_regs, loop_regs + 5, state.loop_regs);
+    state.loop_time = loop_time;
+}
+
+void GameBoy::load_state(const State& state) {
+    cpu.mapper->copy_state(*state.mapper);
+    cpu.copy_state(state.cpu);
+    cpu.map_banks();
+    lcd = state.lcd;
+    lcd.ppu = &ppu;
+    ppu.copy_state(state.ppu);
+    SampleRing* output = apu.output;
+    apu = state.apu;
+    apu.output = output;
+    timer = state.timer;
+    serial.copy_state(state.serial);
+    loop_head = state.loop_head;
+    std::copy(state.loop_regs, state.loop_regs + 5, loop_regs);
+    loop_time = state.loop_time;
+    if (lockstep) {
+        sync_lockstep();
+    }
+}
+
+std::unique_ptr<GameBoy> GameBoy::fork() {
+    std::unique_ptr<GameBoy> child(new GameBoy());
+    fork_to(*child);
+    return child;
+}
+
+void GameBoy::fork_to(GameBoy& child) {
+    child.save.reset();
+    child.cpu.save = nullptr;
+    child.serial.link.reset();
+    child.ahead.reset();
+    child.rom = rom;
+    child.cpu.rom = cpu.rom;
+    child.cpu.rom_size = cpu.rom_size;
+    child.cpu.mapper = Mapper::create(rom->data(), rom->size());
+    child.cpu.mapper->copy_state(*cpu.mapper);
+    child.cpu.copy_state(cpu);
+    child.cpu.map_banks();
+    ppu.drawHeld(cpu); // drawn by now or covered later, either way the same
+    memcpy(child.cpu.screen, cpu.screen, sizeof(cpu.screen));
+    child.lcd = lcd;
+    child.ppu.copy_state(ppu);
+    child.apu = apu;
+    child.serial.copy_state(serial);
+    child.timer = timer;
+    child.loop_head = loop_head;
+    std::copy(loop_regs, loop_regs + 5, child.loop_regs);
+    child.loop_time = loop_time;
+    child.translation = translation;
+    child.aot = aot;
+    child.fusion = fusion;
+    child.policy = policy;
+    child.wire();
+}
+
+GameBoy::Footprint GameBoy::footprint() const {
+    Footprint bytes;
+    bytes.console = sizeof(GameBoy);
+    bytes.memory = cpu.mem.footprint();
+    bytes.sound = apu.footprint();
+    if (cpu.mapper) {
+        bytes.console += sizeof(*cpu.mapper);
+        bytes.cart_ram = cpu.mapper->ram_size;
+    }
+    if (rom) {
+        bytes.rom = rom->size() / rom.use_count();
+    }
+    if (ahead) {
+        bytes.extras += sizeof(State) + ahead->cpu.mem.footprint() + ahead->mapper->ram_size;
+    }
+    if (renderer) {
+        bytes.extras += sizeof(RenderThread);
+    }
+    return bytes;
+}
+
+void GameBoy::print_footprint() const {
+    Footprint bytes = footprint();
+    printf("footprint: %zu KB (console %zu, memory %zu, cart ram %zu, sound %zu, rom %zu, extras %zu)\n",
+           bytes.total() / 1024, bytes.console, bytes.memory, bytes.cart_ram, bytes.sound, bytes.rom, bytes.extras);
+}
+
+void GameBoy::print_fusion() const {
+    for (int i = 0; i < FUSED_FORMS; i++) {
+        printf("fused %-32s %12llu\n", fused_names[i], (unsigned long long) fused[i]);
+    }
+}
+
+void GameBoy::connect(GameBoy& other) {
+    connect_local(serial, other.serial);
+}
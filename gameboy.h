@@ -0,0 +1,210 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "lcd.h"
+#include "ppu.h"
+#include "apu.h"
+#include "serial.h"
+#include "timer.h"
+#include "audio.h"
+#include "save.h"
+#include "mapper.h"
+
+#define CYCLES_PER_FRAME DOTS_PER_FRAME
+#define FPS 59.73
+#define MAX_ROM_SIZE 0x800000 // 8MB, the largest mbc5 carts
+#define MIN_ROM_SIZE 0x8000
+#define RENDER_BATCH_LINES 8 // how often the render thread is handed lines
+
+class GameBoy;
+struct AotRun;
+struct AotTranslation;
+// a basic block recompiled ahead of time (aot.h)
+typedef int (*AotBlock)(GameBoy& gb, AotRun& run);
+
+// instruction sequences the interpreter runs in one go (fuse.h)
+enum FusedForm {
+    FUSED_DEC_JR,  // dec r; jr nz
+    FUSED_TEST_JR, // and, or, xor or cp; jr cc
+    FUSED_POLL,    // ldh a,(n); and, or, xor or cp; jr cc
+    FUSED_COPY,    // ld a,(hl+); ld (de),a; inc de
+    FUSED_FILL,    // a loop storing a byte over a run of memory, trips run at once
+    FUSED_MEMCPY,  // a loop copying a run of memory, the same
+    FUSED_FORMS,
+};
+
+// how the run loop gets through the code. Each policy has a run loop of its
+// own, compiled with only what it uses, and they differ only in which
+// shortcuts the loop takes. These are not accuracy levels: the cpu, lcd and
+// ppu are the same code under all of them, with memory timed per
+// instruction and the picture drawn a line at a time (no per machine cycle
+// accesses, no pixel fifo). So the results are the same cycle for cycle,
+// and the slower ones are references to check against.
+enum Policy {
+    POLICY_FAST,     // recompiled blocks and fused sequences, idle and polling loops skipped
+    POLICY_BALANCED, // one instruction at a time, idle and polling loops skipped
+    POLICY_PLAIN,    // one instruction (a machine cycle when halted) at a time, no shortcuts
+};
+
+// one emulated console, the cpu plus the units it drives; frontends own
+// presentation (video, input, audio device) and call run_frame()
+class GameBoy {
+    public:
+        GameBoy() {};
+        // the cpu keeps pointers into this object
+        GameBoy(const GameBoy&) = delete;
+        GameBoy& operator=(const GameBoy&) = delete;
+
+        bool load_rom(const std::string& rom_name);
+        // nothing runs until a rom is loaded
+        bool loaded() const { return rom != nullptr; }
+        // the rom padded to a power of two banks, shared with every console
+        // that has it loaded; null after printing why not
+        static std::shared_ptr<std::vector<BYTE>> read_rom(const std::string& rom_name);
+        // battery ram is saved in the background, this forces it out now
+        void save_ram();
+        // emulate CYCLES_PER_FRAME cycles, leaving the picture in cpu.screen
+        // and the sound in audio
+        void run_frame();
+        // run_frame(), then show what the picture will be frames further on
+        // with the same input, hiding that many frames of the game's own lag.
+        // The frames ahead are thrown away again, their sound too.
+        void run_ahead(int frames);
+        // draw the picture on a second thread while the cpu carries on. The
+        // picture is the same either way and complete when run_frame() returns.
+        void set_render_thread(bool on);
+        // run code recompiled from the rom (aot.h) where there is some, when
+        // it was linked in. On by default; the results are the same.
+        void set_aot(bool on);
+        bool has_aot() const { return translation != nullptr; }
+        // the run loop from the next frame on, fast by default
+        void set_policy(Policy to) { policy = to; }
+        // check recompiled code against the interpreter, running both in
+        // step on a copy of this console, and stop the program at the
+        // first difference. Not with a link cable plugged in.
+        void set_lockstep(bool on);
+        // write the registers and the bytes at pc to out before each step,
+        // in the form gameboy-doctor reads; null turns it off
+        void set_trace(FILE* out) { trace = out; }
+        // run the commonest instruction sequences through one handler each
+        // rather than one instruction at a time. On by default; the results
+        // are the same.
+        void set_fusion(bool on) { fusion = on; }
+        void print_fusion() const;
+
+        // time passing for the units after an instruction: what the run
+        // loop does between two of them, recompiled blocks too
+        inline void advance(int cycles) {
+            cpu.clock += cycles;
+            if (cpu.clock >= lcd.next_event) {
+                lcd.update(cpu);
+            }
+            if (cpu.clock >= render_flush) {
+                ppu.catchUp(cpu, lcd.visibleLines(cpu.clock));
+                render_flush = cpu.clock + RENDER_BATCH_LINES * DOTS_PER_LINE;
+            }
+            if (cpu.clock >= timer.next_event) {
+                timer.update(cpu);
+            }
+            apu.update(cycles);
+            serial.update(cpu, cycles);
+        }
+        // the first cycle from now advance() does more than count, by end
+        // at the latest. Up to then time can pass in one call as well as in
+        // many, as long as nothing but rom, work ram and high ram is touched.
+        inline uint64_t quiet_until(uint64_t end) {
+            uint64_t until = std::min(end, std::min(lcd.next_event, timer.next_event));
+            return std::min(until, std::min(render_flush, cpu.clock + serial.idle_cycles()));
+        }
+
+        // everything emulation carries on from, the picture on screen aside.
+        // It can be restored on any console running the same rom, and
+        // several can restore the same state at once.
+        struct State {
+            CPU cpu;
+            LCD lcd;
+            PPU ppu;
+            APU apu;
+            Timer timer;
+            Serial serial;
+            std::unique_ptr<Mapper> mapper;
+            WORD loop_head = 0;
+            Register loop_regs[5];
+            uint64_t loop_time = 0;
+        };
+        void save_state(State& state);
+        void load_state(const State& state);
+        // hand battery ram over to the save file as it is now, or as it was
+        // in state; run_frame() does the former unless speculative is set
+        void commit_save();
+        void commit_save(const State& state);
+
+        // a console that carries on independently from here. It shares the
+        // rom and every memory page until one side writes to it; cartridge
+        // ram and the picture are copied, and there is no save file or cable.
+        std::unique_ptr<GameBoy> fork();
+        // the same into an existing console, dropping whatever it ran before
+        void fork_to(GameBoy& child);
+        // plug a link cable into another console in the same process
+        void connect(GameBoy& other);
+
+        // bytes held by this console, counting shared memory pages as the
+        // other side's and the rom as split evenly between its users
+        struct Footprint {
+            size_t console = 0;   // the object itself, picture and sample ring included
+            size_t memory = 0;    // memory pages of its own
+            size_t cart_ram = 0;  // sized from the header
+            size_t sound = 0;     // synthesis buffers
+            size_t rom = 0;
+            size_t extras = 0;    // run-ahead state and render thread, when used
+            size_t total() const { return console + memory + cart_ram + sound + rom + extras; }
+        };
+        Footprint footprint() const;
+        void print_footprint() const;
+
+        CPU cpu;
+        LCD lcd;
+        PPU ppu;
+        APU apu;
+        Serial serial;
+        Timer timer;
+        SampleRing audio;
+        std::unique_ptr<SaveFile> save; // set for cartridges with a battery
+        // frames run now may be taken back, so their battery ram isn't saved
+        bool speculative = false;
+        uint64_t fused[FUSED_FORMS] = {}; // times each sequence ran to the end
+
+    private:
+        // point the units at each other
+        void wire();
+        // the run loop for one policy (gameboy.cc), up to end
+        template <class P> void run(uint64_t end);
+        // one trip round it, returning the instructions it ran
+        template <class P> int step(uint64_t end);
+        void trace_step();
+        AotBlock aot_block();
+        AotBlock fused_block();
+        void end_frame(uint64_t start);
+        void sync_lockstep();
+        void check_lockstep(int executed, uint64_t end);
+        int idle_cycles(uint64_t now, uint64_t until);
+        int poll_loop_cycles(WORD jump, uint64_t now, uint64_t until);
+
+        std::shared_ptr<std::vector<BYTE>> rom; // shared with forks
+        // last arrival at the top of a polling loop
+        WORD loop_head = 0;
+        Register loop_regs[5];
+        uint64_t loop_time = 0;
+        std::unique_ptr<State> ahead; // where run_ahead() goes back to
+        std::unique_ptr<RenderThread> renderer;
+        uint64_t render_flush = UINT64_MAX; // when to hand it lines next
+        const AotTranslation* translation = nullptr; // linked in for this rom
+        const AotTranslation* aot = nullptr; // when in use
+        std::unique_ptr<GameBoy> lockstep; // the interpreter's copy
+        bool fusion = true;
+        Policy policy = POLICY_FAST;
+        FILE* trace = nullptr;
+};
@@ -0,0 +1,303 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <stdlib.h>
+#include "gameboy.h"
+#include "netplay.h"
+#include "forkserver.h"
+#include "pool.h"
+
+// runs a rom without a window or audio device, as fast as the host allows
+// usage: .headless <rom> [--frames N] [--audio null|wav:<path>] [--run-ahead N]
+//                  [--pair <rom>] [--link-listen <path>] [--link-connect <path>]
+//                  [--netplay <1|2> <port> <host:port>] [--net-latency ms]
+//                  [--random-input <seed>] [--fork-server <path>] [--render-thread]
+//                  [--footprint] [--pool <count> [--reset-every N]]
+//                  [--no-aot] [--no-fusion] [--lockstep] [--fusion-report]
+//                  [--policy fast|balanced|plain] [--trace <path>]
+// --pair runs a second console in this process with a link cable between them.
+// --netplay needs --pair as well (the same two roms on both hosts, in the
+// same order) and plays one of them against another process, in real time.
+// --random-input mashes the joypad, the same way for the same seed.
+// --fork-server runs --frames frames once and then serves jobs from there
+// on a unix socket, each in a forked process (see forkserver.h).
+// --pool runs --frames frames on each of count pooled consoles, resetting
+// each to its post-boot state every N frames (60 by default), and times
+// the resets.
+// --no-aot interprets everything in a binary with recompiled code linked in
+// (make aot) and --no-fusion runs instruction sequences one instruction at a
+// time. --lockstep checks both against the plain interpreter instead.
+// --fusion-report says how often each fused sequence ran.
+// --policy picks the run loop (see Policy in gameboy.h); fast, the default,
+// is the only one using recompiled code and fused sequences. --trace logs
+// the registers before every instruction (with fast, before every step,
+// which can be several).
+
+typedef std::string string;
+
+GameBoy gb;
+GameBoy partner;
+
+static int run_pool(const string& rom_name, int count, long frames, long reset_every) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    std::unique_ptr<ConsolePool> pool = ConsolePool::open(rom_name, count);
+    if (!pool) {
+        return 1;
+    }
+    double made = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    printf("pool of %d consoles made in %.1f ms\n", count, made);
+
+    long resets = 0;
+    double reset_us = 0, slowest_us = 0;
+    start = clock::now();
+    for (long i = 0; i < frames; i++) {
+        for (int c = 0; c < count; c++) {
+            if (i && reset_every > 0 && i % reset_every == 0) {
+                auto before = clock::now();
+                pool->reset(c);
+                double us = std::chrono::duration<double, std::micro>(clock::now() - before).count();
+                reset_us += us;
+                slowest_us = std::max(slowest_us, us);
+                resets++;
+            }
+            (*pool)[c].run_frame();
+        }
+    }
+    double host = std::chrono::duration<double>(clock::now() - start).count();
+    double emulated = frames * count / (FPS);
+    printf("%ld frames in %.3f s, %.1fx realtime\n", frames * count, host, emulated / host);
+    if (resets) {
+        printf("%ld resets, %.1f us each on average, %.1f us at most\n", resets, reset_us / resets, slowest_us);
+    }
+    (*pool)[0].print_footprint();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No ROM name provided" << std::endl;
+        return 1;
+    }
+    long frames = 600;
+    int run_ahead = 0;
+    int net_player = 0, net_port = 0, net_latency = 0;
+    string net_peer;
+    unsigned seed = 0;
+    bool render_thread = false;
+    bool footprint = false;
+    bool aot = true, lockstep = false;
+    bool fusion = true, fusion_report = false;
+    Policy policy = POLICY_FAST;
+    string trace;
+    int pool_size = 0;
+    long reset_every = 60;
+    string audio = "null";
+    string pair_rom, link_listen, link_connect, fork_server;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (arg == "--audio" && i + 1 < argc) {
+            audio = argv[++i];
+        } else if (arg == "--run-ahead" && i + 1 < argc) {
+            run_ahead = atoi(argv[++i]);
+        } else if (arg == "--netplay" && i + 3 < argc) {
+            net_player = atoi(argv[++i]);
+            net_port = atoi(argv[++i]);
+            net_peer = argv[++i];
+        } else if (arg == "--net-latency" && i + 1 < argc) {
+            net_latency = atoi(argv[++i]);
+        } else if (arg == "--random-input" && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--pool" && i + 1 < argc) {
+            pool_size = atoi(argv[++i]);
+        } else if (arg == "--reset-every" && i + 1 < argc) {
+            reset_every = atol(argv[++i]);
+        } else if (arg == "--footprint") {
+            footprint = true;
+        } else if (arg == "--no-aot") {
+            aot = false;
+        } else if (arg == "--no-fusion") {
+            fusion = false;
+        } else if (arg == "--lockstep") {
+            lockstep = true;
+        } else if (arg == "--fusion-report") {
+            fusion_report = true;
+        } else if (arg == "--policy" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "fast") {
+                policy = POLICY_FAST;
+            } else if (name == "balanced") {
+                policy = POLICY_BALANCED;
+            } else if (name == "plain") {
+                policy = POLICY_PLAIN;
+            } else {
+                std::cerr << "Unknown policy: " << name << std::endl;
+                return 1;
+            }
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (arg == "--render-thread") {
+            render_thread = true;
+        } else if (arg == "--fork-server" && i + 1 < argc) {
+            fork_server = argv[++i];
+        } else if (arg == "--pair" && i + 1 < argc) {
+            pair_rom = argv[++i];
+        } else if (arg == "--link-listen" && i + 1 < argc) {
+            link_listen = argv[++i];
+        } else if (arg == "--link-connect" && i + 1 < argc) {
+            link_connect = argv[++i];
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (pool_size > 0) {
+        return run_pool(argv[1], pool_size, frames, reset_every);
+    }
+
+    std::unique_ptr<AudioSink> sink;
+    if (audio.rfind("wav:", 0) == 0) {
+        WavSink* wav = new WavSink(audio.substr(4));
+        sink.reset(wav);
+        if (!wav->is_open()) {
+            return 1;
+        }
+    } else if (audio == "null") {
+        sink.reset(new NullSink());
+    } else {
+        std::cerr << "Unknown audio sink: " << audio << std::endl;
+        return 1;
+    }
+
+    if (!gb.load_rom(argv[1])) {
+        return 1;
+    }
+    gb.set_render_thread(render_thread);
+    gb.set_aot(aot);
+    gb.set_fusion(fusion);
+    gb.set_policy(policy);
+    FILE* trace_file = nullptr;
+    if (!trace.empty()) {
+        trace_file = fopen(trace.c_str(), "w");
+        if (!trace_file) {
+            perror(trace.c_str());
+            return 1;
+        }
+        gb.set_trace(trace_file);
+    }
+    if (gb.has_aot() && aot && policy == POLICY_FAST) {
+        printf("running recompiled code\n");
+    }
+    if (lockstep) {
+        printf("checking against the interpreter in lockstep\n");
+        gb.set_lockstep(true);
+    }
+    if (!fork_server.empty()) {
+        // warmed up on a fork, which has no save file for the jobs to write to
+        std::unique_ptr<GameBoy> warm = gb.fork();
+        warm->apu.output = nullptr;
+        for (long i = 0; i < frames; i++) {
+            warm->run_frame();
+        }
+        std::unique_ptr<ForkServer> server = ForkServer::listen(fork_server);
+        if (!server) {
+            return 1;
+        }
+        server->serve(*warm);
+        return 1;
+    }
+    std::unique_ptr<Netplay> net;
+    if (net_player) {
+        if (pair_rom.empty() || (net_player != 1 && net_player != 2)) {
+            std::cerr << "--netplay takes player 1 or 2 and needs --pair" << std::endl;
+            return 1;
+        }
+        if (!partner.load_rom(pair_rom)) {
+            return 1;
+        }
+        GameBoy* consoles[2] = {&gb, &partner};
+        if (net_player == 2) {
+            std::swap(consoles[0], consoles[1]);
+        }
+        net = Netplay::open(consoles, net_player - 1, net_port, net_peer, net_latency);
+        if (!net) {
+            return 1;
+        }
+    } else if (!pair_rom.empty()) {
+        if (!partner.load_rom(pair_rom)) {
+            return 1;
+        }
+        gb.connect(partner);
+    } else if (!link_listen.empty()) {
+        gb.serial.link = UnixSocketLink::listen(link_listen);
+    } else if (!link_connect.empty()) {
+        gb.serial.link = UnixSocketLink::connect(link_connect);
+    }
+    if (gb.serial.link) {
+        run_ahead = 0; // the other end can't be taken back
+    }
+
+    BYTE pad = 0xFF;
+    long next_pad = 0;
+    auto frame_dur = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / (FPS)));
+    auto start = std::chrono::steady_clock::now();
+    auto next_frame = start;
+    for (long i = 0; i < frames; i++) {
+        if (seed && i >= next_pad) {
+            // one key at a time, held for up to half a second
+            seed = seed * 1103515245 + 12345;
+            pad = (seed >> 16) & 1 ? 0xFF : ~(1 << ((seed >> 17) & 7));
+            next_pad = i + 1 + ((seed >> 20) & 31);
+        }
+        if (net) {
+            if (!net->run_frame(pad)) {
+                break;
+            }
+            sink->drain(gb.audio);
+            partner.audio.pop(nullptr, partner.audio.size());
+            next_frame += frame_dur;
+            std::this_thread::sleep_until(next_frame);
+            continue;
+        }
+        if (seed) {
+            gb.cpu.set_joypad(pad);
+        }
+        gb.run_ahead(run_ahead);
+        sink->drain(gb.audio);
+        if (!pair_rom.empty()) {
+            partner.run_frame();
+            partner.audio.pop(nullptr, partner.audio.size());
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    gb.save_ram();
+
+    double host = std::chrono::duration<double>(end - start).count();
+    double emulated = frames / (FPS);
+    printf("%ld frames in %.3f s, %.1fx realtime\n", frames, host, emulated / host);
+    if (footprint) {
+        gb.print_footprint();
+    }
+    if (fusion_report) {
+        gb.print_fusion();
+    }
+    if (trace_file) {
+        fclose(trace_file);
+    }
+    if (net) {
+        printf("netplay: %ld frames run again, deepest %d (%.2f ms), %s\n", net->rollbacks,
+               net->deepest, net->slowest_ms, net->desync_frame < 0 ? "in sync" : "desynced");
+    }
+    if (gb.cpu.locked) {
+        printf("the cpu hung on opcode 0x%02X at 0x%04X, which doesn't exist\n",
+               gb.cpu.peek(gb.cpu.locked_at), gb.cpu.locked_at);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "idle.h"
+
+static int read_source(WORD addr) {
+    if (addr < 0xFF00 || addr >= 0xFF80) {
+        return 0;
+    }
+    switch (addr) {
+        case 0xFF04: return POLL_DIV;
+        case 0xFF05: return POLL_TIMA;
+        case 0xFF41: case 0xFF44: return POLL_LCD;
+    }
+    if (addr >= 0xFF10 && addr < 0xFF40) {
+        return -1; // sound status moves on its own and isn't tracked
+    }
+    return 0;
+}
+
+int poll_loop_sources(CPU& cpu, WORD head, WORD jump) {
+    int sources = 0;
+    WORD pc = head;
+    WORD last = head;
+    while (pc <= jump && pc >= head) {
+        BYTE op = cpu.read_mem(pc);
+        int len = 1;
+        int addr = -1; // memory read, if any
+        switch (op) {
+            // nop, rotates of A, cpl, scf, ccf, inc/dec a
+            case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F:
+            case 0x2F: case 0x37: case 0x3F: case 0x3C: case 0x3D:
+                break;
+            case 0x0A: addr = cpu.BC; break; // ld a,(bc)
+            case 0x1A: addr = cpu.DE; break; // ld a,(de)
+            case 0xF2: addr = 0xFF00 | cpu.C; break; // ldh a,(c)
+            case 0xF0: // ldh a,(n)
+                addr = 0xFF00 | cpu.read_mem(pc + 1);
+                len = 2;
+                break;
+            case 0xFA: // ld a,(nn)
+                addr = cpu.read_mem(pc + 1) | (cpu.read_mem(pc + 2) << 8);
+                len = 3;
+                break;
+            // ld a,n, alu a,n, jr
+            case 0x3E: case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+            case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+                len = 2;
+                break;
+            // jp
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+                len = 3;
+                break;
+            case 0xCB: { // bit only
+                BYTE cb = cpu.read_mem(pc + 1);
+                if (cb < 0x40 || cb >= 0x80) {
+                    return -1;
+                }
+                if ((cb & 7) == 6) {
+                    addr = cpu.HL;
+                }
+                len = 2;
+                break;
+            }
+            default:
+                // ld a,r and alu a,r, (hl) included
+                if (op < 0x78 || op > 0xBF) {
+                    return -1;
+                }
+                if ((op & 7) == 6) {
+                    addr = cpu.HL;
+                }
+        }
+        if (addr >= 0) {
+            int source = read_source(addr);
+            if (source < 0) {
+                return -1;
+            }
+            sources |= source;
+        }
+        last = pc;
+        pc += len;
+    }
+    return last == jump ? sources : -1;
+}
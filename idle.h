@@ -0,0 +1,17 @@
+#pragma once
+#include "cpu.h"
+
+#define MAX_POLL_LOOP 32    // bytes from the top of a loop to its jump back
+#define MAX_POLL_PERIOD 512 // cycles for one trip round it
+
+// what a polling loop reads that changes by itself, rather than at an
+// interrupt or event (which skipping never goes past anyway)
+#define POLL_LCD 1  // LY or STAT
+#define POLL_DIV 2
+#define POLL_TIMA 4
+
+// decode the loop from head to the jump back at jump. If it only reads
+// memory and works on A and the flags (so, started from the same registers,
+// it does the same thing until something it reads changes) returns the
+// POLL_ bits for what it reads, otherwise -1.
+int poll_loop_sources(CPU& cpu, WORD head, WORD jump);
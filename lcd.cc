@@ -4,61 +4,133 @@
 LCD::LCD() {
 }
 
-void LCD::update(CPU& cpu, PPU& ppu, int cycles) {
-    setMode(cpu);
-    if (cpu.read_mem(0xFF40) & 0b10000000) { // check lcd enable bit
-        slCtr -= cycles; // update scanline counter
-        BYTE currLine = cpu.read_mem(0xFF44); // get current scanline
-        if (currLine > 153) {
-            cpu.write_mem(0xFF44, 0); // reset scanline
-            currLine = 0;
+void LCD::reset(CPU& cpu) {
+    enabled = cpu.mem[0xFF40] & 0b10000000;
+    frame_start = cpu.clock;
+    schedule(cpu, cpu.clock + 1);
+}
+
+// the first event at or after cycle from
+void LCD::schedule(CPU& cpu, uint64_t from) {
+    if (!enabled) {
+        next_event = UINT64_MAX;
+        return;
+    }
+    if (from >= frame_start + DOTS_PER_FRAME) {
+        frame_start += (from - frame_start) / DOTS_PER_FRAME * DOTS_PER_FRAME;
+    }
+    int pos = from - frame_start;
+    int line = pos / DOTS_PER_LINE;
+    BYTE stat = cpu.mem[0xFF41];
+
+    // frame relative times, anything already gone is in the next frame
+    int best = DOTS_PER_FRAME * 2;
+    auto consider = [&](int t) {
+        if (t < pos) {
+            t += DOTS_PER_FRAME;
         }
-        if (slCtr <= 0) {
-            slCtr = 456; // reset scanline counter
-            if (currLine < 144) {
-                ppu.draw(cpu);
-            } else if (currLine == 144) { // vblank
-                cpu.interrupt(0);
-            }
-            cpu.write_mem(0xFF44, currLine + 1); // go to next scanline
+        if (t < best) {
+            best = t;
         }
+    };
+    consider(144 * DOTS_PER_LINE); // vblank
+    if ((stat & 0b1000000) && cpu.mem[0xFF45] < LINES_PER_FRAME) { // LY == LYC
+        consider(cpu.mem[0xFF45] * DOTS_PER_LINE);
     }
+    if (stat & 0b100000) { // mode 2
+        int next = (pos + DOTS_PER_LINE - 1) / DOTS_PER_LINE;
+        consider(next < 144 ? next * DOTS_PER_LINE : 0);
+    }
+    if (stat & 0b1000) { // mode 0
+        int next = line * DOTS_PER_LINE + HBLANK_DOT < pos ? line + 1 : line;
+        consider(next < 144 ? next * DOTS_PER_LINE + HBLANK_DOT : HBLANK_DOT);
+    }
+    next_event = frame_start + best;
 }
 
-void LCD::setMode(CPU& cpu) {
-    BYTE LCDSR = cpu.read_mem(0xFF41); // LCD Status Register
-    if (cpu.read_mem(0xFF40) & 0b10000000) { // check lcd enable bit
-        bool modeChanged = false;
-        BYTE currLine = cpu.read_mem(0xFF44); // get current scanline
-        BYTE currMode = LCDSR & 0b11; // get current mode
-        if (currLine >= 144) { // mode 1
-            modeChanged = (LCDSR & 0b10000) && currMode != 1;
-            LCDSR = (LCDSR & 0b11111101) | 0b1; // set lower 2 bits to 1
-        } else if (slCtr >= 456 - 80) { // mode 2
-            modeChanged = (LCDSR & 0b100000) && currMode != 2;
-            LCDSR = (LCDSR & 0b11111110) | 0b10; // set lower 2 bits to 2
-        } else if (slCtr >= 456 - 80 - 172) { // mode 3
-            modeChanged = false;
-            LCDSR = LCDSR  | 0b11; // set lower 2 bits to 3
-        } else { // mode 0
-            modeChanged = (LCDSR & 0b1000) && currMode != 0;
-            LCDSR = LCDSR & 0b11111100; // set lower 2 bits to 0
+void LCD::update(CPU& cpu) {
+    while (cpu.clock >= next_event) {
+        uint64_t now = next_event;
+        int pos = (now - frame_start) % DOTS_PER_FRAME;
+        int line = pos / DOTS_PER_LINE;
+        int dot = pos % DOTS_PER_LINE;
+        BYTE stat = cpu.mem[0xFF41];
+        bool statInterrupt = false;
+
+        if (dot == 0) {
+            if (line == 144) { // vblank
+                ppu->catchUp(cpu, 144);
+                ppu->restart();
+                cpu.interrupt(0);
+                statInterrupt |= stat & 0b10000;
+            } else if (line < 144) {
+                statInterrupt |= stat & 0b100000;
+            }
+            statInterrupt |= (stat & 0b1000000) && line == cpu.mem[0xFF45];
+        } else if (dot == HBLANK_DOT && line < 144) {
+            statInterrupt |= stat & 0b1000;
         }
-        if (modeChanged) {
+        if (statInterrupt) {
             cpu.interrupt(1);
         }
-        if (currLine == cpu.read_mem(0xFF45)) { // Coincidence Flag
-            LCDSR |= 0b100;
-            if (LCDSR & 0b01000000) {
-                cpu.interrupt(1);
-            }
-        } else {
-            LCDSR &= 0b11111011;
-        }
-        cpu.write_mem(0xFF41, LCDSR);
-    } else {
-        slCtr = 456; // reset scanline counter
-        cpu.write_mem(0xFF44, 0); // reset scanline
-        cpu.write_mem(0xFF41, (LCDSR & 0b11111101) | 0b1);
+        schedule(cpu, now + 1);
     }
-}
\ No newline at end of file
+}
+
+uint64_t LCD::nextChange(uint64_t now) {
+    if (!enabled) {
+        return UINT64_MAX;
+    }
+    int pos = (now - frame_start) % DOTS_PER_FRAME;
+    int line = pos / DOTS_PER_LINE;
+    int dot = pos % DOTS_PER_LINE;
+    int next = DOTS_PER_LINE;
+    if (line < 144 && dot < OAM_SCAN_DOTS) {
+        next = OAM_SCAN_DOTS;
+    } else if (line < 144 && dot < HBLANK_DOT) {
+        next = HBLANK_DOT;
+    }
+    return now - dot + next;
+}
+
+BYTE LCD::read(CPU& cpu, WORD addr) {
+    BYTE stat = 0b10000000 | (cpu.mem[0xFF41] & 0b1111000);
+    if (!enabled) {
+        return addr == 0xFF44 ? 0 : stat; // mode 0
+    }
+    int pos = (cpu.clock - frame_start) % DOTS_PER_FRAME;
+    int line = pos / DOTS_PER_LINE;
+    int dot = pos % DOTS_PER_LINE;
+    if (addr == 0xFF44) {
+        return line;
+    }
+    if (line == cpu.mem[0xFF45]) { // coincidence flag
+        stat |= 0b100;
+    }
+    if (line >= 144) {
+        return stat | 1;
+    } else if (dot < OAM_SCAN_DOTS) {
+        return stat | 2;
+    } else if (dot < HBLANK_DOT) {
+        return stat | 3;
+    }
+    return stat;
+}
+
+void LCD::write(CPU& cpu, WORD addr, BYTE data) {
+    if (addr == 0xFF40) {
+        bool on = data & 0b10000000;
+        if (on && !enabled) {
+            frame_start = cpu.clock; // starts over at line 0
+        } else if (!on && enabled) {
+            ppu->restart();
+        }
+        enabled = on;
+        cpu.mem.set(0xFF40, data);
+    } else if (addr == 0xFF41) {
+        cpu.mem.set(0xFF41, data & 0b1111000); // only the interrupt selects are writable
+    } else if (addr == 0xFF45) {
+        cpu.mem.set(0xFF45, data);
+    } // LY is read only
+    schedule(cpu, cpu.clock + 1);
+}
@@ -1,12 +1,47 @@
 #pragma once
+#include <cstdint>
 #include "cpu.h"
 #include "ppu.h"
 
+#define DOTS_PER_LINE 456
+#define LINES_PER_FRAME 154
+#define DOTS_PER_FRAME (DOTS_PER_LINE * LINES_PER_FRAME)
+#define OAM_SCAN_DOTS 80
+#define HBLANK_DOT (OAM_SCAN_DOTS + 172) // start of mode 0
+
+// LY and the STAT mode/coincidence bits are never stored, they're worked out
+// from cpu.clock when read. Interrupts (vblank and the enabled STAT sources)
+// are scheduled: next_event is the next cycle anything happens, and update()
+// only needs calling once cpu.clock reaches it.
 class LCD {
     public:
         LCD();
-        void update(CPU& cpu, PPU& ppu, int cycles);
-        void setMode(CPU& cpu);
+        // pick up LCDC/STAT/LYC from memory and start scanning from line 0
+        void reset(CPU& cpu);
+        // raise every interrupt due by cpu.clock
+        void update(CPU& cpu);
+        BYTE read(CPU& cpu, WORD addr);
+        // LCDC, STAT, LYC
+        void write(CPU& cpu, WORD addr, BYTE data);
+
+        // lines scanned out so far this frame, none once it reached vblank
+        // (the vblank event has drawn it)
+        inline int visibleLines(uint64_t now) {
+            if (!enabled) {
+                return 0;
+            }
+            int ly = (now - frame_start) % DOTS_PER_FRAME / DOTS_PER_LINE;
+            return ly < 144 ? ly : 0;
+        }
+
+        // the next cycle LY or the STAT mode reads differently
+        uint64_t nextChange(uint64_t now);
+
+        uint64_t next_event = UINT64_MAX;
+        PPU* ppu = nullptr;
+
     private:
-        int slCtr = 456; // scanline counter, 456 clock cycles per one scanline
-};
\ No newline at end of file
+        void schedule(CPU& cpu, uint64_t from);
+        bool enabled = false;
+        uint64_t frame_start = 0; // cycle line 0 of the current frame began
+};
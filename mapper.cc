@@ -0,0 +1,287 @@
+#include "mapper.h"
+#include <cstring>
+
+static size_t header_ram_size(BYTE code) {
+    switch(code) {
+        case 0x01: return 0x2000; // a 2KB chip still decodes a whole bank, it just mirrors
+        case 0x02: return 0x2000;
+        case 0x03: return 0x8000;
+        case 0x04: return 0x20000;
+        case 0x05: return 0x10000;
+        default: return 0;
+    }
+}
+
+// mbc1 multicarts are 1MB and repeat the header (and so the logo) at the
+// start of each 256KB game
+static bool is_multicart(BYTE* rom, size_t rom_size) {
+    return rom_size == 0x100000 && memcmp(rom + 0x104, rom + 0x40104, 0x30) == 0;
+}
+
+std::unique_ptr<Mapper> Mapper::create(BYTE* rom, size_t rom_size) {
+    size_t ram_size = header_ram_size(rom[0x149]);
+    switch(rom[0x147]) {
+        case 0x01: case 0x02: case 0x03:
+            return std::unique_ptr<Mapper>(new MBC1(rom, rom_size, ram_size, is_multicart(rom, rom_size)));
+        case 0x05: case 0x06:
+            return std::unique_ptr<Mapper>(new MBC2(rom, rom_size));
+        case 0x0F: case 0x10:
+            return std::unique_ptr<Mapper>(new MBC3(rom, rom_size, ram_size, true));
+        case 0x11: case 0x12: case 0x13:
+            return std::unique_ptr<Mapper>(new MBC3(rom, rom_size, ram_size, false));
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            return std::unique_ptr<Mapper>(new MBC5(rom, rom_size, ram_size));
+        default:
+            return std::unique_ptr<Mapper>(new NoMBC(rom, rom_size, ram_size));
+    }
+}
+
+bool Mapper::has_battery(const BYTE* rom) {
+    switch(rom[0x147]) {
+        case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10:
+        case 0x13: case 0x1B: case 0x1E: case 0x22: case 0xFF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Mapper::Mapper(BYTE* rom, size_t rom_size, size_t ram_size) : rom(rom) {
+    rom_banks = 1;
+    while((size_t) rom_banks * 2 * ROM_BANK_SIZE <= rom_size) {
+        rom_banks *= 2;
+    }
+    ram_store.assign(ram_size, 0);
+    ram = ram_store.data();
+    this->ram_size = ram_size;
+    rom0 = rom_bank(0);
+    romx = rom_bank(1);
+}
+
+void Mapper::copy_state(const Mapper& other) {
+    memcpy(ram, other.ram, ram_size);
+    update();
+}
+
+BYTE* Mapper::ram_bank(int bank) {
+    if(ram_size < RAM_BANK_SIZE) {
+        return nullptr;
+    }
+    int banks = ram_size / RAM_BANK_SIZE;
+    return ram + (bank % banks) * RAM_BANK_SIZE;
+}
+
+NoMBC::NoMBC(BYTE* rom, size_t rom_size, size_t ram_size) : Mapper(rom, rom_size, ram_size) {
+    update();
+}
+
+void NoMBC::update() {
+    sram = ram_bank(0);
+}
+
+MBC1::MBC1(BYTE* rom, size_t rom_size, size_t ram_size, bool multicart)
+    : Mapper(rom, rom_size, ram_size), bank1_bits(multicart ? 4 : 5) {
+    update();
+}
+
+void MBC1::write(WORD addr, BYTE data) {
+    if(addr < 0x2000) {
+        ram_en = (data & 0xF) == 0xA;
+    }else if(addr < 0x4000) {
+        // the zero check sees all five bits even when only four are wired
+        bank1 = data & 0x1F;
+        if(bank1 == 0) {
+            bank1 = 1;
+        }
+    }else if(addr < 0x6000) {
+        bank2 = data & 3;
+    }else {
+        advanced = data & 1;
+    }
+    update();
+}
+
+void MBC1::update() {
+    int upper = bank2 << bank1_bits;
+    rom0 = rom_bank(advanced ? upper : 0);
+    romx = rom_bank(upper | (bank1 & ((1 << bank1_bits) - 1)));
+    sram = ram_en ? ram_bank(advanced ? bank2 : 0) : nullptr;
+}
+
+void MBC1::copy_state(const Mapper& other) {
+    const MBC1& from = static_cast<const MBC1&>(other);
+    bank1 = from.bank1;
+    bank2 = from.bank2;
+    advanced = from.advanced;
+    ram_en = from.ram_en;
+    Mapper::copy_state(other);
+}
+
+// built in, 512 4 bit cells kept a byte each (as saves store them) and
+// repeated over all of 0xA000-0xBFFF
+MBC2::MBC2(BYTE* rom, size_t rom_size) : Mapper(rom, rom_size, 0x200) {}
+
+void MBC2::write(WORD addr, BYTE data) {
+    if(addr >= 0x4000) {
+        return;
+    }
+    // address bit 8 picks the register
+    if(addr & (1 << 8)) {
+        rom_sel = data & 0xF;
+        if(rom_sel == 0) {
+            rom_sel = 1;
+        }
+    }else {
+        ram_en = (data & 0xF) == 0xA;
+    }
+    update();
+}
+
+void MBC2::update() {
+    romx = rom_bank(rom_sel);
+}
+
+void MBC2::copy_state(const Mapper& other) {
+    const MBC2& from = static_cast<const MBC2&>(other);
+    rom_sel = from.rom_sel;
+    ram_en = from.ram_en;
+    Mapper::copy_state(other);
+}
+
+BYTE MBC2::read_ram(WORD addr) {
+    if(!ram_en) {
+        return 0xFF;
+    }
+    return ram[addr & 0x1FF] | 0xF0;
+}
+
+void MBC2::write_ram(WORD addr, BYTE data) {
+    if(ram_en) {
+        ram[addr & 0x1FF] = data & 0xF;
+    }
+}
+
+MBC3::MBC3(BYTE* rom, size_t rom_size, size_t ram_size, bool has_rtc)
+    : Mapper(rom, rom_size, ram_size), has_rtc(has_rtc) {
+    update();
+}
+
+void MBC3::write(WORD addr, BYTE data) {
+    if(addr < 0x2000) {
+        ram_en = (data & 0xF) == 0xA;
+    }else if(addr < 0x4000) {
+        rom_sel = data & 0x7F;
+        if(rom_sel == 0) {
+            rom_sel = 1;
+        }
+    }else if(addr < 0x6000) {
+        ram_sel = data & 0xF;
+    }else {
+        // writing 0 then 1 copies the running clock into the readable registers
+        if(latch_prev == 0 && data == 1) {
+            memcpy(latched, rtc, sizeof(rtc));
+        }
+        latch_prev = data;
+    }
+    update();
+}
+
+void MBC3::update() {
+    romx = rom_bank(rom_sel);
+    sram = (ram_en && ram_sel < 8) ? ram_bank(ram_sel) : nullptr;
+}
+
+void MBC3::copy_state(const Mapper& other) {
+    const MBC3& from = static_cast<const MBC3&>(other);
+    memcpy(rtc, from.rtc, sizeof(rtc));
+    rom_sel = from.rom_sel;
+    ram_sel = from.ram_sel;
+    ram_en = from.ram_en;
+    memcpy(latched, from.latched, sizeof(latched));
+    latch_prev = from.latch_prev;
+    subsecond = from.subsecond;
+    Mapper::copy_state(other);
+}
+
+BYTE MBC3::read_ram(WORD addr) {
+    if(ram_en && has_rtc && ram_sel >= 0x8 && ram_sel <= 0xC) {
+        return latched[ram_sel - 0x8];
+    }
+    return 0xFF;
+}
+
+void MBC3::write_ram(WORD addr, BYTE data) {
+    if(!(ram_en && has_rtc && ram_sel >= 0x8 && ram_sel <= 0xC)) {
+        return;
+    }
+    static const BYTE masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+    rtc[ram_sel - 0x8] = data & masks[ram_sel - 0x8];
+    latched[ram_sel - 0x8] = rtc[ram_sel - 0x8];
+    if(ram_sel == 0x8) {
+        subsecond = 0;
+    }
+}
+
+void MBC3::tick(int cycles) {
+    if(!has_rtc || (rtc[4] & 0x40)) {
+        return;
+    }
+    subsecond += cycles;
+    while(subsecond >= RTC_CLOCK_RATE) {
+        subsecond -= RTC_CLOCK_RATE;
+        // out of range values count up to the register width and wrap
+        // without carrying
+        rtc[0] = (rtc[0] + 1) & 0x3F;
+        if(rtc[0] != 60) {
+            continue;
+        }
+        rtc[0] = 0;
+        rtc[1] = (rtc[1] + 1) & 0x3F;
+        if(rtc[1] != 60) {
+            continue;
+        }
+        rtc[1] = 0;
+        rtc[2] = (rtc[2] + 1) & 0x1F;
+        if(rtc[2] != 24) {
+            continue;
+        }
+        rtc[2] = 0;
+        int day = (((rtc[4] & 1) << 8) | rtc[3]) + 1;
+        if(day > 0x1FF) {
+            day = 0;
+            rtc[4] |= 0x80; // day counter carry
+        }
+        rtc[3] = day & 0xFF;
+        rtc[4] = (rtc[4] & 0xFE) | (day >> 8);
+    }
+}
+
+MBC5::MBC5(BYTE* rom, size_t rom_size, size_t ram_size) : Mapper(rom, rom_size, ram_size) {
+    update();
+}
+
+void MBC5::write(WORD addr, BYTE data) {
+    if(addr < 0x2000) {
+        ram_en = (data & 0xF) == 0xA;
+    }else if(addr < 0x3000) {
+        rom_sel = (rom_sel & 0x100) | data;
+    }else if(addr < 0x4000) {
+        rom_sel = (rom_sel & 0xFF) | ((data & 1) << 8);
+    }else if(addr < 0x6000) {
+        ram_sel = data & 0xF;
+    }
+    update();
+}
+
+void MBC5::update() {
+    romx = rom_bank(rom_sel); // bank 0 can be mapped here, unlike older mbcs
+    sram = ram_en ? ram_bank(ram_sel) : nullptr;
+}
+
+void MBC5::copy_state(const Mapper& other) {
+    const MBC5& from = static_cast<const MBC5&>(other);
+    rom_sel = from.rom_sel;
+    ram_sel = from.ram_sel;
+    ram_en = from.ram_en;
+    Mapper::copy_state(other);
+}
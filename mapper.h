@@ -0,0 +1,126 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include "cpu.h"
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+#define RTC_CLOCK_RATE 4194304 // cycles per rtc second
+
+// cartridge memory bank controller. Register writes to 0x0000-0x7FFF go to
+// write(), after which the cpu copies rom0/romx/sram into its memory map, so
+// ordinary reads are a pointer lookup no matter which controller is fitted.
+// sram is null whenever external ram isn't plainly mapped (disabled, mbc2's
+// nibble ram, mbc3 clock registers) and those accesses go through
+// read_ram()/write_ram() instead.
+class Mapper {
+    public:
+        // picks the controller from the cartridge header (0x147)
+        static std::unique_ptr<Mapper> create(BYTE* rom, size_t rom_size);
+        // whether the cartridge keeps its ram powered
+        static bool has_battery(const BYTE* rom);
+        virtual ~Mapper() {}
+
+        virtual void write(WORD addr, BYTE data) {}
+        virtual BYTE read_ram(WORD addr) { return 0xFF; }
+        virtual void write_ram(WORD addr, BYTE data) {}
+        // advance any cartridge clock
+        virtual void tick(int cycles) {}
+        // take over the registers and ram contents of another controller for
+        // the same cartridge; the cpu must map_banks() after
+        virtual void copy_state(const Mapper& other);
+
+        BYTE* rom0 = nullptr; // 0x0000 - 0x3FFF
+        BYTE* romx = nullptr; // 0x4000 - 0x7FFF
+        BYTE* sram = nullptr; // 0xA000 - 0xBFFF
+        BYTE* ram = nullptr;
+        size_t ram_size = 0;
+
+    protected:
+        Mapper(BYTE* rom, size_t rom_size, size_t ram_size);
+        // republish the bank pointers
+        virtual void update() {}
+        BYTE* rom_bank(int bank) { return rom + (bank & (rom_banks - 1)) * ROM_BANK_SIZE; }
+        BYTE* ram_bank(int bank);
+
+        BYTE* rom;
+        int rom_banks; // power of two
+
+    private:
+        std::vector<BYTE> ram_store;
+};
+
+// rom only, possibly with unbanked ram
+class NoMBC : public Mapper {
+    public:
+        NoMBC(BYTE* rom, size_t rom_size, size_t ram_size);
+    protected:
+        void update() override;
+};
+
+// also covers MBC1M multicarts, which wire the upper bank bits one lower
+class MBC1 : public Mapper {
+    public:
+        MBC1(BYTE* rom, size_t rom_size, size_t ram_size, bool multicart);
+        void write(WORD addr, BYTE data) override;
+        void copy_state(const Mapper& other) override;
+    protected:
+        void update() override;
+    private:
+        int bank1_bits;
+        int bank1 = 1;
+        int bank2 = 0;
+        bool advanced = false; // mode 1: bank2 also applies to 0x0000 and ram
+        bool ram_en = false;
+};
+
+class MBC2 : public Mapper {
+    public:
+        MBC2(BYTE* rom, size_t rom_size);
+        void write(WORD addr, BYTE data) override;
+        BYTE read_ram(WORD addr) override;
+        void write_ram(WORD addr, BYTE data) override;
+        void copy_state(const Mapper& other) override;
+    protected:
+        void update() override;
+    private:
+        int rom_sel = 1;
+        bool ram_en = false;
+};
+
+class MBC3 : public Mapper {
+    public:
+        MBC3(BYTE* rom, size_t rom_size, size_t ram_size, bool has_rtc);
+        void write(WORD addr, BYTE data) override;
+        BYTE read_ram(WORD addr) override;
+        void write_ram(WORD addr, BYTE data) override;
+        void tick(int cycles) override;
+
+        // seconds, minutes, hours, day low, day high (bit 0 day 8, bit 6 halt, bit 7 carry)
+        BYTE rtc[5] = {0, 0, 0, 0, 0};
+        void copy_state(const Mapper& other) override;
+    protected:
+        void update() override;
+    private:
+        bool has_rtc;
+        int rom_sel = 1;
+        int ram_sel = 0; // 0x00-0x07 ram bank, 0x08-0x0C clock register
+        bool ram_en = false;
+        BYTE latched[5] = {0, 0, 0, 0, 0};
+        BYTE latch_prev = 0xFF;
+        int subsecond = 0;
+};
+
+class MBC5 : public Mapper {
+    public:
+        MBC5(BYTE* rom, size_t rom_size, size_t ram_size);
+        void write(WORD addr, BYTE data) override;
+        void copy_state(const Mapper& other) override;
+    protected:
+        void update() override;
+    private:
+        int rom_sel = 1; // 9 bits
+        int ram_sel = 0;
+        bool ram_en = false;
+};
@@ -0,0 +1,123 @@
+#include "memory.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+Memory::Memory() {
+    std::shared_ptr<Page> zero = std::make_shared<Page>(); // value initialised
+    for (int i = 0; i < MEM_PAGES; i++) {
+        pages[i] = zero;
+        data[i] = zero->data;
+    }
+}
+
+Memory::Memory(const Memory& other) {
+    *this = other;
+}
+
+Memory& Memory::operator=(const Memory& other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (block) {
+        for (int i = 0; i < MEM_PAGES; i++) {
+            memcpy(data[i], other.data[i], MEM_PAGE_SIZE);
+        }
+        return *this;
+    }
+    if (other.block) {
+        for (int i = 0; i < MEM_PAGES; i++) {
+            pages[i] = std::make_shared<Page>();
+            memcpy(pages[i]->data, other.data[i], MEM_PAGE_SIZE);
+            data[i] = pages[i]->data;
+        }
+        owned = 0xFFFF;
+        return *this;
+    }
+    for (int i = 0; i < MEM_PAGES; i++) {
+        pages[i] = other.pages[i];
+        data[i] = other.data[i];
+    }
+    owned = 0;
+    if (other.owned) { // untouched otherwise, so a copy can be read from by many threads
+        other.owned = 0;
+    }
+    return *this;
+}
+
+void Memory::write(WORD addr, const BYTE* from, size_t size) {
+    size_t at = addr;
+    while (size) {
+        int index = at >> MEM_PAGE_BITS;
+        size_t offset = at & (MEM_PAGE_SIZE - 1);
+        size_t count = std::min(size, MEM_PAGE_SIZE - offset);
+        if (!(owned & (1 << index))) {
+            own(index);
+        }
+        memmove(data[index] + offset, from, count);
+        at += count;
+        from += count;
+        size -= count;
+    }
+}
+
+void Memory::fill(WORD addr, BYTE value, size_t size) {
+    size_t at = addr;
+    while (size) {
+        int index = at >> MEM_PAGE_BITS;
+        size_t offset = at & (MEM_PAGE_SIZE - 1);
+        size_t count = std::min(size, MEM_PAGE_SIZE - offset);
+        if (!(owned & (1 << index))) {
+            own(index);
+        }
+        memset(data[index] + offset, value, count);
+        at += count;
+        size -= count;
+    }
+}
+
+BYTE* Memory::flat() {
+    if (!block) {
+        block.reset(new BYTE[0x10000]);
+        for (int i = 0; i < MEM_PAGES; i++) {
+            memcpy(block.get() + i * MEM_PAGE_SIZE, data[i], MEM_PAGE_SIZE);
+            data[i] = block.get() + i * MEM_PAGE_SIZE;
+            pages[i].reset();
+        }
+        owned = 0xFFFF;
+    }
+    return block.get();
+}
+
+size_t Memory::footprint() const {
+    if (block) {
+        return 0x10000;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < MEM_PAGES; i++) {
+        // count each page once, if every reference to it is from here
+        long slots = 0;
+        bool first = true;
+        for (int j = 0; j < MEM_PAGES; j++) {
+            if (pages[j] == pages[i]) {
+                slots++;
+                first &= j >= i;
+            }
+        }
+        if (first && slots == pages[i].use_count()) {
+            bytes += MEM_PAGE_SIZE;
+        }
+    }
+    return bytes;
+}
+
+void Memory::own(int index) {
+    if (pages[index].use_count() > 1) {
+        pages[index] = std::make_shared<Page>(*pages[index]);
+        data[index] = pages[index]->data;
+    } else {
+        // another thread may have just let go of it, its reads come first
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    owned |= 1 << index;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+
+#define MEM_PAGE_BITS 12 // 4KB
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGES (0x10000 / MEM_PAGE_SIZE)
+
+// a 64KB address space kept in pages that copies share until one of them
+// writes. Copying a Memory copies 16 pointers, so forks and snapshots are
+// cheap and only pay for the pages that change afterwards. Pages start out
+// as one shared page of zeroes.
+class Memory {
+    public:
+        Memory();
+        Memory(const Memory& other);
+        Memory& operator=(const Memory& other);
+
+        inline BYTE operator[](WORD addr) const {
+            return data[addr >> MEM_PAGE_BITS][addr & (MEM_PAGE_SIZE - 1)];
+        }
+        inline void set(WORD addr, BYTE value) {
+            int index = addr >> MEM_PAGE_BITS;
+            if (!(owned & (1 << index))) {
+                own(index);
+            }
+            data[index][addr & (MEM_PAGE_SIZE - 1)] = value;
+        }
+        // size bytes from addr on, across pages if need be but not past 0xFFFF
+        void write(WORD addr, const BYTE* from, size_t size);
+        void fill(WORD addr, BYTE value, size_t size);
+        const BYTE* page(int index) const { return data[index]; }
+        // lay the pages out in one block that stays put, to hand out a
+        // pointer to all 64KB. From then on this memory never shares: copies
+        // of it get their own pages and copies into it are written in place.
+        BYTE* flat();
+        // bytes of the pages nothing else holds
+        size_t footprint() const;
+
+    private:
+        struct Page {
+            BYTE data[MEM_PAGE_SIZE];
+        };
+        // copy the page unless nothing else has it any more
+        void own(int index);
+
+        // accesses only need these two, which come first
+        BYTE* data[MEM_PAGES]; // pages[i]->data, saving a load on every access
+        // pages known not to be shared; copying in either direction clears it
+        mutable uint16_t owned = 0;
+        std::shared_ptr<Page> pages[MEM_PAGES];
+        std::unique_ptr<BYTE[]> block; // once flat()
+};
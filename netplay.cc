@@ -0,0 +1,323 @@
+#include "netplay.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define PACKET_INPUTS 32 // inputs resent in each packet at most
+#define LINGER_MS 200    // on the way out, for the peer to get our last inputs
+
+// tag, first frame, count, ack, hash frame, hash, then the inputs; in host
+// byte order, both ends are expected to be the same build
+#define PACKET_TAG 'N'
+#define HEADER_SIZE (1 + 4 + 1 + 4 + 4 + 8)
+
+static int64_t now_ms() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// fnv-1a over what the game can see: registers, memory and cartridge ram
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t size) {
+    const BYTE* bytes = (const BYTE*) data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_console(uint64_t h, const CPU& cpu, const Mapper& mapper) {
+    WORD regs[6] = {cpu.AF, cpu.BC, cpu.DE, cpu.HL, cpu.SP, cpu.PC};
+    h = hash_bytes(h, regs, sizeof(regs));
+    h = hash_bytes(h, &cpu.clock, sizeof(cpu.clock));
+    for (int i = 0; i < MEM_PAGES; i++) {
+        h = hash_bytes(h, cpu.mem.page(i), MEM_PAGE_SIZE);
+    }
+    return hash_bytes(h, mapper.ram, mapper.ram_size);
+}
+
+std::unique_ptr<Netplay> Netplay::open(GameBoy* consoles[2], int player, int port,
+                                       const std::string& peer, int latency_ms) {
+    size_t colon = peer.find_last_of(':');
+    if (colon == std::string::npos) {
+        printf("Netplay peer should be host:port\n");
+        return nullptr;
+    }
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* peer_addr;
+    if (getaddrinfo(peer.substr(0, colon).c_str(), peer.substr(colon + 1).c_str(), &hints, &peer_addr) != 0) {
+        printf("Unknown netplay peer %s\n", peer.c_str());
+        return nullptr;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        freeaddrinfo(peer_addr);
+        return nullptr;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    // connected, so only the peer's datagrams come in
+    if (bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0 ||
+        ::connect(fd, peer_addr->ai_addr, peer_addr->ai_addrlen) < 0) {
+        perror("bind");
+        close(fd);
+        freeaddrinfo(peer_addr);
+        return nullptr;
+    }
+    freeaddrinfo(peer_addr);
+
+    std::unique_ptr<Netplay> net(new Netplay(fd));
+    net->consoles[0] = consoles[0];
+    net->consoles[1] = consoles[1];
+    net->player = player;
+    net->latency_ms = latency_ms;
+    for (int i = 0; i < 2; i++) {
+        net->states[i].resize(MAX_ROLLBACK + 1);
+    }
+    std::fill(net->remote_hash_frames, net->remote_hash_frames + INPUT_RING, -1);
+    consoles[0]->connect(*consoles[1]);
+    // any frame may be rolled back, battery ram is saved once it's settled
+    for (int i = 0; i < 2; i++) {
+        consoles[i]->speculative = true;
+    }
+    return net;
+}
+
+Netplay::~Netplay() {
+    int64_t until = now_ms() + LINGER_MS;
+    while (peer_has < local_count && now_ms() < until) {
+        send_inputs();
+        service(NETPLAY_RESEND_MS);
+    }
+    close(fd);
+}
+
+bool Netplay::run_frame(BYTE input) {
+    local_inputs[frame % INPUT_RING] = input;
+    local_count = frame + 1;
+    send_inputs();
+    service(0);
+    // don't guess further ahead than can be taken back
+    int64_t since = now_ms();
+    while (frame - remote_count >= MAX_ROLLBACK) {
+        if (now_ms() - since > NETPLAY_TIMEOUT_MS) {
+            printf("Netplay peer stopped responding\n");
+            return false;
+        }
+        if (now_ms() - last_send_ms >= NETPLAY_RESEND_MS) {
+            send_inputs();
+        }
+        service(1);
+    }
+    if (mispredicted >= 0) {
+        rollback(mispredicted);
+    }
+    advance(true);
+    record_hashes();
+    return true;
+}
+
+void Netplay::advance(bool shown) {
+    long f = frame;
+    BYTE remote = 0xFF; // nothing held
+    if (f < remote_count) {
+        remote = remote_inputs[f % INPUT_RING];
+    } else if (remote_count > 0) {
+        remote = remote_inputs[(remote_count - 1) % INPUT_RING];
+    }
+    used[f % INPUT_RING] = remote;
+
+    BYTE inputs[2];
+    inputs[player] = local_inputs[f % INPUT_RING];
+    inputs[1 - player] = remote;
+    for (int i = 0; i < 2; i++) {
+        consoles[i]->save_state(states[i][f % (MAX_ROLLBACK + 1)]);
+        consoles[i]->cpu.set_joypad(inputs[i]);
+    }
+    // always in the same order, the cable is clocked from within run_frame
+    for (int i = 0; i < 2; i++) {
+        GameBoy& gb = *consoles[i];
+        SampleRing* output = gb.apu.output;
+        bool skip = gb.ppu.skip;
+        if (!shown) {
+            gb.apu.output = nullptr;
+            gb.ppu.skip = true;
+        }
+        gb.run_frame();
+        gb.apu.output = output;
+        gb.ppu.skip = skip;
+    }
+    frame++;
+}
+
+void Netplay::rollback(long to) {
+    auto start = std::chrono::steady_clock::now();
+    long end = frame;
+    for (int i = 0; i < 2; i++) {
+        consoles[i]->load_state(states[i][to % (MAX_ROLLBACK + 1)]);
+    }
+    frame = to;
+    while (frame < end) {
+        advance(false);
+    }
+    rollbacks += end - to;
+    deepest = std::max(deepest, (int) (end - to));
+    mispredicted = -1;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    slowest_ms = std::max(slowest_ms, ms);
+}
+
+// a frame is settled once both inputs for it are known and it has been run
+// with them; its hash is of the consoles at the start of the next, and
+// that is when battery ram is saved
+void Netplay::record_hashes() {
+    long settled = hashed;
+    while (hashed < remote_count && hashed < frame) {
+        long h = hashed;
+        uint64_t value = 1469598103934665603ULL;
+        for (int i = 0; i < 2; i++) {
+            if (h + 1 == frame) {
+                value = hash_console(value, consoles[i]->cpu, *consoles[i]->cpu.mapper);
+            } else {
+                const GameBoy::State& state = states[i][(h + 1) % (MAX_ROLLBACK + 1)];
+                value = hash_console(value, state.cpu, *state.mapper);
+            }
+        }
+        hashes[h % INPUT_RING] = value;
+        hashed++;
+        compare(h);
+    }
+    for (int i = 0; i < 2 && hashed > settled; i++) {
+        if (hashed == frame) {
+            consoles[i]->commit_save();
+        } else {
+            consoles[i]->commit_save(states[i][hashed % (MAX_ROLLBACK + 1)]);
+        }
+    }
+}
+
+bool Netplay::settled_hash(long at, uint64_t& hash) const {
+    if (at >= hashed || at < hashed - INPUT_RING || at < 0) {
+        return false;
+    }
+    hash = hashes[at % INPUT_RING];
+    return true;
+}
+
+void Netplay::compare(long at) {
+    if (at >= hashed || at < hashed - INPUT_RING || remote_hash_frames[at % INPUT_RING] != at) {
+        return;
+    }
+    if (hashes[at % INPUT_RING] != remote_hashes[at % INPUT_RING] && desync_frame < 0) {
+        desync_frame = at;
+        printf("Netplay desync at frame %ld\n", at);
+    }
+}
+
+void Netplay::send_inputs() {
+    long first = std::max(peer_has, local_count - PACKET_INPUTS);
+    BYTE count = local_count - first;
+    BYTE packet[HEADER_SIZE + PACKET_INPUTS];
+    uint32_t first32 = first;
+    uint32_t ack = remote_count;
+    uint32_t hash_frame = hashed - 1; // all ones before the first
+    uint64_t hash = hashed ? hashes[(hashed - 1) % INPUT_RING] : 0;
+    packet[0] = PACKET_TAG;
+    memcpy(packet + 1, &first32, 4);
+    packet[5] = count;
+    memcpy(packet + 6, &ack, 4);
+    memcpy(packet + 10, &hash_frame, 4);
+    memcpy(packet + 14, &hash, 8);
+    for (int i = 0; i < count; i++) {
+        packet[HEADER_SIZE + i] = local_inputs[(first + i) % INPUT_RING];
+    }
+    send_packet(packet, HEADER_SIZE + count);
+    last_send_ms = now_ms();
+}
+
+void Netplay::send_packet(const BYTE* data, size_t size) {
+    if (latency_ms > 0) {
+        outbox.push_back({now_ms() + latency_ms, std::vector<BYTE>(data, data + size)});
+        return;
+    }
+    send(fd, data, size, MSG_DONTWAIT); // lost, like any datagram, if it fails
+}
+
+bool Netplay::service(int timeout_ms) {
+    int64_t now = now_ms();
+    size_t sent = 0;
+    while (sent < outbox.size() && outbox[sent].due_ms <= now) {
+        send(fd, outbox[sent].data.data(), outbox[sent].data.size(), MSG_DONTWAIT);
+        sent++;
+    }
+    outbox.erase(outbox.begin(), outbox.begin() + sent);
+    if (!outbox.empty()) {
+        timeout_ms = std::min<int64_t>(timeout_ms, outbox[0].due_ms - now);
+    }
+
+    pollfd pfd = {fd, POLLIN, 0};
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+        return false;
+    }
+    BYTE buf[HEADER_SIZE + PACKET_INPUTS];
+    bool got = false;
+    while (true) {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0 && errno == ECONNREFUSED) {
+            continue; // peer not up yet
+        }
+        if (n <= 0) {
+            break;
+        }
+        receive(buf, n);
+        got = true;
+    }
+    return got;
+}
+
+void Netplay::receive(const BYTE* data, size_t size) {
+    if (size < HEADER_SIZE || data[0] != PACKET_TAG || size < (size_t) HEADER_SIZE + data[5]) {
+        return;
+    }
+    uint32_t first, ack, hash_frame;
+    uint64_t hash;
+    memcpy(&first, data + 1, 4);
+    BYTE count = data[5];
+    memcpy(&ack, data + 6, 4);
+    memcpy(&hash_frame, data + 10, 4);
+    memcpy(&hash, data + 14, 8);
+
+    peer_has = std::max(peer_has, (long) ack);
+    // only in order, anything past a gap comes round again
+    for (int i = 0; i < count; i++) {
+        long f = first + i;
+        if (f != remote_count) {
+            continue;
+        }
+        BYTE input = data[HEADER_SIZE + i];
+        remote_inputs[f % INPUT_RING] = input;
+        remote_count++;
+        if (f < frame && used[f % INPUT_RING] != input && mispredicted < 0) {
+            mispredicted = f;
+        }
+    }
+    if (hash_frame != UINT32_MAX) {
+        remote_hashes[hash_frame % INPUT_RING] = hash;
+        remote_hash_frames[hash_frame % INPUT_RING] = hash_frame;
+        compare(hash_frame);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gameboy.h"
+
+#define MAX_ROLLBACK 8        // frames the remote input may be guessed ahead
+#define INPUT_RING 64         // frames of input kept, for resending and rollback
+#define NETPLAY_TIMEOUT_MS 5000
+#define NETPLAY_RESEND_MS 16  // while waiting on the peer
+
+// two-player link cable games over udp. Both hosts run both consoles,
+// cabled together in process, and each drives one of them; only joypad
+// states cross the network. The other player's input is guessed (it is
+// assumed not to change) so neither host waits on the round trip; when the
+// real input arrives and differs, both consoles go back to that frame and
+// run forward again without drawing or sound. Both sides hash the consoles
+// after every frame whose inputs are settled and compare, so a desync is
+// reported rather than played through.
+class Netplay {
+    public:
+        // player is 0 or 1, consoles[player] is this host's. peer is
+        // "host:port"; latency_ms holds outgoing packets back, for testing
+        static std::unique_ptr<Netplay> open(GameBoy* consoles[2], int player, int port,
+                                             const std::string& peer, int latency_ms = 0);
+        ~Netplay();
+
+        // run both consoles through the next frame with this host's joypad
+        // (as cpu.joypad_state, a 0 bit is held); false once the peer has gone quiet
+        bool run_frame(BYTE input);
+        // frames settled so far (both inputs known and run with them), and
+        // the hash of both consoles after one of the last INPUT_RING of them
+        long settled() const { return hashed; }
+        bool settled_hash(long at, uint64_t& hash) const;
+
+        long frame = 0;          // frames run
+        long rollbacks = 0;      // frames run again
+        int deepest = 0;         // longest single rollback
+        double slowest_ms = 0;   // and the most time one took
+        long desync_frame = -1;  // first frame the hashes disagreed on
+
+    private:
+        Netplay(int fd) : fd(fd) {}
+        void advance(bool shown);
+        void rollback(long to);
+        void record_hashes();
+        void compare(long at);
+        // send what is due, then take in packets for up to timeout_ms
+        bool service(int timeout_ms);
+        void send_inputs();
+        void send_packet(const BYTE* data, size_t size);
+        void receive(const BYTE* data, size_t size);
+
+        int fd;
+        GameBoy* consoles[2];
+        int player;
+        int latency_ms;
+
+        BYTE local_inputs[INPUT_RING];
+        long local_count = 0;
+        BYTE remote_inputs[INPUT_RING];
+        BYTE used[INPUT_RING];   // remote input each frame was last run with
+        long remote_count = 0;   // remote inputs known, frames 0 to remote_count - 1
+        long peer_has = 0;       // of ours
+        long mispredicted = -1;  // earliest frame run with a wrong guess
+
+        // state at the start of each of the last frames, per console
+        std::vector<GameBoy::State> states[2];
+
+        // hashes of the consoles after each settled frame
+        uint64_t hashes[INPUT_RING];
+        long hashed = 0;         // frames hashed here
+        uint64_t remote_hashes[INPUT_RING];
+        long remote_hash_frames[INPUT_RING];
+
+        struct Delayed {
+            int64_t due_ms;
+            std::vector<BYTE> data;
+        };
+        std::vector<Delayed> outbox;
+        int64_t last_send_ms = 0;
+};
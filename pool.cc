@@ -0,0 +1,34 @@
+#include "pool.h"
+#include <cstring>
+
+std::unique_ptr<ConsolePool> ConsolePool::open(const std::string& rom_name, int count, int boot_frames) {
+    std::unique_ptr<GameBoy> loaded(new GameBoy());
+    if (count <= 0 || !loaded->load_rom(rom_name)) {
+        return nullptr;
+    }
+    // a fork has no save file, so nothing the consoles do reaches the disk
+    std::unique_ptr<GameBoy> booted = loaded->fork();
+    loaded.reset();
+    booted->apu.output = nullptr;
+    for (int i = 0; i < boot_frames; i++) {
+        booted->run_frame();
+    }
+
+    std::unique_ptr<ConsolePool> pool(new ConsolePool());
+    booted->save_state(pool->boot);
+    memcpy(pool->boot_screen, booted->cpu.screen, sizeof(pool->boot_screen));
+    pool->consoles.reset(new GameBoy[count]);
+    pool->count = count;
+    for (int i = 0; i < count; i++) {
+        booted->fork_to(pool->consoles[i]);
+        pool->consoles[i].apu.output = nullptr;
+    }
+    return pool;
+}
+
+void ConsolePool::reset(int i) {
+    GameBoy& gb = consoles[i];
+    gb.load_state(boot); // many at once is fine, boot is only read
+    memcpy(gb.cpu.screen, boot_screen, sizeof(boot_screen));
+    gb.ppu.dropHeld();
+}
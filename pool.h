@@ -0,0 +1,30 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "gameboy.h"
+
+// consoles for batch jobs that start over thousands of times. They are
+// allocated up front in one array, all running the same rom, and reset()
+// takes one back to a state saved once after boot: loading it shares the
+// memory pages and copies a few small units, instead of reading and
+// booting the rom again. Nobody listens to their sound.
+class ConsolePool {
+    public:
+        // boot_frames are run once (with no input) before the state is saved
+        static std::unique_ptr<ConsolePool> open(const std::string& rom_name, int count,
+                                                 int boot_frames = 0);
+
+        GameBoy& operator[](int i) { return consoles[i]; }
+        int size() const { return count; }
+        // console i as it was after boot, picture included. Several
+        // consoles can be reset at once from different threads.
+        void reset(int i);
+
+    private:
+        ConsolePool() {}
+
+        std::unique_ptr<GameBoy[]> consoles; // the arena
+        int count = 0;
+        GameBoy::State boot;
+        BYTE boot_screen[144][160];
+};
@@ -1,28 +1,32 @@
 #include "ppu.h"
 #include <stdio.h>
+#include <cstring>
+
+// the grey level of each of the four shades
+static const BYTE shades[4] = {0xFF, 0xCC, 0x77, 0x00};
 
 PPU::PPU () {
+    memset(line, 0xFF, sizeof(line));
 }
 
-inline int getColor(CPU& cpu, WORD addr, int colorId) {
-    BYTE palette = cpu.read_mem(addr);
+inline int getColor(const Memory& mem, WORD addr, int colorId) {
+    BYTE palette = mem[addr];
     return (((palette >> (colorId * 2 + 1)) & 0b1) << 1) | ((palette >> (colorId * 2)) & 0b1);
 }
 
-void PPU::renderTiles(CPU& cpu) {
-    BYTE LCDCR = cpu.read_mem(0xFF40); // LCD Control Register
+void PPU::renderTiles(const Memory& mem, int scanline) {
+    BYTE LCDCR = mem[0xFF40]; // LCD Control Register
 
     WORD background;
     BYTE currLine;
 
-    BYTE SCY = cpu.read_mem(0xFF42);
-    BYTE SCX = cpu.read_mem(0xFF43);
+    BYTE SCY = mem[0xFF42];
+    BYTE SCX = mem[0xFF43];
 
-    BYTE WY = cpu.read_mem(0xFF4A);
-    BYTE WX = cpu.read_mem(0xFF4B) - 7;
+    BYTE WY = mem[0xFF4A];
+    BYTE WX = mem[0xFF4B] - 7;
 
     WORD tileData = LCDCR & 0b10000 ? 0x8000 : 0x8800;
-    BYTE scanline = cpu.read_mem(0xFF44);
     bool windowOn = (LCDCR & 0b100000) && WY <= scanline; // check window display enable bit
 
     if (windowOn) {
@@ -37,7 +41,7 @@ void PPU::renderTiles(CPU& cpu) {
     // cache color values
     int colors[4];
     for (int i = 0; i < 4; i++) {
-        colors[i] = getColor(cpu, 0xFF47, i);
+        colors[i] = getColor(mem, 0xFF47, i);
     }
     
     for (int i = 0; i < 160; i++) {
@@ -45,52 +49,31 @@ void PPU::renderTiles(CPU& cpu) {
         WORD tileMem;
 
         if (LCDCR & 0b10000) {
-            tileMem = tileData + cpu.read_mem(background + row + currCol / 8) * 16;
+            tileMem = tileData + mem[background + row + currCol / 8] * 16;
         } else {
-            tileMem = tileData + ((SIGNED_BYTE) cpu.read_mem(background + row + currCol / 8) + 128) * 16;
+            tileMem = tileData + ((SIGNED_BYTE) mem[background + row + currCol / 8] + 128) * 16;
         }
 
-        BYTE data1 = cpu.read_mem(tileMem + 2 * (currLine % 8));
-        BYTE data2 = cpu.read_mem(tileMem + 2 * (currLine % 8) + 1);
+        BYTE data1 = mem[tileMem + 2 * (currLine % 8)];
+        BYTE data2 = mem[tileMem + 2 * (currLine % 8) + 1];
 
         int colorBit = 7 - currCol % 8;
         int colorId = (((data2 >> colorBit) & 0b1) << 1) | ((data1 >> colorBit) & 0b1);
         int color = colors[colorId];
 
-        switch (color) {
-            case 0:
-                screen[scanline][i][0] = 255;
-                screen[scanline][i][1] = 255;
-                screen[scanline][i][2] = 255;
-                break;
-            case 1:
-                screen[scanline][i][0] = 0xCC;
-                screen[scanline][i][1] = 0xCC;
-                screen[scanline][i][2] = 0xCC;
-                break;
-            case 2:
-                screen[scanline][i][0] = 0x77;
-                screen[scanline][i][1] = 0x77;
-                screen[scanline][i][2] = 0x77;
-                break;
-            case 3:
-                screen[scanline][i][0] = 0x0;
-                screen[scanline][i][1] = 0x0;
-                screen[scanline][i][2] = 0x0;
-                break;
-        }
+        line[i] = shades[color];
     }
 }
 
-void PPU::renderSprites(CPU& cpu) {
-    BYTE LCDCR = cpu.read_mem(0xFF40); // LCD Control Register
+void PPU::renderSprites(const Memory& mem, int scanline) {
+    BYTE LCDCR = mem[0xFF40]; // LCD Control Register
 
     // cache color values
     int colors1[4];
     int colors2[4];
     for (int i = 0; i < 4; i++) {
-        colors1[i] = getColor(cpu, 0xFF48, i);
-        colors2[i] = getColor(cpu, 0xFF49, i);
+        colors1[i] = getColor(mem, 0xFF48, i);
+        colors2[i] = getColor(mem, 0xFF49, i);
     }
 
     int spriteCounter = 0;
@@ -100,18 +83,17 @@ void PPU::renderSprites(CPU& cpu) {
         }
 
         BYTE idx = i * 4;
-        BYTE XPos = cpu.read_mem(idx + 0xFE00 + 1) - 8;
-        BYTE YPos = cpu.read_mem(idx + 0xFE00) - 16;
-        BYTE flags = cpu.read_mem(idx + 0xFE00 + 3);
-        BYTE scanline = cpu.read_mem(0xFF44);
+        BYTE XPos = mem[idx + 0xFE00 + 1] - 8;
+        BYTE YPos = mem[idx + 0xFE00] - 16;
+        BYTE flags = mem[idx + 0xFE00 + 3];
         int spriteSize = LCDCR & 0b100 ? 16 : 8;
 
         if (scanline >= YPos && scanline < YPos + spriteSize) {
             spriteCounter++;
 
-            WORD addr = 0x8000 + cpu.read_mem(idx + 0xFE00 + 2) * 16 + 2 * (flags & 0b1000000 ? YPos + spriteSize - scanline - 1 : scanline - YPos);
-            BYTE data1 = cpu.read_mem(addr);
-            BYTE data2 = cpu.read_mem(addr + 1);
+            WORD addr = 0x8000 + mem[idx + 0xFE00 + 2] * 16 + 2 * (flags & 0b1000000 ? YPos + spriteSize - scanline - 1 : scanline - YPos);
+            BYTE data1 = mem[addr];
+            BYTE data2 = mem[addr + 1];
 
             for (int j = 0; j < 8; j++) {
                 int colorBit = flags & 0b100000 ? 7 - j : j;
@@ -120,71 +102,151 @@ void PPU::renderSprites(CPU& cpu) {
 
                 // Sprite BG Priority
                 if (colorId == 0 || 
-                    (flags & 0b10000000 && (screen[scanline][XPos + 7 - j][0] != 255 || screen[scanline][XPos + 7 - j][1] != 255 || screen[scanline][XPos + 7 - j][2] != 255)) || 
-                    (XPos + 7 - j <= 0 || XPos + 7 - j >= 160 || scanline <= 0 || scanline >= 144)) {
+                    (XPos + 7 - j <= 0 || XPos + 7 - j >= 160 || scanline <= 0 || scanline >= 144) ||
+                    (flags & 0b10000000 && line[XPos + 7 - j] != 255)) {
                     continue;
                 }
 
-                switch (color) {
-                    case 0:
-                        screen[scanline][XPos + 7 - j][0] = 255;
-                        screen[scanline][XPos + 7 - j][1] = 255;
-                        screen[scanline][XPos + 7 - j][2] = 255;
-                        break;
-                    case 1:
-                        screen[scanline][XPos + 7 - j][0] = 0xCC;
-                        screen[scanline][XPos + 7 - j][1] = 0xCC;
-                        screen[scanline][XPos + 7 - j][2] = 0xCC;
-                        break;
-                    case 2:
-                        screen[scanline][XPos + 7 - j][0] = 0x77;
-                        screen[scanline][XPos + 7 - j][1] = 0x77;
-                        screen[scanline][XPos + 7 - j][2] = 0x77;
-                        break;
-                    case 3:
-                        screen[scanline][XPos + 7 - j][0] = 0x0;
-                        screen[scanline][XPos + 7 - j][1] = 0x0;
-                        screen[scanline][XPos + 7 - j][2] = 0x0;
-                        break;
-                }
+                line[XPos + 7 - j] = shades[color];
             }
         }
     }
 }
 
-void PPU::writePixels(CPU& cpu) {
-    for (int i = 0; i < 144; i++) {
-        for (int j = 0; j < 160; j++) {
-            if (screen[i][j][0] != cpu.screen[i][j][0]) {
-                cpu.screen[i][j][0] = screen[i][j][0];
-                cpu.screen[i][j][1] = screen[i][j][1];
-                cpu.screen[i][j][2] = screen[i][j][2];
-                if (i < cpu.dirtyMinY) {
-                    cpu.dirtyMinY = i;
-                }
-                if (i > cpu.dirtyMaxY) {
-                    cpu.dirtyMaxY = i;
-                }
-                if (j < cpu.dirtyMinX) {
-                    cpu.dirtyMinX = j;
-                }
-                if (j > cpu.dirtyMaxX) {
-                    cpu.dirtyMaxX = j;
-                }
+void PPU::writeLine(CPU& cpu, int scanline) {
+    for (int j = 0; j < 160; j++) {
+        if (line[j] != cpu.screen[scanline][j]) {
+            cpu.screen[scanline][j] = line[j];
+            if (scanline < cpu.dirtyMinY) {
+                cpu.dirtyMinY = scanline;
+            }
+            if (scanline > cpu.dirtyMaxY) {
+                cpu.dirtyMaxY = scanline;
+            }
+            if (j < cpu.dirtyMinX) {
+                cpu.dirtyMinX = j;
+            }
+            if (j > cpu.dirtyMaxX) {
+                cpu.dirtyMaxX = j;
             }
         }
     }
 }
 
-void PPU::draw(CPU& cpu) {
-    BYTE LCDCR = cpu.read_mem(0xFF40); // LCD Control Register
+void PPU::draw(const Memory& mem, int scanline) {
+    BYTE LCDCR = mem[0xFF40]; // LCD Control Register
     if (LCDCR & 0b1) {
-        renderTiles(cpu);
+        renderTiles(mem, scanline);
     }
     if (LCDCR & 0b10) {
-        renderSprites(cpu);
+        renderSprites(mem, scanline);
+    }
+}
+
+void PPU::render(const Memory& mem, CPU& cpu, int first, int last) {
+    for (int scanline = first; scanline < last; scanline++) {
+        // whatever isn't drawn over stays as it was
+        memcpy(line, cpu.screen[scanline], sizeof(line));
+        draw(mem, scanline);
+        writeLine(cpu, scanline);
+    }
+}
+
+void PPU::renderUpTo(CPU& cpu, int target) {
+    bool covers = cpu.mem[0xFF40] & 0b1; // the background is on
+    if (skip && covers) {
+        std::shared_ptr<const Memory> mem = std::make_shared<const Memory>(cpu.mem);
+        for (int scanline = renderedLines; scanline < target; scanline++) {
+            heldLines += !held[scanline];
+            held[scanline] = mem;
+        }
+        renderedLines = target;
+        return;
+    }
+    if (covers) {
+        for (int scanline = renderedLines; scanline < target && heldLines; scanline++) {
+            heldLines -= !!held[scanline];
+            held[scanline].reset();
+        }
+    } else {
+        drawHeld(cpu, renderedLines, target);
+    }
+    if (worker) {
+        worker->submit(*this, cpu, renderedLines, target);
+    } else {
+        render(cpu.mem, cpu, renderedLines, target);
     }
-    if (LCDCR & 0b11) {
-        writePixels(cpu);
+    renderedLines = target;
+}
+
+void PPU::drawHeld(CPU& cpu, int first, int last) {
+    if (!heldLines) {
+        return;
+    }
+    if (worker) {
+        worker->wait(); // lines go to the screen in order
+    }
+    for (int scanline = first; scanline < last; scanline++) {
+        if (held[scanline]) {
+            render(*held[scanline], cpu, scanline, scanline + 1);
+            held[scanline].reset();
+            heldLines--;
+        }
+    }
+}
+
+void PPU::dropHeld() {
+    for (std::shared_ptr<const Memory>& mem : held) {
+        mem.reset();
+    }
+    heldLines = 0;
+}
+
+RenderThread::RenderThread() {
+    thread = std::thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
     }
-}
\ No newline at end of file
+    wake.notify_one();
+    thread.join();
+}
+
+void RenderThread::submit(PPU& ppu, CPU& cpu, int first, int last) {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [&] { return queued - done < RENDER_QUEUE; });
+    Job& job = jobs[queued % RENDER_QUEUE];
+    job.ppu = &ppu;
+    job.cpu = &cpu;
+    job.mem = cpu.mem;
+    job.first = first;
+    job.last = last;
+    queued++;
+    guard.unlock();
+    wake.notify_one();
+}
+
+void RenderThread::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [&] { return done == queued; });
+}
+
+void RenderThread::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [&] { return stopping || done < queued; });
+        if (done == queued) {
+            return; // stopping
+        }
+        Job& job = jobs[done % RENDER_QUEUE];
+        guard.unlock();
+        job.ppu->render(job.mem, *job.cpu, job.first, job.last);
+        guard.lock();
+        job.mem = blank;
+        done++;
+        idle.notify_all();
+    }
+}
@@ -1,12 +1,88 @@
 #pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "cpu.h"
 
+#define RENDER_QUEUE 32 // batches of lines in flight at most
+
+class RenderThread;
+
+// lines are drawn lazily: a line is due once LY has moved past it, and due
+// lines are drawn in one go just before anything they depend on changes
+// (vram, oam or a video register) and when vblank starts
 class PPU {
     public:
         PPU();
-        BYTE screen[144][160][3];
-        void renderTiles(CPU& cpu);
-        void renderSprites(CPU& cpu);
-        void writePixels(CPU& cpu);
-        void draw(CPU& cpu);
-};
\ No newline at end of file
+        // the line being drawn, grey levels as in cpu.screen
+        BYTE line[160];
+        // draw every line the lcd has already scanned out, target of them
+        inline void catchUp(CPU& cpu, int target) {
+            if (renderedLines < target) {
+                renderUpTo(cpu, target);
+            }
+        }
+        // the frame is done (or the lcd switched off), start again from line 0
+        void restart() { renderedLines = 0; }
+        void renderTiles(const Memory& mem, int scanline);
+        void renderSprites(const Memory& mem, int scanline);
+        // copy line into cpu.screen, growing the dirty rectangle
+        void writeLine(CPU& cpu, int scanline);
+        void draw(const Memory& mem, int scanline);
+        // draw lines first to last from mem into cpu.screen
+        void render(const Memory& mem, CPU& cpu, int first, int last);
+        // where another ppu of the same console is in its frame
+        void copy_state(const PPU& other) { renderedLines = other.renderedLines; }
+
+        // frames nobody will see (run-ahead) are scanned but not drawn
+        bool skip = false;
+        // draw what skipped frames left on lines nothing has drawn over
+        // since, e.g. because the lcd went off. Done after every frame seen.
+        void drawHeld(CPU& cpu) { drawHeld(cpu, 0, 144); }
+        // the screen was replaced, what was held is moot
+        void dropHeld();
+        // hand due lines to this thread instead of drawing them here
+        RenderThread* worker = nullptr;
+    private:
+        void renderUpTo(CPU& cpu, int target);
+        void drawHeld(CPU& cpu, int first, int last);
+        int renderedLines = 0;
+        // each line a skipped frame passed over, with the memory it would
+        // have been drawn from. A line drawn with the background on covers
+        // everything, so it lets go; anything else draws on top of it.
+        std::shared_ptr<const Memory> held[144];
+        int heldLines = 0;
+};
+
+// draws lines for a ppu on a thread of its own, so the cpu can carry on.
+// Each batch of due lines comes with a copy of memory taken when they were
+// due; pages are shared until the cpu writes them (see memory.h), so the
+// copy is cheap and the lines come out the same as if drawn on the spot.
+class RenderThread {
+    public:
+        RenderThread();
+        ~RenderThread();
+        void submit(PPU& ppu, CPU& cpu, int first, int last);
+        // until everything submitted is in cpu.screen
+        void wait();
+
+    private:
+        struct Job {
+            PPU* ppu;
+            CPU* cpu;
+            Memory mem;
+            int first;
+            int last;
+        };
+        void run();
+
+        Job jobs[RENDER_QUEUE];
+        Memory blank; // what finished jobs hold instead, so their pages are let go
+        long queued = 0;
+        long done = 0;
+        bool stopping = false;
+        std::mutex lock;
+        std::condition_variable wake, idle;
+        std::thread thread;
+};
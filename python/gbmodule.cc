@@ -0,0 +1,492 @@
+// python binding over the C interface in capi.h. The framebuffer and memory
+// are buffer protocol views straight onto the console, so wrapping them in
+// numpy (np.asarray) or reading a memoryview copies nothing and stays live.
+// VecEnv observations are views the same way, onto a buffer each step
+// writes over.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cstring>
+#include <vector>
+#include "../capi.h"
+
+struct Console {
+    PyObject_HEAD
+    gb_console* gb;
+};
+
+struct State {
+    PyObject_HEAD
+    gb_state* state;
+};
+
+struct VecEnv {
+    PyObject_HEAD
+    gb_vecenv* env;
+    int size;
+    size_t obs_size;
+    uint8_t* obs;   // size * obs_size
+    uint8_t* dones; // size
+};
+
+// exports one region of a console or vecenv, keeping it alive while viewed
+struct View {
+    PyObject_HEAD
+    PyObject* owner;
+    const uint8_t* data;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+};
+
+static PyTypeObject ConsoleType = {PyVarObject_HEAD_INIT(NULL, 0)};
+static PyTypeObject StateType = {PyVarObject_HEAD_INIT(NULL, 0)};
+static PyTypeObject ViewType = {PyVarObject_HEAD_INIT(NULL, 0)};
+static PyTypeObject VecEnvType = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+//———— View ————————————————————————————————————
+
+static int view_getbuffer(PyObject* self, Py_buffer* buf, int flags) {
+    View* view = (View*) self;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "console views are read only");
+        buf->obj = NULL;
+        return -1;
+    }
+    Py_ssize_t len = 1;
+    for (int i = 0; i < view->ndim; i++) {
+        len *= view->shape[i];
+    }
+    buf->buf = (void*) view->data;
+    buf->obj = self;
+    Py_INCREF(self);
+    buf->len = len;
+    buf->readonly = 1;
+    buf->itemsize = 1;
+    buf->format = (flags & PyBUF_FORMAT) ? (char*) "B" : NULL;
+    buf->ndim = view->ndim;
+    buf->shape = (flags & PyBUF_ND) == PyBUF_ND ? view->shape : NULL;
+    buf->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? view->strides : NULL;
+    buf->suboffsets = NULL;
+    buf->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs view_buffer = {view_getbuffer, NULL};
+
+static void view_dealloc(PyObject* self) {
+    Py_XDECREF(((View*) self)->owner);
+    Py_TYPE(self)->tp_free(self);
+}
+
+// a memoryview over data, C order
+static PyObject* make_view(PyObject* owner, const uint8_t* data, int ndim, const Py_ssize_t* shape) {
+    View* view = PyObject_New(View, &ViewType);
+    if (!view) {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    view->owner = owner;
+    view->data = data;
+    view->ndim = ndim;
+    Py_ssize_t stride = 1;
+    for (int i = ndim - 1; i >= 0; i--) {
+        view->shape[i] = shape[i];
+        view->strides[i] = stride;
+        stride *= shape[i];
+    }
+    PyObject* memory = PyMemoryView_FromObject((PyObject*) view);
+    Py_DECREF(view); // the memoryview holds it now
+    return memory;
+}
+
+//———— State ———————————————————————————————————
+
+static PyObject* state_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    State* self = (State*) type->tp_alloc(type, 0);
+    if (self) {
+        self->state = gb_state_create();
+    }
+    return (PyObject*) self;
+}
+
+static void state_dealloc(PyObject* self) {
+    gb_state_destroy(((State*) self)->state);
+    Py_TYPE(self)->tp_free(self);
+}
+
+//———— GameBoy —————————————————————————————————
+
+static PyObject* console_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    Console* self = (Console*) type->tp_alloc(type, 0);
+    if (self) {
+        self->gb = gb_create();
+    }
+    return (PyObject*) self;
+}
+
+static int console_init(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* keywords[] = {"path", NULL};
+    const char* path = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", (char**) keywords, &path)) {
+        return -1;
+    }
+    if (path && !gb_load_rom(((Console*) self)->gb, path)) {
+        PyErr_Format(PyExc_IOError, "could not load %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+// sets an error unless the console has a rom to run
+static bool require_rom(PyObject* self) {
+    if (!gb_rom_loaded(((Console*) self)->gb)) {
+        PyErr_SetString(PyExc_RuntimeError, "no rom loaded, call load_rom first");
+        return false;
+    }
+    return true;
+}
+
+static void console_dealloc(PyObject* self) {
+    gb_destroy(((Console*) self)->gb);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject* console_load_rom(PyObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+    if (!gb_load_rom(((Console*) self)->gb, path)) {
+        PyErr_Format(PyExc_IOError, "could not load %s", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* console_run_frame(PyObject* self, PyObject* args) {
+    int frames = 1;
+    if (!PyArg_ParseTuple(args, "|i", &frames) || !require_rom(self)) {
+        return NULL;
+    }
+    gb_console* gb = ((Console*) self)->gb;
+    // other threads can carry on meanwhile, each console is independent
+    Py_BEGIN_ALLOW_THREADS
+    for (int i = 0; i < frames; i++) {
+        gb_run_frame(gb);
+    }
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject* console_set_input(PyObject* self, PyObject* args) {
+    unsigned char buttons;
+    if (!PyArg_ParseTuple(args, "b", &buttons)) {
+        return NULL;
+    }
+    gb_set_input(((Console*) self)->gb, buttons);
+    Py_RETURN_NONE;
+}
+
+static PyObject* console_read_mem(PyObject* self, PyObject* args) {
+    unsigned short addr;
+    if (!PyArg_ParseTuple(args, "H", &addr) || !require_rom(self)) {
+        return NULL;
+    }
+    return PyLong_FromLong(gb_read_mem(((Console*) self)->gb, addr));
+}
+
+static PyObject* console_read_audio(PyObject* self, PyObject* args) {
+    int16_t samples[4096 * 2];
+    size_t frames = gb_read_audio(((Console*) self)->gb, samples, 4096);
+    return PyBytes_FromStringAndSize((const char*) samples, frames * 2 * sizeof(int16_t));
+}
+
+static PyObject* console_save_state(PyObject* self, PyObject* args) {
+    State* state = NULL;
+    if (!PyArg_ParseTuple(args, "|O!", &StateType, &state) || !require_rom(self)) {
+        return NULL;
+    }
+    if (state) {
+        Py_INCREF(state);
+    } else if (!(state = (State*) PyObject_CallNoArgs((PyObject*) &StateType))) {
+        return NULL;
+    }
+    gb_save_state(((Console*) self)->gb, state->state);
+    return (PyObject*) state;
+}
+
+static PyObject* console_load_state(PyObject* self, PyObject* args) {
+    State* state;
+    if (!PyArg_ParseTuple(args, "O!", &StateType, &state) || !require_rom(self)) {
+        return NULL;
+    }
+    gb_load_state(((Console*) self)->gb, state->state);
+    Py_RETURN_NONE;
+}
+
+static PyObject* console_locked_up(PyObject* self, void* closure) {
+    uint16_t pc;
+    if (!gb_locked_up(((Console*) self)->gb, &pc)) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromLong(pc);
+}
+
+static PyObject* console_framebuffer(PyObject* self, void* closure) {
+    Py_ssize_t shape[2] = {GB_SCREEN_HEIGHT, GB_SCREEN_WIDTH};
+    Console* console = (Console*) self;
+    return make_view(self, gb_framebuffer(console->gb), 2, shape);
+}
+
+static PyObject* console_memory(PyObject* self, void* closure) {
+    Py_ssize_t shape[1] = {0x10000};
+    Console* console = (Console*) self;
+    return make_view(self, gb_memory(console->gb), 1, shape);
+}
+
+static PyMethodDef console_methods[] = {
+    {"load_rom", console_load_rom, METH_VARARGS, "load_rom(path): load a cartridge and reset"},
+    {"run_frame", console_run_frame, METH_VARARGS, "run_frame(frames=1): emulate whole frames"},
+    {"set_input", console_set_input, METH_VARARGS, "set_input(buttons): BUTTON_* bits held"},
+    {"read_mem", console_read_mem, METH_VARARGS, "read_mem(addr): a byte as the cpu reads it"},
+    {"read_audio", console_read_audio, METH_NOARGS, "read_audio(): stereo int16 samples since the last call"},
+    {"save_state", console_save_state, METH_VARARGS, "save_state(state=None): save into state, or a new one"},
+    {"load_state", console_load_state, METH_VARARGS, "load_state(state)"},
+    {NULL}
+};
+
+static PyGetSetDef console_getset[] = {
+    {"locked_up", console_locked_up, NULL,
+     "None, or where the cpu ran an opcode that doesn't exist and hung for good", NULL},
+    {"framebuffer", console_framebuffer, NULL, "live (144, 160) view of the picture, grey levels", NULL},
+    {"memory", console_memory, NULL,
+     "live view of the 64KB address space as memory holds it. rom and cartridge ram\n"
+     "(0x0000-0x7FFF, 0xA000-0xBFFF) read zero or stale, as do registers worked out on\n"
+     "read: joypad, serial, timer, LY, STAT and sound. Use read_mem for those.", NULL},
+    {NULL}
+};
+
+//———— VecEnv ——————————————————————————————————
+
+static const char* obs_modes[] = {"rgb", "gray", "gray_half"}; // GB_OBS_* order
+
+static PyObject* vecenv_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    static const char* keywords[] = {"path", "count", "frames_per_step", "threads", "boot_frames",
+                                     "obs", "watch", "max_frames", NULL};
+    const char* path;
+    int count;
+    int frames_per_step = 4;
+    int threads = 0;
+    int boot_frames = 0;
+    const char* obs = "rgb";
+    PyObject* watch = NULL;
+    long max_frames = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "si|iiisOl", (char**) keywords, &path, &count,
+                                     &frames_per_step, &threads, &boot_frames, &obs, &watch,
+                                     &max_frames)) {
+        return NULL;
+    }
+    int mode = -1;
+    for (int i = 0; i < 3; i++) {
+        if (!strcmp(obs, obs_modes[i])) {
+            mode = i;
+        }
+    }
+    if (mode < 0) {
+        PyErr_Format(PyExc_ValueError, "obs must be rgb, gray or gray_half, not %s", obs);
+        return NULL;
+    }
+    if (count <= 0) {
+        PyErr_SetString(PyExc_ValueError, "count must be positive");
+        return NULL;
+    }
+    std::vector<uint16_t> addrs;
+    if (watch) {
+        PyObject* seq = PySequence_Fast(watch, "watch must be a sequence of addresses");
+        if (!seq) {
+            return NULL;
+        }
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+            long addr = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+            if (addr < 0 || addr > 0xFFFF) {
+                if (!PyErr_Occurred()) {
+                    PyErr_Format(PyExc_ValueError, "address %ld is outside 0x0000-0xFFFF", addr);
+                }
+                Py_DECREF(seq);
+                return NULL;
+            }
+            addrs.push_back(addr);
+        }
+        Py_DECREF(seq);
+    }
+
+    VecEnv* self = (VecEnv*) type->tp_alloc(type, 0);
+    if (!self) {
+        return NULL;
+    }
+    self->env = gb_vecenv_create(path, count, frames_per_step, threads, boot_frames);
+    if (!self->env) {
+        Py_DECREF(self);
+        PyErr_Format(PyExc_IOError, "could not load %s", path);
+        return NULL;
+    }
+    gb_vecenv_set_obs_mode(self->env, mode);
+    gb_vecenv_watch_ram(self->env, addrs.data(), addrs.size());
+    gb_vecenv_set_max_frames(self->env, max_frames);
+    self->size = count;
+    self->obs_size = gb_vecenv_obs_size(self->env);
+    self->obs = (uint8_t*) PyMem_Calloc(count, self->obs_size);
+    self->dones = (uint8_t*) PyMem_Calloc(count, 1);
+    if (!self->obs || !self->dones) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject*) self;
+}
+
+static void vecenv_dealloc(PyObject* self) {
+    VecEnv* vecenv = (VecEnv*) self;
+    if (vecenv->env) {
+        gb_vecenv_destroy(vecenv->env);
+    }
+    PyMem_Free(vecenv->obs);
+    PyMem_Free(vecenv->dones);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject* vecenv_obs(VecEnv* vecenv) {
+    Py_ssize_t shape[2] = {vecenv->size, (Py_ssize_t) vecenv->obs_size};
+    return make_view((PyObject*) vecenv, vecenv->obs, 2, shape);
+}
+
+static PyObject* vecenv_step(PyObject* self, PyObject* args) {
+    VecEnv* vecenv = (VecEnv*) self;
+    Py_buffer actions;
+    if (!PyArg_ParseTuple(args, "y*", &actions)) {
+        return NULL;
+    }
+    if (actions.len != vecenv->size) {
+        PyErr_Format(PyExc_ValueError, "%d actions needed, got %zd", vecenv->size, actions.len);
+        PyBuffer_Release(&actions);
+        return NULL;
+    }
+    // all the consoles step on the vecenv's threads, python carries on meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    gb_vecenv_step(vecenv->env, (const uint8_t*) actions.buf, vecenv->obs, vecenv->dones);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&actions);
+    Py_ssize_t shape[1] = {vecenv->size};
+    PyObject* obs = vecenv_obs(vecenv);
+    PyObject* dones = make_view(self, vecenv->dones, 1, shape);
+    if (!obs || !dones) {
+        Py_XDECREF(obs);
+        Py_XDECREF(dones);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", obs, dones);
+}
+
+static PyObject* vecenv_reset(PyObject* self, PyObject* args) {
+    VecEnv* vecenv = (VecEnv*) self;
+    Py_BEGIN_ALLOW_THREADS
+    gb_vecenv_reset(vecenv->env, vecenv->obs);
+    Py_END_ALLOW_THREADS
+    return vecenv_obs(vecenv);
+}
+
+static PyObject* vecenv_read_mem(PyObject* self, PyObject* args) {
+    VecEnv* vecenv = (VecEnv*) self;
+    int i;
+    unsigned short addr;
+    if (!PyArg_ParseTuple(args, "iH", &i, &addr)) {
+        return NULL;
+    }
+    if (i < 0 || i >= vecenv->size) {
+        PyErr_SetString(PyExc_IndexError, "no such console");
+        return NULL;
+    }
+    return PyLong_FromLong(gb_vecenv_read_mem(vecenv->env, i, addr));
+}
+
+static Py_ssize_t vecenv_len(PyObject* self) {
+    return ((VecEnv*) self)->size;
+}
+
+static PySequenceMethods vecenv_sequence = {vecenv_len};
+
+static PyMethodDef vecenv_methods[] = {
+    {"step", vecenv_step, METH_VARARGS,
+     "step(actions): hold actions[i] (BUTTON_* bits, one byte each) on console i for\n"
+     "frames_per_step frames. Returns (obs, dones) views of shape (n, obs_size) and (n,),\n"
+     "written over by the next step or reset. A console whose episode ended has started over."},
+    {"reset", vecenv_reset, METH_NOARGS, "reset(): start every episode over, returns obs"},
+    {"read_mem", vecenv_read_mem, METH_VARARGS, "read_mem(i, addr): a byte as console i's cpu reads it"},
+    {NULL}
+};
+
+//———— module ——————————————————————————————————
+
+static PyModuleDef module = {PyModuleDef_HEAD_INIT, "gameboy", "Game Boy emulator core", -1};
+
+PyMODINIT_FUNC PyInit_gameboy(void) {
+    ConsoleType.tp_name = "gameboy.GameBoy";
+    ConsoleType.tp_doc = "GameBoy(path=None): a console, with the rom at path loaded if given";
+    ConsoleType.tp_basicsize = sizeof(Console);
+    ConsoleType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ConsoleType.tp_new = console_new;
+    ConsoleType.tp_init = console_init;
+    ConsoleType.tp_dealloc = console_dealloc;
+    ConsoleType.tp_methods = console_methods;
+    ConsoleType.tp_getset = console_getset;
+
+    StateType.tp_name = "gameboy.State";
+    StateType.tp_basicsize = sizeof(State);
+    StateType.tp_flags = Py_TPFLAGS_DEFAULT;
+    StateType.tp_new = state_new;
+    StateType.tp_dealloc = state_dealloc;
+
+    ViewType.tp_name = "gameboy._View";
+    ViewType.tp_basicsize = sizeof(View);
+    ViewType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ViewType.tp_dealloc = view_dealloc;
+    ViewType.tp_as_buffer = &view_buffer;
+
+    VecEnvType.tp_name = "gameboy.VecEnv";
+    VecEnvType.tp_doc = "VecEnv(path, count, frames_per_step=4, threads=0, boot_frames=0, obs='rgb',\n"
+                        "       watch=(), max_frames=0)\n\n"
+                        "count consoles on one rom, stepped together on a pool of threads. Each\n"
+                        "observation is the picture (obs 'rgb' 160x144x3, 'gray' 160x144 or\n"
+                        "'gray_half' 80x72) followed by the bytes at the watch addresses.\n"
+                        "Episodes start from the state after boot_frames and end after\n"
+                        "max_frames (0 for never).";
+    VecEnvType.tp_basicsize = sizeof(VecEnv);
+    VecEnvType.tp_flags = Py_TPFLAGS_DEFAULT;
+    VecEnvType.tp_new = vecenv_new;
+    VecEnvType.tp_dealloc = vecenv_dealloc;
+    VecEnvType.tp_methods = vecenv_methods;
+    VecEnvType.tp_as_sequence = &vecenv_sequence;
+
+    if (PyType_Ready(&ConsoleType) < 0 || PyType_Ready(&StateType) < 0 || PyType_Ready(&ViewType) < 0 ||
+        PyType_Ready(&VecEnvType) < 0) {
+        return NULL;
+    }
+    PyObject* m = PyModule_Create(&module);
+    if (!m) {
+        return NULL;
+    }
+    Py_INCREF(&ConsoleType);
+    Py_INCREF(&StateType);
+    PyModule_AddObject(m, "GameBoy", (PyObject*) &ConsoleType);
+    PyModule_AddObject(m, "State", (PyObject*) &StateType);
+    Py_INCREF(&VecEnvType);
+    PyModule_AddObject(m, "VecEnv", (PyObject*) &VecEnvType);
+    PyModule_AddIntConstant(m, "BUTTON_RIGHT", GB_BUTTON_RIGHT);
+    PyModule_AddIntConstant(m, "BUTTON_LEFT", GB_BUTTON_LEFT);
+    PyModule_AddIntConstant(m, "BUTTON_UP", GB_BUTTON_UP);
+    PyModule_AddIntConstant(m, "BUTTON_DOWN", GB_BUTTON_DOWN);
+    PyModule_AddIntConstant(m, "BUTTON_A", GB_BUTTON_A);
+    PyModule_AddIntConstant(m, "BUTTON_B", GB_BUTTON_B);
+    PyModule_AddIntConstant(m, "BUTTON_SELECT", GB_BUTTON_SELECT);
+    PyModule_AddIntConstant(m, "BUTTON_START", GB_BUTTON_START);
+    return m;
+}
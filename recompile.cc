@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include "gameboy.h"
+#include "cfg.h"
+#include "aot.h"
+
+// writes C++ for every basic block of a rom's control flow graph (see aot.h),
+// to be compiled into a binary for that rom: make aot ROM=game.gb
+// usage: gb-recompile <rom> [--out <path>]
+// The graph is read from game.cfg next to the rom, and made and saved there
+// first when missing or out of date. Output goes to game.aot.cc by default.
+
+typedef std::string string;
+
+// the flag and value that jumps, calls and returns test, by condition code
+static const char* conditions[4][2] = {
+    {"(cpu.F >> 7) & 1", "false"}, // nz
+    {"(cpu.F >> 7) & 1", "true"},  // z
+    {"(cpu.F >> 4) & 1", "false"}, // nc
+    {"(cpu.F >> 4) & 1", "true"},  // c
+};
+
+static string format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static string format(const char* fmt, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    return text;
+}
+
+// whether the units could tell an access to addr happened, or when: all
+// but rom, work ram and high ram, and writes to rom switch banks
+static bool seen(WORD addr, bool write) {
+    if (addr < 0x8000) {
+        return write;
+    }
+    return !((addr >= 0xC000 && addr < 0xFE00) || (addr >= 0xFF80 && addr < 0xFFFF));
+}
+
+// the statement exec() would run for the instruction at code, operands and
+// all. reads and writes are set when it may load or store where the units
+// could see (above): anywhere through a register pair or the stack.
+static string instruction(const BYTE* code, bool& reads, bool& writes) {
+    BYTE op = code[0];
+    BYTE n = code[1];
+    WORD nn = code[1] | (code[2] << 8);
+    int r = (op >> 3) & 7;  // the register in bits 3-5
+    int rr = (op >> 4) & 3; // the pair in bits 4-5
+    int cc = (op >> 3) & 3;
+    reads = writes = false;
+    if (op >= 0x40 && op < 0x80 && op != 0x76) {
+        reads = (op & 7) == 6;
+        writes = r == 6;
+        return format("cpu.ld_r_r(%d, %d);", r, op & 7);
+    }
+    if (op >= 0x80 && op < 0xC0) {
+        static const char* alu[8] = {"add_r(0, %d)", "add_r(1, %d)", "sub_r(0, %d)", "sub_r(1, %d)",
+                                     "bit_and(%d)", "bit_xor(%d)", "bit_or(%d)", "cp_r(%d)"};
+        reads = (op & 7) == 6;
+        return "cpu." + format(alu[r], op & 7) + ";";
+    }
+    switch (op & 0xC7) {
+        case 0x04:
+            reads = writes = r == 6;
+            return format("cpu.inc_r(%d);", r);
+        case 0x05:
+            reads = writes = r == 6;
+            return format("cpu.dec_r(%d);", r);
+        case 0x06:
+            writes = r == 6;
+            return format("cpu.ld_r_imm(%d, 0x%02X);", r, n);
+        case 0xC7:
+            writes = true;
+            return format("cpu.restart(0x%02X);", op & 0x38);
+    }
+    switch (op & 0xCF) {
+        case 0x01:
+            return format("cpu.ld_rr_nn(%d, 0x%04X);", rr, nn);
+        case 0x02:
+            writes = true;
+            return format("cpu.ld_r16mem_a(%d);", rr);
+        case 0x03:
+            return format("cpu.inc_r16(%d);", rr);
+        case 0x09:
+            return format("cpu.add_r16(%d);", rr);
+        case 0x0A:
+            reads = true;
+            return format("cpu.ld_a_r16mem(%d);", rr);
+        case 0x0B:
+            return format("cpu.dec_r16(%d);", rr);
+        case 0xC1:
+            reads = true;
+            return format("cpu.pop_rr(%d);", rr);
+        case 0xC5:
+            writes = true;
+            return format("cpu.push_rr(%d);", rr);
+    }
+    switch (op) {
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            return format("cpu.jump_relative(true, %s, %s, %d);", conditions[cc][0], conditions[cc][1],
+                          (SIGNED_BYTE) n);
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+            reads = true;
+            return format("cpu.ret(true, %s, %s);", conditions[cc][0], conditions[cc][1]);
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+            return format("cpu.jump(true, %s, %s, 0x%04X);", conditions[cc][0], conditions[cc][1], nn);
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC:
+            writes = true;
+            return format("cpu.call(true, %s, %s, 0x%04X);", conditions[cc][0], conditions[cc][1], nn);
+        case 0x00: return "cpu.cycles = 1; cpu.PC += 1;";
+        case 0x07: return "cpu.rlca();";
+        case 0x08:
+            writes = seen(nn, true) || seen(nn + 1, true);
+            return format("cpu.ld_nn_sp(0x%04X);", nn);
+        case 0x0F: return "cpu.rrca();";
+        case 0x10: return "cpu.stop();";
+        case 0x17: return "cpu.rla();";
+        case 0x18: return format("cpu.jump_relative(false, 0, false, %d);", (SIGNED_BYTE) n);
+        case 0x1F: return "cpu.rra();";
+        case 0x27: return "cpu.daa();";
+        case 0x2F: return "cpu.cpl();";
+        case 0x37: return "cpu.scf();";
+        case 0x3F: return "cpu.ccf();";
+        case 0x76: return "cpu.halt();";
+        case 0xC3: return format("cpu.jump(false, 0, false, 0x%04X);", nn);
+        case 0xC6: return format("cpu.add_imm(0, 0x%02X);", n);
+        case 0xC9:
+            reads = true;
+            return "cpu.ret(false, 0, false);";
+        case 0xCD:
+            writes = true;
+            return format("cpu.call(false, 0, false, 0x%04X);", nn);
+        case 0xCE: return format("cpu.add_imm(1, 0x%02X);", n);
+        case 0xD6: return format("cpu.sub_imm(0, 0x%02X);", n);
+        case 0xD9:
+            reads = true;
+            return "cpu.reti();";
+        case 0xDE: return format("cpu.sub_imm(1, 0x%02X);", n);
+        case 0xE0:
+            writes = seen(0xFF00 + n, true);
+            return format("cpu.ldh_n_a(0x%02X);", n);
+        case 0xE2:
+            writes = true;
+            return "cpu.ld_c_a();";
+        case 0xE6: return format("cpu.and_imm(0x%02X);", n);
+        case 0xE8: return format("cpu.add_sp(%d);", (SIGNED_BYTE) n);
+        case 0xE9: return "cpu.cycles = 1; cpu.PC = cpu.HL;";
+        case 0xEA:
+            writes = seen(nn, true);
+            return format("cpu.ld_nn_a(0x%04X);", nn);
+        case 0xEE: return format("cpu.xor_imm(0x%02X);", n);
+        case 0xF0:
+            reads = seen(0xFF00 + n, false);
+            return format("cpu.ldh_a_n(0x%02X);", n);
+        case 0xF2:
+            reads = true;
+            return "cpu.ld_a_c();";
+        case 0xF3: return "cpu.IME = 0; cpu.PC += 1; cpu.cycles = 1;";
+        case 0xF6: return format("cpu.or_imm(0x%02X);", n);
+        case 0xF8: return format("cpu.ld_hl_sp(%d);", (SIGNED_BYTE) n);
+        case 0xF9: return "cpu.cycles = 2; cpu.SP = cpu.HL; cpu.PC += 1;";
+        case 0xFA:
+            reads = seen(nn, false);
+            return format("cpu.ld_a_nn(0x%04X);", nn);
+        case 0xFB: return "cpu.IME_next = 1; cpu.PC += 1; cpu.cycles = 1;";
+        case 0xFE: return format("cpu.cp_imm(0x%02X);", n);
+        case 0xCB: {
+            // exec() steps over the prefix first, the helper over the rest
+            int reg = n & 7, bit = (n >> 3) & 7;
+            static const char* shifts[8] = {"rotate_left_circular", "rotate_right_circular", "rotate_left",
+                                            "rotate_right", "sla", "sra", "swap", "srl"};
+            reads = reg == 6;
+            writes = reg == 6 && (n < 0x40 || n >= 0x80);
+            if (n < 0x40) {
+                return format("cpu.PC += 1; cpu.%s(%d);", shifts[bit], reg);
+            }
+            static const char* bits[4] = {nullptr, "test_bit", "reset_bit", "set_bit"};
+            return format("cpu.PC += 1; cpu.%s(%d, %d);", bits[n >> 6], bit, reg);
+        }
+    }
+    return "";
+}
+
+static string block_name(CodeAddr at) {
+    return format("block_%02X_%04X", code_bank(at), code_pc(at));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <rom> [--out <path>]\n", argv[0]);
+        return 1;
+    }
+    string rom_name = argv[1];
+    string base = rom_name.substr(0, rom_name.find_last_of('.'));
+    string out_name = base + ".aot.cc";
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            out_name = argv[++i];
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::shared_ptr<std::vector<BYTE>> rom = GameBoy::read_rom(rom_name);
+    if (!rom) {
+        return 1;
+    }
+    const BYTE* image = rom->data();
+    size_t rom_size = rom->size();
+    string cfg_name = base + ".cfg";
+    std::unique_ptr<ControlFlowGraph> cfg = ControlFlowGraph::load(cfg_name, image, rom_size);
+    if (!cfg) {
+        cfg = ControlFlowGraph::analyze(image, rom_size);
+        cfg->save(cfg_name);
+    }
+
+    FILE* out = fopen(out_name.c_str(), "w");
+    if (!out) {
+        perror(out_name.c_str());
+        return 1;
+    }
+    string short_name = rom_name.substr(rom_name.find_last_of('/') + 1);
+    fprintf(out, "// recompiled from %s by gb-recompile, do not edit\n", short_name.c_str());
+    fprintf(out, "#include \"aot.h\"\n");
+
+    // bank -> address -> function
+    std::map<int, std::map<WORD, string>> blocks;
+    long instructions = 0;
+    for (const auto& entry : cfg->blocks) {
+        const BasicBlock& block = entry.second;
+        int bank = code_bank(block.start);
+        WORD pc = code_pc(block.start);
+        if (block.exit == EXIT_INVALID) {
+            continue; // the interpreter stops there
+        }
+        string name = block_name(block.start);
+        fprintf(out, "\n// %d instructions\n", block.instructions);
+        fprintf(out, "static int %s(GameBoy& gb, AotRun& run) {\n", name.c_str());
+        fprintf(out, "    CPU& cpu = gb.cpu;\n");
+        for (int i = 0; i < block.instructions; i++) {
+            size_t offset = pc < 0x4000 ? pc : bank * 0x4000 + (pc - 0x4000);
+            const BYTE* code = image + offset;
+            int length = instruction_length(code[0]);
+            BYTE bytes[3] = {code[0], 0, 0};
+            memcpy(bytes, code, std::min<size_t>(length, rom_size - offset));
+            bool reads, writes;
+            string statement = instruction(bytes, reads, writes);
+            string listing;
+            for (int b = 0; b < length; b++) {
+                listing += format(" %02X", bytes[b]);
+            }
+            if ((reads || writes) && i > 0) {
+                fprintf(out, "    aot_sync(gb, run);\n");
+            }
+            fprintf(out, "    %s // %04X%s\n", statement.c_str(), pc, listing.c_str());
+            pc += length;
+            if (i + 1 < block.instructions) {
+                // ei is followed by a look at interrupts like a write
+                bool wrote = writes || bytes[0] == 0xFB;
+                fprintf(out, "    if (!aot_next<%s>(gb, run, 0x%04X)) return -1;\n", wrote ? "true" : "false", pc);
+            }
+            instructions++;
+        }
+        fprintf(out, "    return aot_last(cpu, run);\n}\n");
+        blocks[bank][code_pc(block.start)] = name;
+    }
+
+    for (const auto& bank : blocks) {
+        fprintf(out, "\nstatic AotBlock find_%02X(WORD pc) {\n    switch (pc) {\n", bank.first);
+        for (const auto& block : bank.second) {
+            fprintf(out, "        case 0x%04X: return %s;\n", block.first, block.second.c_str());
+        }
+        fprintf(out, "    }\n    return nullptr;\n}\n");
+    }
+    fprintf(out, "\nstatic AotBlock find(int bank, WORD pc) {\n    switch (bank) {\n");
+    size_t count = 0;
+    for (const auto& bank : blocks) {
+        fprintf(out, "        case %d: return find_%02X(pc);\n", bank.first, bank.first);
+        count += bank.second.size();
+    }
+    fprintf(out, "    }\n    return nullptr;\n}\n");
+    fprintf(out, "\nstatic const AotTranslation translation = {\"%s\", %zu, 0x%016llXULL, %zu, find};\n",
+            short_name.c_str(), rom_size, (unsigned long long) aot_rom_hash(image, rom_size), count);
+    fprintf(out, "static AotRegistration registration(translation);\n");
+    bool ok = !ferror(out);
+    fclose(out);
+    if (!ok) {
+        perror(out_name.c_str());
+        return 1;
+    }
+    printf("%s: %zu blocks, %ld instructions written to %s\n", rom_name.c_str(), count, instructions,
+           out_name.c_str());
+    return 0;
+}
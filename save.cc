@@ -0,0 +1,112 @@
+#include "save.h"
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SAVE_POLL_MS 100
+
+std::unique_ptr<SaveFile> SaveFile::open(const std::string& path, size_t size, BYTE* ram) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path.c_str());
+        return nullptr;
+    }
+    // grow (zero filled) or keep a save that is bigger than the header says
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t) st.st_size < size && ftruncate(fd, size) < 0)) {
+        perror(path.c_str());
+        close(fd);
+        return nullptr;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return nullptr;
+    }
+    memcpy(ram, map, size);
+    // a lock of its own for each open, so consoles of this process exclude each other too
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        printf("%s is in use, this console's saves won't be kept\n", path.c_str());
+        munmap(map, size);
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<SaveFile>(new SaveFile(fd, (BYTE*) map, size));
+}
+
+SaveFile::SaveFile(int fd, BYTE* data, size_t size) : size(size), fd(fd), data(data) {
+    flusher = std::thread(&SaveFile::run, this);
+}
+
+SaveFile::~SaveFile() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    flusher.join();
+    flush();
+    munmap(data, size);
+    close(fd);
+}
+
+void SaveFile::commit(const BYTE* ram) {
+    uint64_t pages = 0;
+    for (size_t offset = 0; offset < size; offset += SAVE_PAGE_SIZE) {
+        size_t len = std::min((size_t) SAVE_PAGE_SIZE, size - offset);
+        if (memcmp(data + offset, ram + offset, len) != 0) {
+            memcpy(data + offset, ram + offset, len);
+            pages |= 1ull << ((offset / SAVE_PAGE_SIZE) & 63);
+        }
+    }
+    if (pages) {
+        dirty.fetch_or(pages, std::memory_order_relaxed);
+        // single writer, no need for a locked add
+        commits.store(commits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+void SaveFile::flush() {
+    sync(dirty.exchange(0));
+}
+
+void SaveFile::sync(uint64_t pages) {
+    if (!pages) {
+        return;
+    }
+    size_t page_count = (size + SAVE_PAGE_SIZE - 1) / SAVE_PAGE_SIZE;
+    for (size_t page = 0; page < page_count; page++) {
+        if (pages & (1ull << (page & 63))) {
+            size_t len = std::min((size_t) SAVE_PAGE_SIZE, size - page * SAVE_PAGE_SIZE);
+            msync(data + page * SAVE_PAGE_SIZE, len, MS_SYNC);
+        }
+    }
+}
+
+void SaveFile::run() {
+    uint64_t last_commits = 0;
+    int quiet_ms = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, std::chrono::milliseconds(SAVE_POLL_MS));
+        uint64_t count = commits.load(std::memory_order_relaxed);
+        if (count != last_commits) {
+            last_commits = count;
+            quiet_ms = 0;
+            continue;
+        }
+        quiet_ms += SAVE_POLL_MS;
+        if (quiet_ms >= SAVE_QUIET_MS && dirty.load(std::memory_order_relaxed)) {
+            guard.unlock();
+            flush();
+            guard.lock();
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "cpu.h"
+
+#define SAVE_PAGE_SIZE 4096
+#define SAVE_QUIET_MS 1000 // flush once the game has stopped saving for this long
+
+// battery ram saved through a shared mapping of the save file. The console
+// runs on ram of its own and hands it over with commit() at the end of
+// frames nothing will take back, so run-ahead and rollback never reach the
+// file; stores land in the page cache then, so even a crash keeps them, and
+// a background thread pushes changed pages to disk once commits have gone
+// quiet. A save file is locked to one console in any process, the others
+// only start from what it holds.
+class SaveFile {
+    public:
+        // read the save at path into size bytes of ram, creating it if need
+        // be. Null after printing why, or when another console has it: ram
+        // is read just the same but nothing stored in it is kept.
+        static std::unique_ptr<SaveFile> open(const std::string& path, size_t size, BYTE* ram);
+        ~SaveFile();
+
+        // note a store to the console's ram, from the emulation thread
+        inline void mark() { written++; }
+        // whether ram was stored to since this was last asked
+        bool changed() {
+            bool any = written != seen;
+            seen = written;
+            return any;
+        }
+        // make the file hold ram (of size bytes), from the emulation thread
+        void commit(const BYTE* ram);
+        // write everything committed out now and wait for it, for exit
+        void flush();
+
+        size_t size;
+
+    private:
+        SaveFile(int fd, BYTE* data, size_t size);
+        void run();
+        void sync(uint64_t pages);
+
+        int fd;
+        BYTE* data; // the mapping
+        uint64_t written = 0;
+        uint64_t seen = 0;
+        // one bit per page, wrapping for ram bigger than 256KB
+        std::atomic<uint64_t> dirty{0};
+        std::atomic<uint64_t> commits{0};
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stopping = false;
+        std::thread flusher;
+};
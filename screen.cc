@@ -4,33 +4,36 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
-#include "lcd.h"
 #include <stdlib.h>
+#include <cstring>
 #include <string>
-#include "cpu.h"
-#include "ppu.h"
+#include "gameboy.h"
+#include "netplay.h"
 
 static const int windowWidth = 160*2;
 static const int windowHeight = 144*2;
 
-#define CYCLES_PER_FRAME 70221*2
-#define FPS 59.73/2
-
 #define VERTICAL_BLANK_SCAN_LINE 0x90
 #define VERTICAL_BLANK_SCAN_LINE_MAX 0x99
 #define RETRACE_START 456
-#define MAX_ROM_SIZE 0x200000
 
 typedef std::string string;
 
-CPU cpu;
-LCD lcd;
-PPU ppu;
-int cycles_this_update = 0;
-bool saving;
+GameBoy gb;
+GameBoy partner; // the other player's console in netplay
+std::unique_ptr<Netplay> net;
+BYTE pad = 0xFF; // joypad for netplay, which applies it itself
+bool sound = true;
+int latency_ms = 60;
+int audio_chunk = 0; // ring entries the device takes per callback
+int run_ahead = 0; // frames
+bool render_thread = false;
+string link_listen, link_connect;
+int net_player = 0, net_port = 0, net_latency = 0;
+string net_peer, net_rom;
 
 void init_screen() {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         printf("Failed to initialize SDL: %s\n", SDL_GetError());
         exit(1);
     }
@@ -76,96 +79,86 @@ void render_game() {
 	glPixelZoom(2, -2);
     if (count < 2) {
         glRasterPos2i(0, 0);
-        glDrawPixels(160, 144, GL_RGB, GL_UNSIGNED_BYTE, cpu.screen); // SCREEN DATA GOES HERE
+        glDrawPixels(160, 144, GL_LUMINANCE, GL_UNSIGNED_BYTE, gb.cpu.screen); // SCREEN DATA GOES HERE
         if (count) {
-            minX = cpu.dirtyMinX;
-            maxX = cpu.dirtyMaxX;
-            minY = cpu.dirtyMinY;
-            maxY = cpu.dirtyMaxY;
+            minX = gb.cpu.dirtyMinX;
+            maxX = gb.cpu.dirtyMaxX;
+            minY = gb.cpu.dirtyMinY;
+            maxY = gb.cpu.dirtyMaxY;
         }
         count++;
     } else {
-        int tempMinX = std::min(minX, cpu.dirtyMinX);
-        int tempMaxX = std::max(maxX, cpu.dirtyMaxX);
-        int tempMinY = std::min(minY, cpu.dirtyMinY);
-        int tempMaxY = std::max(maxY, cpu.dirtyMaxY);
-        minX = cpu.dirtyMinX;
-        maxX = cpu.dirtyMaxX;
-        minY = cpu.dirtyMinY;
-        maxY = cpu.dirtyMaxY;
+        int tempMinX = std::min(minX, gb.cpu.dirtyMinX);
+        int tempMaxX = std::max(maxX, gb.cpu.dirtyMaxX);
+        int tempMinY = std::min(minY, gb.cpu.dirtyMinY);
+        int tempMaxY = std::max(maxY, gb.cpu.dirtyMaxY);
+        minX = gb.cpu.dirtyMinX;
+        maxX = gb.cpu.dirtyMaxX;
+        minY = gb.cpu.dirtyMinY;
+        maxY = gb.cpu.dirtyMaxY;
         int width = tempMaxX - tempMinX + 1;
         int height = tempMaxY - tempMinY + 1;
         if (width > 0 && height > 0) {
-            dirtyRect.resize(height * width * 3);
+            dirtyRect.resize(height * width);
             for (int i = tempMinY; i <= tempMaxY; i++) {
-                for (int j = tempMinX; j <= tempMaxX; j++) {
-                    int idx = ((i - tempMinY) * width + (j - tempMinX)) * 3;
-                    dirtyRect[idx] = cpu.screen[i][j][0];
-                    dirtyRect[idx + 1] = cpu.screen[i][j][1];
-                    dirtyRect[idx + 2] = cpu.screen[i][j][2];
-                }
+                memcpy(&dirtyRect[(i - tempMinY) * width], &gb.cpu.screen[i][tempMinX], width);
             }
             glRasterPos2i(tempMinX, tempMinY);
-            glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, dirtyRect.data());
+            glDrawPixels(width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, dirtyRect.data());
         }
     }
     SDL_GL_SwapBuffers();
-    cpu.resetDirty();
+    gb.cpu.resetDirty();
 }
 
-void emulator_update() {
-    int cycle_cnt = 0;
-    while (cycle_cnt < CYCLES_PER_FRAME) {
-        // BYTE rmpc = cpu.read_mem(cpu.PC);
-        // BYTE rmpc1 = cpu.read_mem(cpu.PC + 1);
-        // BYTE rmpc2 = cpu.read_mem(cpu.PC + 2);
-        // BYTE rmpc3 = cpu.read_mem(cpu.PC + 3);
-        // if(!cpu.halted) fprintf(stderr, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n", cpu.A, cpu.F, cpu.B, cpu.C, cpu.D, cpu.E, cpu.H, cpu.L, cpu.SP, cpu.PC, rmpc, rmpc1, rmpc2, rmpc3);
-        int interrupt_cycles = cpu.check_interrupts();
-        if(cpu.IME_next){
-            cpu.IME = true;
-            cpu.IME_next = false;
+bool emulator_update() {
+    if (net) {
+        if (!net->run_frame(pad)) {
+            return false;
         }
-        int curr_cycles = cpu.exec() + interrupt_cycles;
-        lcd.update(cpu, ppu, curr_cycles);
-
-        cpu.update_timers(curr_cycles);
-        cycle_cnt += curr_cycles;
+        partner.audio.pop(nullptr, partner.audio.size());
+    } else {
+        gb.run_ahead(run_ahead);
+    }
+    static bool hung = false;
+    if (gb.cpu.locked && !hung) { // the picture stays as it was, as on the real thing
+        hung = true;
+        printf("the cpu hung on opcode 0x%02X at 0x%04X, which doesn't exist\n",
+               gb.cpu.peek(gb.cpu.locked_at), gb.cpu.locked_at);
     }
     render_game();
+    return true;
 }
 
-
-bool load_rom(const string& rom_name) {
-    BYTE rom[MAX_ROM_SIZE];
-    saving = rom_name == "red.gb";
-    FILE* fin;
-    fin = fopen(rom_name.c_str(), "rb");
-    size_t read_count = fread(rom, 1, MAX_ROM_SIZE, fin);
-    if (read_count != MAX_ROM_SIZE) {
-        if (ferror(fin)) {
-            printf("Error reading file\n");
-            exit(1);
-        }
+// runs on the SDL audio thread, the consumer side of the sample ring
+void audio_callback(void* userdata, Uint8* stream, int len) {
+    int16_t* out = (int16_t*) stream;
+    size_t count = len / sizeof(int16_t);
+    size_t got = gb.audio.pop(out, count);
+    if (got < count) {
+        memset(out + got, 0, (count - got) * sizeof(int16_t)); // underrun
     }
-    fclose(fin);
-
-
-    cpu = CPU(rom);
-    if(saving){
-        fin = fopen("red.sav", "rb");
-
-        if (fin) {
-            fread(cpu.ram, 1, 0x8000, fin);
-            fclose(fin);
-        } else {
-            memset(cpu.ram, 0, 0x8000);
-        }
-    } 
-    lcd = LCD();
-    ppu = PPU();
+}
 
-    return true;
+void init_audio() {
+    SDL_AudioSpec spec;
+    spec.freq = SAMPLE_RATE;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = AUDIO_CHANNELS;
+    // keep the device's own buffer well under the requested latency
+    spec.samples = 256;
+    while (spec.samples < 2048 && spec.samples * 2 * 3 * 1000 <= SAMPLE_RATE * latency_ms) {
+        spec.samples *= 2;
+    }
+    spec.callback = audio_callback;
+    spec.userdata = NULL;
+    if (SDL_OpenAudio(&spec, NULL) < 0) {
+        printf("Failed to open audio: %s\n", SDL_GetError());
+        sound = false;
+        return;
+    }
+    audio_chunk = spec.samples * AUDIO_CHANNELS;
+    SDL_PauseAudio(0);
 }
 
 
@@ -201,44 +194,66 @@ int get_key(int code) {
     }
 }
 
+// handle the window's events, false once it's closed
+bool handle_events() {
+    SDL_Event event;
+    while(SDL_PollEvent(&event)) {
+        int key_code;
+        switch(event.type) {
+            case SDL_QUIT:
+                return false;
+            case SDL_KEYDOWN:
+                key_code = get_key(event.key.keysym.sym);
+                if(key_code >= 0 && net)
+                    pad &= ~(1 << key_code);
+                else if(key_code >= 0)
+                    gb.cpu.key_pressed(key_code);
+                break;
+            case SDL_KEYUP:
+                key_code = get_key(event.key.keysym.sym);
+                if(key_code >= 0 && net)
+                    pad |= 1 << key_code;
+                else if(key_code >= 0)
+                    gb.cpu.key_released(key_code);
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
 void game_loop() {
     bool quit = false;
-    SDL_Event event;
     
-    std::chrono::milliseconds frame_dur((int)(1000.0 / FPS));
+    RateControl rate(latency_ms, audio_chunk);
+    auto frame_dur = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / (FPS)));
+    auto next_frame = std::chrono::steady_clock::now();
     while(!quit) {
-        while(SDL_PollEvent(&event)) {
-            int key_code;
-            switch(event.type) {
-                case SDL_QUIT:
-                    quit = true;
-                    break;
-                case SDL_KEYDOWN:
-                    key_code = get_key(event.key.keysym.sym);
-                    if(key_code >= 0)
-                        cpu.key_pressed(key_code);
-                    break;
-                case SDL_KEYUP:
-                    key_code = get_key(event.key.keysym.sym);
-                    if(key_code >= 0)
-                        cpu.key_released(key_code);
-                    break;
-                default:
-                    break;
-            }
-        }
-        
+        quit = !handle_events();
         if(quit) break;
 
-        auto frameStart = std::chrono::steady_clock::now();
-        emulator_update();
-        auto frameEnd = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(frameEnd - frameStart);
-        if (elapsed < frame_dur) {
-            std::this_thread::sleep_for(frame_dur - elapsed);
+        if (sound) {
+            // the audio device is the clock: wait for it to drain the ring to
+            // the target latency, then nudge the resampling ratio by how far
+            // off the fill was so the two clocks never drift apart
+            while (gb.audio.size() > rate.target() && !quit) {
+                std::this_thread::sleep_for(std::chrono::microseconds(250));
+                quit = !handle_events(); // the window stays responsive however long the device takes
+            }
+            if (quit) break;
+            gb.apu.set_rate_ratio(rate.ratio(gb.audio.size()));
+            quit = !emulator_update();
+        } else {
+            // no device, pace against absolute deadlines so rounding never accumulates
+            quit = !emulator_update();
+            next_frame += frame_dur;
+            auto now = std::chrono::steady_clock::now();
+            if (next_frame < now) {
+                next_frame = now; // fell behind, don't try to catch up
+            }
+            std::this_thread::sleep_until(next_frame);
         }
-        // string temp;
-        // std::getline(std::cin, temp);
     }
 }
 
@@ -247,20 +262,64 @@ int main(int argc, char** argv) {
         std::cerr << "No ROM name provided" << std::endl;
         return 1;
     }
+    for (int i = 2; i < argc; i++) {
+        if (string(argv[i]) == "--mute") {
+            sound = false;
+        } else if (string(argv[i]) == "--latency" && i + 1 < argc) {
+            latency_ms = atoi(argv[++i]);
+        } else if (string(argv[i]) == "--run-ahead" && i + 1 < argc) {
+            run_ahead = atoi(argv[++i]);
+        } else if (string(argv[i]) == "--netplay" && i + 4 < argc) {
+            net_player = atoi(argv[++i]);
+            net_port = atoi(argv[++i]);
+            net_peer = argv[++i];
+            net_rom = argv[++i];
+        } else if (string(argv[i]) == "--net-latency" && i + 1 < argc) {
+            net_latency = atoi(argv[++i]);
+        } else if (string(argv[i]) == "--render-thread") {
+            render_thread = true;
+        } else if (string(argv[i]) == "--link-listen" && i + 1 < argc) {
+            link_listen = argv[++i];
+        } else if (string(argv[i]) == "--link-connect" && i + 1 < argc) {
+            link_connect = argv[++i];
+        }
+    }
     init_screen();
-    load_rom(argv[1]);
-    game_loop();
-    // SDL_Delay(3000);
-    if(saving){
-        FILE* fout;
-        fout = fopen("red.sav", "wb");
-        if (fout) {
-            fwrite(cpu.ram, 1, 0x8000, fout);
-            fclose(fout);
-        } else {
-            printf("Error writing save file\n");
+    if (!gb.load_rom(argv[1])) {
+        return 1;
+    }
+    gb.set_render_thread(render_thread);
+    if (net_player == 1 || net_player == 2) {
+        // player 1's console comes first on both ends
+        if (!partner.load_rom(net_rom)) {
+            return 1;
+        }
+        partner.apu.output = nullptr;
+        partner.ppu.skip = true;
+        GameBoy* consoles[2] = {&gb, &partner};
+        if (net_player == 2) {
+            std::swap(consoles[0], consoles[1]);
+        }
+        net = Netplay::open(consoles, net_player - 1, net_port, net_peer, net_latency);
+        if (!net) {
+            return 1;
         }
+    } else if (!link_listen.empty()) {
+        gb.serial.link = UnixSocketLink::listen(link_listen);
+    } else if (!link_connect.empty()) {
+        gb.serial.link = UnixSocketLink::connect(link_connect);
+    }
+    if (gb.serial.link) {
+        run_ahead = 0; // the other end can't be taken back
+    }
+    if (sound) {
+        init_audio();
+    }
+    game_loop();
+    if (sound) {
+        SDL_CloseAudio();
     }
+    gb.save_ram();
     SDL_Quit( ) ;
     return 0;
 }
@@ -0,0 +1,231 @@
+#include "serial.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LINK_TIMEOUT_MS 500 // give up on a silent partner, the byte reads as 0xFF
+#define MSG_CLOCK 'M'       // master clocked a byte out
+#define MSG_REPLY 'R'       // slave's byte shifted back, with the clock's number
+#define MSG_SIZE 3          // tag, transfer number, byte
+
+void Serial::reset() {
+    sb = 0x00;
+    sc = 0x00;
+    out = 0xFF;
+    remaining = 0;
+    poll_delay = 0;
+    irq = false;
+}
+
+BYTE Serial::read(WORD addr) {
+    if (addr == 0xFF01) {
+        return sb;
+    }
+    return sc | 0b01111110;
+}
+
+void Serial::write(WORD addr, BYTE data) {
+    if (addr == 0xFF01) {
+        sb = data;
+        return;
+    }
+    sc = data & 0b10000001;
+    if ((sc & 0b10000001) == 0b10000001) { // start on the internal clock
+        remaining = SERIAL_TRANSFER_CYCLES;
+        out = sb;
+        if (link) {
+            link->start(sb);
+        }
+    }
+}
+
+BYTE Serial::clock_external(BYTE in) {
+    // the shift register moves whether or not a transfer was armed, but only
+    // an armed port completes and interrupts
+    BYTE shifted = sb;
+    sb = in;
+    if ((sc & 0b10000001) == 0b10000000) {
+        sc &= 0b01111111;
+        irq = true;
+    }
+    return shifted;
+}
+
+void Serial::copy_state(const Serial& other) {
+    sb = other.sb;
+    sc = other.sc;
+    out = other.out;
+    remaining = other.remaining;
+    poll_delay = other.poll_delay;
+    irq = other.irq;
+}
+
+void Serial::poll() {
+    if (link) {
+        link->poll(*this);
+        link->flush();
+    }
+}
+
+void Serial::step(CPU& cpu, int cycles) {
+    if (irq) {
+        irq = false;
+        cpu.interrupt(3);
+    }
+    if ((sc & 0b10000001) == 0b10000001) {
+        remaining -= cycles;
+        if (remaining <= 0) {
+            BYTE in = 0xFF; // nothing connected reads as 0xFF
+            if (link && !link->finish(*this, in)) {
+                remaining = SERIAL_POLL_CYCLES; // not back yet, look again a bit time later
+                return;
+            }
+            sb = in;
+            sc &= 0b01111111;
+            cpu.interrupt(3);
+        }
+    } else if ((sc & 0b10000000) && link) {
+        // armed on the external clock, check for the other end every bit time
+        poll_delay -= cycles;
+        if (poll_delay <= 0) {
+            poll_delay = SERIAL_POLL_CYCLES;
+            link->poll(*this);
+        }
+    }
+}
+
+bool LocalLink::finish(Serial& port, BYTE& in) {
+    in = peer->clock_external(port.outgoing());
+    return true;
+}
+
+void connect_local(Serial& a, Serial& b) {
+    a.link.reset(new LocalLink(&b));
+    b.link.reset(new LocalLink(&a));
+}
+
+std::unique_ptr<UnixSocketLink> UnixSocketLink::listen(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        perror("socket");
+        return nullptr;
+    }
+    unlink(path.c_str());
+    if (bind(server, (sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(server, 1) < 0) {
+        perror("bind");
+        close(server);
+        return nullptr;
+    }
+    printf("Waiting for link partner on %s\n", path.c_str());
+    int fd = accept(server, NULL, NULL);
+    close(server);
+    unlink(path.c_str());
+    if (fd < 0) {
+        perror("accept");
+        return nullptr;
+    }
+    return std::unique_ptr<UnixSocketLink>(new UnixSocketLink(fd));
+}
+
+std::unique_ptr<UnixSocketLink> UnixSocketLink::connect(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return nullptr;
+    }
+    if (::connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<UnixSocketLink>(new UnixSocketLink(fd));
+}
+
+UnixSocketLink::~UnixSocketLink() {
+    close(fd);
+}
+
+void UnixSocketLink::flush() {
+    size_t sent = 0;
+    while (sent < outbox.size()) {
+        ssize_t n = send(fd, outbox.data() + sent, outbox.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; // partner went away, transfers will time out to 0xFF
+        }
+        sent += n;
+    }
+    outbox.clear();
+}
+
+// read everything that has arrived, without waiting
+void UnixSocketLink::receive() {
+    if (inbox_pos == inbox.size()) {
+        inbox.clear();
+        inbox_pos = 0;
+    }
+    BYTE buf[512];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        inbox.insert(inbox.end(), buf, buf + n);
+    }
+}
+
+void UnixSocketLink::read_inbox(Serial& port) {
+    receive();
+    while (inbox.size() - inbox_pos >= MSG_SIZE) {
+        BYTE tag = inbox[inbox_pos];
+        BYTE number = inbox[inbox_pos + 1];
+        BYTE data = inbox[inbox_pos + 2];
+        inbox_pos += MSG_SIZE;
+        if (tag == MSG_CLOCK) {
+            // clocked by the other end (maybe as this end started too)
+            outbox.push_back(MSG_REPLY);
+            outbox.push_back(number);
+            outbox.push_back(port.clock_external(data));
+        } else if (waiting && number == transfer) {
+            replied = true;
+            reply = data;
+        } // else the reply to a transfer that already timed out
+    }
+}
+
+void UnixSocketLink::start(BYTE out) {
+    transfer++;
+    waiting = true;
+    replied = false;
+    outbox.push_back(MSG_CLOCK);
+    outbox.push_back(transfer);
+    outbox.push_back(out);
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(LINK_TIMEOUT_MS);
+}
+
+bool UnixSocketLink::finish(Serial& port, BYTE& in) {
+    read_inbox(port);
+    if (!replied && std::chrono::steady_clock::now() < deadline) {
+        return false;
+    }
+    in = replied ? reply : 0xFF;
+    waiting = false;
+    replied = false;
+    return true;
+}
+
+void UnixSocketLink::poll(Serial& port) {
+    read_inbox(port);
+}
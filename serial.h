@@ -0,0 +1,126 @@
+#pragma once
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+
+#define SERIAL_TRANSFER_CYCLES 4096 // 8 bits at 8192 Hz
+#define SERIAL_POLL_CYCLES 512      // one bit time
+
+class Serial;
+
+// transport between the serial ports of two consoles
+class SerialLink {
+    public:
+        virtual ~SerialLink() {}
+        // this end drives the clock and a transfer of out has started...
+        virtual void start(BYTE out) = 0;
+        // ...and its time is up: in is the byte shifted in from the other
+        // end. False if that hasn't come yet, the transfer then runs on.
+        virtual bool finish(Serial& port, BYTE& in) = 0;
+        // service transfers clocked by the other end
+        virtual void poll(Serial& port) {}
+        // send what has been queued, once a frame
+        virtual void flush() {}
+};
+
+// both consoles live in the same process and are stepped by the same
+// thread, so the other port can be clocked directly; given a fixed stepping
+// order this is fully deterministic. It keeps no state of its own, so
+// saving both ports saves the cable too.
+class LocalLink : public SerialLink {
+    public:
+        LocalLink(Serial* peer) : peer(peer) {}
+        void start(BYTE out) override {}
+        bool finish(Serial& port, BYTE& in) override;
+    private:
+        Serial* peer;
+};
+
+// plug a cable between two ports of the same process
+void connect_local(Serial& a, Serial& b);
+
+// two processes on the same host talking over a unix domain stream socket;
+// every message is a tag byte, the number of the transfer it belongs to and
+// data. Messages are queued and sent once a frame, and the emulation never
+// waits on the other end: a transfer this end clocks runs on until the
+// reply is in, or reads 0xFF if none came within LINK_TIMEOUT_MS. A reply
+// that comes later than that is told apart by its number and dropped.
+class UnixSocketLink : public SerialLink {
+    public:
+        static std::unique_ptr<UnixSocketLink> listen(const std::string& path);
+        static std::unique_ptr<UnixSocketLink> connect(const std::string& path);
+        ~UnixSocketLink();
+        void start(BYTE out) override;
+        bool finish(Serial& port, BYTE& in) override;
+        void poll(Serial& port) override;
+        void flush() override;
+
+    private:
+        UnixSocketLink(int fd) : fd(fd) {}
+        void receive();
+        // handle what has come in; replies are kept for finish()
+        void read_inbox(Serial& port);
+
+        int fd;
+        std::vector<BYTE> outbox;
+        std::vector<BYTE> inbox;
+        size_t inbox_pos = 0;
+        // the transfer this end clocks
+        BYTE transfer = 0;
+        bool waiting = false;
+        bool replied = false;
+        BYTE reply = 0xFF;
+        std::chrono::steady_clock::time_point deadline;
+};
+
+class Serial {
+    public:
+        void reset();
+        BYTE read(WORD addr);
+        void write(WORD addr, BYTE data);
+
+        // cheap per-instruction hook, only does work while a transfer is
+        // armed. cycles are of the 4.19MHz clock, four to a machine cycle.
+        inline void update(CPU& cpu, int cycles) {
+            if ((sc & 0x80) || irq) {
+                step(cpu, cycles);
+            }
+        }
+        // cycles until update() next has work, for skipping idle time
+        inline int idle_cycles() {
+            if (irq) {
+                return 0;
+            }
+            if ((sc & 0b10000001) == 0b10000001) {
+                return remaining;
+            }
+            if ((sc & 0b10000000) && link) {
+                return poll_delay;
+            }
+            return INT_MAX;
+        }
+        // service the other end even while no transfer is armed and send
+        // what the link queued, once per frame
+        void poll();
+        // the other end clocked a byte in, returns the byte shifted out
+        BYTE clock_external(BYTE in);
+        // take over another port's registers, the cable stays as it is
+        void copy_state(const Serial& other);
+        // the byte the current transfer on the internal clock started with
+        BYTE outgoing() const { return out; }
+
+        std::unique_ptr<SerialLink> link;
+
+    private:
+        void step(CPU& cpu, int cycles);
+
+        BYTE sb = 0x00;
+        BYTE sc = 0x00;
+        BYTE out = 0xFF;
+        int remaining = 0;  // clocks left in a transfer on the internal clock
+        int poll_delay = 0;
+        bool irq = false;   // a transfer completed from the other end's clock
+};
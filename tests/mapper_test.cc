@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <vector>
+#include "cpu.h"
+#include "mapper.h"
+
+// bank switching for each controller, on roms made up here: the first two
+// bytes of every bank hold its number, so reads show what is mapped
+
+static int failures = 0;
+
+static void check(bool ok, const char* mbc, const char* what) {
+    if (!ok) {
+        printf("%s: %s\n", mbc, what);
+        failures++;
+    }
+}
+
+static std::vector<BYTE> make_rom(BYTE type, int banks, BYTE ram_code) {
+    std::vector<BYTE> rom(banks * ROM_BANK_SIZE);
+    for (int bank = 0; bank < banks; bank++) {
+        rom[bank * ROM_BANK_SIZE] = bank & 0xFF;
+        rom[bank * ROM_BANK_SIZE + 1] = bank >> 8;
+    }
+    rom[0x147] = type;
+    rom[0x149] = ram_code;
+    return rom;
+}
+
+// the bank mapped at 0x4000 (or 0x0000)
+static int bank_at(CPU& cpu, WORD addr) {
+    return cpu.read_mem(addr) | (cpu.read_mem(addr + 1) << 8);
+}
+
+static void mbc1() {
+    std::vector<BYTE> rom = make_rom(0x03, 128, 0x03); // 2MB, 32KB ram
+    CPU cpu(rom.data(), rom.size());
+    check(bank_at(cpu, 0x4000) == 1, "mbc1", "bank 1 at start");
+    cpu.write_mem(0x2000, 0x00);
+    check(bank_at(cpu, 0x4000) == 1, "mbc1", "bank 0 selects 1");
+    cpu.write_mem(0x2000, 0x05);
+    check(bank_at(cpu, 0x4000) == 5, "mbc1", "bank 5");
+    cpu.write_mem(0x4000, 0x02);
+    check(bank_at(cpu, 0x4000) == 0x45, "mbc1", "upper bits");
+    check(bank_at(cpu, 0x0000) == 0, "mbc1", "bank 0 at 0x0000 in mode 0");
+    cpu.write_mem(0x6000, 0x01);
+    check(bank_at(cpu, 0x0000) == 0x40, "mbc1", "upper bits at 0x0000 in mode 1");
+
+    check(cpu.read_mem(0xA000) == 0xFF, "mbc1", "ram disabled reads 0xFF");
+    cpu.write_mem(0x0000, 0x0A);
+    cpu.write_mem(0xA000, 0x22); // ram bank 2 in mode 1
+    cpu.write_mem(0x4000, 0x01);
+    cpu.write_mem(0xA000, 0x11);
+    cpu.write_mem(0x4000, 0x02);
+    check(cpu.read_mem(0xA000) == 0x22, "mbc1", "ram bank 2");
+    cpu.write_mem(0x6000, 0x00);
+    check(cpu.read_mem(0xA000) == 0x00, "mbc1", "ram bank 0 in mode 0");
+}
+
+static void mbc2() {
+    std::vector<BYTE> rom = make_rom(0x06, 16, 0x00);
+    CPU cpu(rom.data(), rom.size());
+    check(cpu.mapper->ram_size == 0x200, "mbc2", "512 cells of ram");
+    cpu.write_mem(0x2100, 0x03);
+    check(bank_at(cpu, 0x4000) == 3, "mbc2", "bank 3");
+    cpu.write_mem(0x2100, 0x00);
+    check(bank_at(cpu, 0x4000) == 1, "mbc2", "bank 0 selects 1");
+    cpu.write_mem(0x2000, 0x07); // bit 8 clear: ram enable, not the bank
+    check(bank_at(cpu, 0x4000) == 1, "mbc2", "address bit 8 picks the register");
+
+    cpu.write_mem(0x0000, 0x0A);
+    cpu.write_mem(0xA005, 0x37);
+    check(cpu.read_mem(0xA005) == 0xF7, "mbc2", "4 bit cells");
+    check(cpu.read_mem(0xA205) == 0xF7 && cpu.read_mem(0xBE05) == 0xF7, "mbc2", "mirrored");
+    cpu.write_mem(0x0000, 0x00);
+    check(cpu.read_mem(0xA005) == 0xFF, "mbc2", "ram disabled reads 0xFF");
+}
+
+static void mbc3() {
+    std::vector<BYTE> rom = make_rom(0x10, 128, 0x03); // timer, ram and battery
+    CPU cpu(rom.data(), rom.size());
+    cpu.write_mem(0x2000, 0x7F);
+    check(bank_at(cpu, 0x4000) == 0x7F, "mbc3", "bank 0x7F");
+    cpu.write_mem(0x2000, 0x00);
+    check(bank_at(cpu, 0x4000) == 1, "mbc3", "bank 0 selects 1");
+
+    cpu.write_mem(0x0000, 0x0A);
+    for (int bank = 0; bank < 4; bank++) {
+        cpu.write_mem(0x4000, bank);
+        cpu.write_mem(0xA000, 0x10 + bank);
+    }
+    bool banked = true;
+    for (int bank = 0; bank < 4; bank++) {
+        cpu.write_mem(0x4000, bank);
+        banked &= cpu.read_mem(0xA000) == 0x10 + bank;
+    }
+    check(banked, "mbc3", "four ram banks");
+
+    cpu.write_mem(0x4000, 0x08); // seconds
+    cpu.write_mem(0xA000, 5);
+    cpu.mapper->tick(RTC_CLOCK_RATE * 3);
+    check(cpu.read_mem(0xA000) == 5, "mbc3", "clock reads latched");
+    cpu.write_mem(0x6000, 0x00);
+    cpu.write_mem(0x6000, 0x01);
+    check(cpu.read_mem(0xA000) == 8, "mbc3", "clock counts seconds");
+}
+
+static void mbc5() {
+    std::vector<BYTE> rom = make_rom(0x1B, 512, 0x04); // 8MB, 128KB ram
+    CPU cpu(rom.data(), rom.size());
+    cpu.write_mem(0x2000, 0x00);
+    check(bank_at(cpu, 0x4000) == 0, "mbc5", "bank 0 can be mapped high");
+    cpu.write_mem(0x2000, 0x23);
+    cpu.write_mem(0x3000, 0x01);
+    check(bank_at(cpu, 0x4000) == 0x123, "mbc5", "ninth bank bit");
+
+    cpu.write_mem(0x0000, 0x0A);
+    cpu.write_mem(0x4000, 0x0F);
+    cpu.write_mem(0xBFFF, 0x5A);
+    cpu.write_mem(0x4000, 0x00);
+    check(cpu.read_mem(0xBFFF) == 0x00, "mbc5", "ram bank 0");
+    cpu.write_mem(0x4000, 0x0F);
+    check(cpu.read_mem(0xBFFF) == 0x5A, "mbc5", "ram bank 15");
+}
+
+int main() {
+    mbc1();
+    mbc2();
+    mbc3();
+    mbc5();
+    if (failures) {
+        printf("mapper_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("mapper_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+#include "netplay.h"
+
+// two netplay hosts in one process, a thread each, talking over loopback
+// with latency added so inputs are guessed and rolled back. Both play
+// tetris against each other with their own random input, and must agree
+// on the hash of both consoles after every settled frame
+
+#define FRAMES 600
+#define LATENCY_MS 40
+#define FIRST_PORT 47310
+
+struct Host {
+    GameBoy consoles[2];
+    std::unique_ptr<Netplay> net;
+    unsigned seed;
+    bool ok = true;
+    // what the host saw, kept once it has gone
+    long settled = 0;
+    long rollbacks = 0;
+    long desync_frame = -1;
+    uint64_t hashes[INPUT_RING];
+};
+
+static void play(Host& host) {
+    BYTE pad = 0xFF;
+    long next_pad = 0;
+    // enough frames past FRAMES for every one of those to be settled at the end
+    for (long i = 0; i < FRAMES + 2 * MAX_ROLLBACK; i++) {
+        if (i < FRAMES && i >= next_pad) {
+            host.seed = host.seed * 1103515245 + 12345;
+            pad = (host.seed >> 16) & 1 ? 0xFF : ~(1 << ((host.seed >> 17) & 7));
+            next_pad = i + 1 + ((host.seed >> 20) & 15);
+        } else if (i >= FRAMES) {
+            pad = 0xFF;
+        }
+        if (!host.net->run_frame(pad)) {
+            host.ok = false;
+            break;
+        }
+    }
+    Netplay& net = *host.net;
+    host.settled = net.settled();
+    host.rollbacks = net.rollbacks;
+    host.desync_frame = net.desync_frame;
+    for (long at = host.settled - INPUT_RING; at < host.settled; at++) {
+        net.settled_hash(at, host.hashes[at % INPUT_RING]);
+    }
+    host.net.reset(); // lingers until the other host has our last inputs
+}
+
+int main() {
+    Host hosts[2];
+    for (int player = 0; player < 2; player++) {
+        Host& host = hosts[player];
+        for (int i = 0; i < 2; i++) {
+            if (!host.consoles[i].load_rom("tetris.gb")) {
+                return 1;
+            }
+            host.consoles[i].apu.output = nullptr;
+        }
+        GameBoy* consoles[2] = {&host.consoles[0], &host.consoles[1]};
+        char peer[32];
+        snprintf(peer, sizeof(peer), "127.0.0.1:%d", FIRST_PORT + 1 - player);
+        host.net = Netplay::open(consoles, player, FIRST_PORT + player, peer, LATENCY_MS);
+        if (!host.net) {
+            return 1;
+        }
+        host.seed = 1 + player;
+    }
+    std::thread other(play, std::ref(hosts[1]));
+    play(hosts[0]);
+    other.join();
+
+    int failures = 0;
+    for (int player = 0; player < 2; player++) {
+        Host& host = hosts[player];
+        if (!host.ok || host.settled < FRAMES) {
+            printf("netplay_test: player %d settled %ld of %d frames\n", player + 1, host.settled, FRAMES);
+            failures++;
+        }
+        if (host.desync_frame >= 0) {
+            printf("netplay_test: player %d saw a desync at frame %ld\n", player + 1, host.desync_frame);
+            failures++;
+        }
+    }
+    // the last frames both still hold hashes of
+    long last = std::min(hosts[0].settled, hosts[1].settled);
+    long first = std::max(hosts[0].settled, hosts[1].settled) - INPUT_RING;
+    long compared = 0;
+    for (long at = std::max(first, 0L); at < last; at++) {
+        uint64_t a = hosts[0].hashes[at % INPUT_RING];
+        uint64_t b = hosts[1].hashes[at % INPUT_RING];
+        if (a != b) {
+            printf("netplay_test: frame %ld hashes %016" PRIx64 " and %016" PRIx64 "\n", at, a, b);
+            failures++;
+            break;
+        }
+        compared++;
+    }
+    if (!compared) {
+        printf("netplay_test: no settled frames to compare\n");
+        failures++;
+    }
+    long rollbacks = hosts[0].rollbacks + hosts[1].rollbacks;
+    if (!rollbacks) {
+        printf("netplay_test: nothing was rolled back, the latency isn't being felt\n");
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("netplay_test: ok (%ld frames compared, %ld run again)\n", compared, rollbacks);
+    return 0;
+}
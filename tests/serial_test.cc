@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "serial.h"
+
+// a byte each way between two ports, first over a local cable, then over a
+// unix socket with both ends stepped by this thread in turn, as two
+// processes would be a frame at a time. The socket ends see each other's
+// messages only after the sender's end of frame.
+
+#define FRAME_CYCLES 70224
+
+static int failures = 0;
+
+static void check(bool ok, const char* link, const char* what) {
+    if (!ok) {
+        printf("serial_test: %s: %s\n", link, what);
+        failures++;
+    }
+}
+
+struct Port {
+    CPU cpu;
+    Serial serial;
+    Port(std::vector<BYTE>& rom) : cpu(rom.data(), rom.size()) {}
+
+    // arm a transfer of out, on the internal clock or waiting for the other end
+    void arm(BYTE out, bool internal) {
+        serial.write(0xFF01, out);
+        serial.write(0xFF02, internal ? 0x81 : 0x80);
+    }
+    bool busy() { return serial.read(0xFF02) & 0x80; }
+    BYTE received() { return serial.read(0xFF01); }
+    // a frame of a console doing nothing else...
+    void frame() {
+        for (int cycles = 0; cycles < FRAME_CYCLES; cycles += 16) {
+            serial.update(cpu, 16);
+        }
+    }
+    // ...and its end
+    void end_frame() { serial.poll(); }
+};
+
+static void local(std::vector<BYTE>& rom) {
+    Port a(rom), b(rom);
+    connect_local(a.serial, b.serial);
+    b.arm(0x99, false);
+    a.arm(0x42, true);
+    a.frame();
+    a.end_frame();
+    check(!a.busy() && !b.busy(), "local", "transfer done within a frame");
+    check(a.received() == 0x99 && b.received() == 0x42, "local", "bytes swapped");
+}
+
+// step a and b until a's transfer is done, false after frames. b's whole
+// frame falls within the end of a's, so whatever b sends comes in as a
+// ends its frame rather than while a is running.
+static bool run(Port& a, Port& b, int frames) {
+    for (int i = 0; i < frames && a.busy(); i++) {
+        a.frame();
+        b.frame();
+        b.end_frame();
+        a.end_frame();
+    }
+    return !a.busy();
+}
+
+static void socket(std::vector<BYTE>& rom) {
+    std::string path = "/tmp/serial_test_" + std::to_string(getpid());
+    Port a(rom), b(rom);
+    std::thread listener([&] { a.serial.link = UnixSocketLink::listen(path); });
+    for (int tries = 0; tries < 100 && !b.serial.link; tries++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        b.serial.link = UnixSocketLink::connect(path);
+    }
+    listener.join();
+    if (!a.serial.link || !b.serial.link) {
+        check(false, "socket", "couldn't connect");
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    b.arm(0x99, false);
+    a.arm(0x42, true);
+    check(run(a, b, 10), "socket", "transfer done within 10 frames");
+    auto took = std::chrono::steady_clock::now() - start;
+    check(a.received() == 0x99 && b.received() == 0x42, "socket", "bytes swapped");
+    check(took < std::chrono::milliseconds(100), "socket", "reply taken without waiting for the timeout");
+
+    // b stays away until a gives up, so its reply comes late...
+    b.arm(0x55, false);
+    a.arm(0x11, true);
+    start = std::chrono::steady_clock::now();
+    while (a.busy() && std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+        a.frame();
+        a.end_frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    check(!a.busy() && a.received() == 0xFF, "socket", "silent partner reads 0xFF");
+    // ...and must not be taken for the answer to the next transfer
+    a.arm(0x22, true);
+    check(run(a, b, 10), "socket", "transfer after a timeout done");
+    check(a.received() == 0x11, "socket", "late reply dropped, this transfer's reply kept");
+}
+
+int main() {
+    std::vector<BYTE> rom(0x8000);
+    local(rom);
+    socket(rom);
+    if (failures) {
+        return 1;
+    }
+    printf("serial_test: ok\n");
+    return 0;
+}
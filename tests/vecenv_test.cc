@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "capi.h"
+
+// a batch of tetris consoles stepped through the C interface, each with
+// its own random input, against as many single consoles given the same
+// input frame by frame. Observations must match their pictures and ram,
+// including across an episode starting over
+
+#define ENVS 4
+#define FRAMES_PER_STEP 4
+#define STEPS 150
+#define MAX_FRAMES 360
+
+static const uint16_t watched[] = {0xC000, 0xFF40, 0xFF44, 0xFF80};
+#define WATCHED (sizeof(watched) / sizeof(watched[0]))
+#define PICTURE (GB_SCREEN_WIDTH * GB_SCREEN_HEIGHT)
+
+static int failures = 0;
+
+// obs holds console i's picture and watched ram
+static void compare(const uint8_t* obs, gb_console* gb, int i, int step) {
+    if (memcmp(obs, gb_framebuffer(gb), PICTURE) != 0) {
+        printf("vecenv_test: env %d picture differs at step %d\n", i, step);
+        failures++;
+        return;
+    }
+    for (size_t w = 0; w < WATCHED; w++) {
+        if (obs[PICTURE + w] != gb_read_mem(gb, watched[w])) {
+            printf("vecenv_test: env %d byte %04X differs at step %d\n", i, watched[w], step);
+            failures++;
+            return;
+        }
+    }
+}
+
+int main() {
+    gb_vecenv* env = gb_vecenv_create("tetris.gb", ENVS, FRAMES_PER_STEP, 2, 0);
+    if (!env) {
+        return 1;
+    }
+    gb_vecenv_set_obs_mode(env, GB_OBS_GRAY);
+    gb_vecenv_watch_ram(env, watched, WATCHED);
+    gb_vecenv_set_max_frames(env, MAX_FRAMES);
+    size_t stride = gb_vecenv_obs_size(env);
+    if (gb_vecenv_size(env) != ENVS || stride != PICTURE + WATCHED) {
+        printf("vecenv_test: %d envs with %zu byte observations\n", gb_vecenv_size(env), stride);
+        return 1;
+    }
+
+    gb_console* singles[ENVS];
+    gb_state* boot = gb_state_create();
+    for (int i = 0; i < ENVS; i++) {
+        singles[i] = gb_create();
+        if (!gb_load_rom(singles[i], "tetris.gb")) {
+            return 1;
+        }
+    }
+    gb_save_state(singles[0], boot);
+
+    std::vector<uint8_t> obs(ENVS * stride), boot_obs(stride);
+    uint8_t dones[ENVS];
+    gb_vecenv_reset(env, obs.data());
+    for (int i = 0; i < ENVS; i++) {
+        compare(&obs[i * stride], singles[i], i, 0);
+    }
+    memcpy(boot_obs.data(), obs.data(), stride);
+
+    unsigned seed = 1;
+    uint8_t buttons[ENVS];
+    int16_t audio[4096 * 2]; // drained and dropped
+    int episodes = 0;
+    for (int step = 1; step <= STEPS && !failures; step++) {
+        for (int i = 0; i < ENVS; i++) {
+            seed = seed * 1103515245 + 12345;
+            buttons[i] = (seed >> 16) & 1 ? 0 : 1 << ((seed >> 17) & 7);
+        }
+        gb_vecenv_step(env, buttons, obs.data(), dones);
+        for (int i = 0; i < ENVS; i++) {
+            gb_set_input(singles[i], buttons[i]);
+            for (int f = 0; f < FRAMES_PER_STEP; f++) {
+                gb_run_frame(singles[i]);
+                gb_read_audio(singles[i], audio, sizeof(audio) / 4);
+            }
+            bool over = step * FRAMES_PER_STEP % MAX_FRAMES == 0;
+            if (dones[i] != over) {
+                printf("vecenv_test: env %d done is %d at step %d\n", i, dones[i], step);
+                failures++;
+                break;
+            }
+            if (over) {
+                // the start state's picture, not what the single console has yet
+                if (memcmp(&obs[i * stride], boot_obs.data(), stride) != 0) {
+                    printf("vecenv_test: env %d didn't start over at step %d\n", i, step);
+                    failures++;
+                    break;
+                }
+                gb_load_state(singles[i], boot);
+                episodes++;
+                continue;
+            }
+            compare(&obs[i * stride], singles[i], i, step);
+        }
+    }
+
+    for (int i = 0; i < ENVS; i++) {
+        gb_destroy(singles[i]);
+    }
+    gb_state_destroy(boot);
+    gb_vecenv_destroy(env);
+    if (failures) {
+        return 1;
+    }
+    printf("vecenv_test: ok (%d envs, %d steps, %d episodes ended)\n", ENVS, STEPS, episodes);
+    return 0;
+}
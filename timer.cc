@@ -0,0 +1,102 @@
+#include "timer.h"
+
+#define DIV_AFTER_BOOT 0xABCC // internal counter when the boot rom hands over
+
+void Timer::reset(CPU& cpu) {
+    div_start = cpu.clock - DIV_AFTER_BOOT;
+    tima_time = cpu.clock;
+    tima = 0;
+    tma = 0;
+    tac = 0;
+    schedule();
+}
+
+// falling edges of the selected counter bit in (from, to]
+int Timer::edges(uint64_t from, uint64_t to) {
+    return (to - div_start) / period() - (from - div_start) / period();
+}
+
+void Timer::sync(uint64_t now) {
+    if (enabled()) {
+        tima += edges(tima_time, now); // never reaches an overflow, that's next_event
+    }
+    tima_time = now;
+}
+
+void Timer::increment(CPU& cpu) {
+    if (tima == 0xFF) {
+        tima = tma;
+        cpu.interrupt(2);
+    } else {
+        tima++;
+    }
+}
+
+void Timer::schedule() {
+    if (!enabled()) {
+        next_event = UINT64_MAX;
+        return;
+    }
+    // the edge that takes tima past 0xFF
+    uint64_t edge = (tima_time - div_start) / period() + (0x100 - tima);
+    next_event = div_start + edge * period();
+}
+
+void Timer::update(CPU& cpu) {
+    while (cpu.clock >= next_event) {
+        tima = tma;
+        tima_time = next_event;
+        cpu.interrupt(2);
+        schedule();
+    }
+}
+
+uint64_t Timer::next_change(uint64_t now, bool tima) {
+    if (!tima) {
+        return now + 256 - (counter(now) & 0xFF);
+    }
+    if (!enabled()) {
+        return UINT64_MAX;
+    }
+    return div_start + ((now - div_start) / period() + 1) * period();
+}
+
+BYTE Timer::read(CPU& cpu, WORD addr) {
+    switch (addr) {
+        case 0xFF04: return counter(cpu.clock) >> 8;
+        case 0xFF05: sync(cpu.clock); return tima;
+        case 0xFF06: return tma;
+        default: return tac | 0b11111000;
+    }
+}
+
+void Timer::write(CPU& cpu, WORD addr, BYTE data) {
+    uint64_t now = cpu.clock;
+    sync(now);
+    switch (addr) {
+        case 0xFF04:
+            // clearing the counter is a falling edge if the selected bit was set
+            if (enabled() && (counter(now) & (period() / 2))) {
+                increment(cpu);
+            }
+            div_start = now;
+            break;
+        case 0xFF05:
+            tima = data;
+            break;
+        case 0xFF06:
+            tma = data;
+            break;
+        case 0xFF07: {
+            // the increment signal is (bit & enable), it can fall from either
+            bool before = enabled() && (counter(now) & (period() / 2));
+            tac = data & 0b111;
+            bool after = enabled() && (counter(now) & (period() / 2));
+            if (before && !after) {
+                increment(cpu);
+            }
+            break;
+        }
+    }
+    schedule();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include "cpu.h"
+
+// DIV is the top byte of a 16-bit counter running at 4.19MHz, and TIMA
+// counts falling edges of one of its bits (picked by TAC). Neither is
+// stepped: DIV is read straight off cpu.clock, TIMA is kept as its value at
+// some cycle plus the edges since, and the cycle it next overflows is worked
+// out ahead and left in next_event.
+class Timer {
+    public:
+        void reset(CPU& cpu);
+        // handle an overflow due by cpu.clock
+        void update(CPU& cpu);
+        BYTE read(CPU& cpu, WORD addr);
+        void write(CPU& cpu, WORD addr, BYTE data);
+        // the next cycle DIV (or TIMA) reads differently
+        uint64_t next_change(uint64_t now, bool tima);
+
+        uint64_t next_event = UINT64_MAX;
+
+    private:
+        inline WORD counter(uint64_t now) { return now - div_start; }
+        // cycles between TIMA increments for the current TAC
+        inline int period() {
+            static const int periods[4] = {1024, 16, 64, 256};
+            return periods[tac & 3];
+        }
+        inline bool enabled() { return tac & 0b100; }
+        int edges(uint64_t from, uint64_t to);
+        // bring tima up to now
+        void sync(uint64_t now);
+        void increment(CPU& cpu);
+        void schedule();
+
+        uint64_t div_start = 0; // cycle the counter was last 0
+        uint64_t tima_time = 0; // cycle tima was last brought up to date
+        BYTE tima = 0;
+        BYTE tma = 0;
+        BYTE tac = 0;
+};
@@ -0,0 +1,150 @@
+#include "vecenv.h"
+#include <algorithm>
+#include <cstring>
+
+std::unique_ptr<VecEnv> VecEnv::open(const std::string& rom_name, int count, int frames_per_step,
+                                     int threads, int boot_frames) {
+    std::unique_ptr<VecEnv> env(new VecEnv());
+    env->pool = ConsolePool::open(rom_name, count, boot_frames);
+    if (!env->pool) {
+        return nullptr;
+    }
+    env->frames_per_step = std::max(frames_per_step, 1);
+    env->episode_frames.assign(count, 0);
+
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    threads = std::min(threads, count);
+    for (int i = 1; i < threads; i++) { // the caller is one of them
+        env->threads.emplace_back(&VecEnv::worker, env.get());
+    }
+    return env;
+}
+
+VecEnv::~VecEnv() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t VecEnv::obs_size() const {
+    size_t pixels = 160 * 144;
+    switch (obs_mode) {
+        case OBS_RGB: pixels *= 3; break;
+        case OBS_GRAY: break;
+        case OBS_GRAY_HALF: pixels /= 4; break;
+    }
+    return pixels + ram_addrs.size();
+}
+
+void VecEnv::step(const BYTE* actions, BYTE* obs, BYTE* dones) {
+    size_t stride = obs_size();
+    parallel([&](int i) {
+        GameBoy& gb = (*pool)[i];
+        gb.cpu.set_joypad(actions[i]);
+        for (int f = 0; f < frames_per_step; f++) {
+            gb.ppu.skip = f < frames_per_step - 1; // only the last one is looked at
+            gb.run_frame();
+        }
+        gb.ppu.skip = false;
+        episode_frames[i] += frames_per_step;
+        bool over = (max_frames && episode_frames[i] >= max_frames) || (done && done(gb));
+        if (over) {
+            reset_env(i);
+        }
+        if (dones) {
+            dones[i] = over;
+        }
+        observe(i, obs + i * stride);
+    });
+}
+
+void VecEnv::reset(BYTE* obs) {
+    size_t stride = obs_size();
+    parallel([&](int i) {
+        reset_env(i);
+        observe(i, obs + i * stride);
+    });
+}
+
+void VecEnv::reset_env(int i) {
+    pool->reset(i);
+    episode_frames[i] = 0;
+}
+
+void VecEnv::observe(int i, BYTE* out) {
+    GameBoy& gb = (*pool)[i];
+    switch (obs_mode) {
+        case OBS_RGB:
+            for (int y = 0; y < 144; y++) {
+                for (int x = 0; x < 160; x++) {
+                    BYTE grey = gb.cpu.screen[y][x];
+                    *out++ = grey;
+                    *out++ = grey;
+                    *out++ = grey;
+                }
+            }
+            break;
+        case OBS_GRAY:
+            memcpy(out, gb.cpu.screen, sizeof(gb.cpu.screen));
+            out += sizeof(gb.cpu.screen);
+            break;
+        case OBS_GRAY_HALF:
+            for (int y = 0; y < 144; y += 2) {
+                for (int x = 0; x < 160; x += 2) {
+                    *out++ = (gb.cpu.screen[y][x] + gb.cpu.screen[y][x + 1] +
+                              gb.cpu.screen[y + 1][x] + gb.cpu.screen[y + 1][x + 1]) / 4;
+                }
+            }
+            break;
+    }
+    for (WORD addr : ram_addrs) {
+        *out++ = gb.cpu.peek(addr);
+    }
+}
+
+void VecEnv::parallel(const std::function<void(int)>& fn) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        job = &fn;
+        next = 0;
+        busy = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+    for (int i; (i = next++) < size();) {
+        fn(i);
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [&] { return busy == 0; });
+    job = nullptr;
+}
+
+void VecEnv::worker() {
+    long seen = 0;
+    while (true) {
+        const std::function<void(int)>* fn;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            fn = job;
+        }
+        for (int i; (i = next++) < size();) {
+            (*fn)(i);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        if (--busy == 0) {
+            finished.notify_one();
+        }
+    }
+}
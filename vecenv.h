@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gameboy.h"
+#include "pool.h"
+
+// what each console's observation holds, followed by the watched ram bytes
+enum ObsMode {
+    OBS_RGB,       // 160x144x3
+    OBS_GRAY,      // 160x144
+    OBS_GRAY_HALF, // 80x72, 2x2 averaged
+};
+
+// a batch of consoles running the same rom for training agents. step()
+// runs every console a few frames on a pool of threads and writes all the
+// observations into one caller owned buffer. The consoles come from a
+// ConsolePool, so episodes start from a state saved once after boot.
+class VecEnv {
+    public:
+        // boot_frames are run once (with no input) before the start state is
+        // taken, e.g. to get past logos; threads 0 picks one per core
+        static std::unique_ptr<VecEnv> open(const std::string& rom_name, int count,
+                                            int frames_per_step = 4, int threads = 0,
+                                            int boot_frames = 0);
+        ~VecEnv();
+
+        // set up before stepping
+        void set_obs_mode(ObsMode mode) { obs_mode = mode; }
+        void watch_ram(const std::vector<WORD>& addrs) { ram_addrs = addrs; }
+        // an episode ends when this says so, or after max_frames (0 for never)
+        std::function<bool(GameBoy&)> done;
+        long max_frames = 0;
+
+        // bytes of one console's observation in the step() buffer
+        size_t obs_size() const;
+        int size() const { return pool->size(); }
+
+        // hold actions[i] (as cpu.joypad_state, a 0 bit is held) on console i
+        // for frames_per_step frames, then write observations to obs
+        // (size() * obs_size() bytes). A console whose episode ended is
+        // reset, it gets dones[i] = 1 (if dones is given) and the
+        // observation is of the new episode.
+        void step(const BYTE* actions, BYTE* obs, BYTE* dones = nullptr);
+        // start every episode over and observe
+        void reset(BYTE* obs);
+
+        GameBoy& env(int i) { return (*pool)[i]; }
+
+    private:
+        VecEnv() {}
+        void worker();
+        // run fn(i) for every console across the pool
+        void parallel(const std::function<void(int)>& fn);
+        void reset_env(int i);
+        void observe(int i, BYTE* out);
+
+        int frames_per_step = 4;
+        ObsMode obs_mode = OBS_RGB;
+        std::vector<WORD> ram_addrs;
+
+        std::unique_ptr<ConsolePool> pool;
+        std::vector<long> episode_frames;
+
+        std::vector<std::thread> threads;
+        std::mutex lock;
+        std::condition_variable wake, finished;
+        const std::function<void(int)>* job = nullptr;
+        long generation = 0;
+        std::atomic<int> next{0};
+        int busy = 0;
+        bool stopping = false;
+};